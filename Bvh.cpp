@@ -0,0 +1,284 @@
+#include "Bvh.hpp"
+
+#include <algorithm>
+#include <cfloat>
+
+namespace gps {
+
+    static float surfaceArea(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+
+        glm::vec3 extent = boxMax - boxMin;
+        return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+    }
+
+    void Bvh::build(const std::vector<Aabb>& itemBounds) {
+
+        bounds = itemBounds;
+        nodes.clear();
+        itemOrder.resize(bounds.size());
+
+        if (bounds.empty()) {
+            return;
+        }
+
+        std::vector<glm::vec3> centroids(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++) {
+
+            itemOrder[i] = (uint32_t)i;
+            centroids[i] = (bounds[i].min + bounds[i].max) * 0.5f;
+        }
+
+        // a binary tree over n leaves has at most 2n - 1 nodes
+        nodes.reserve(2 * bounds.size() - 1);
+
+        Node root;
+        root.leftFirst = 0;
+        root.count = (uint32_t)bounds.size();
+        nodes.push_back(root);
+
+        updateNodeBounds(0);
+        subdivide(0, centroids);
+    }
+
+    void Bvh::updateNodeBounds(uint32_t nodeIndex) {
+
+        Node& node = nodes[nodeIndex];
+        node.min = glm::vec3(FLT_MAX);
+        node.max = glm::vec3(-FLT_MAX);
+
+        for (uint32_t i = 0; i < node.count; i++) {
+
+            const Aabb& box = bounds[itemOrder[node.leftFirst + i]];
+            node.min = glm::min(node.min, box.min);
+            node.max = glm::max(node.max, box.max);
+        }
+    }
+
+    float Bvh::findSplit(const Node& node, const std::vector<glm::vec3>& centroids, int& axis, float& position) const {
+
+        struct Bin {
+            glm::vec3 min;
+            glm::vec3 max;
+            uint32_t count;
+        };
+
+        float bestCost = FLT_MAX;
+
+        for (int a = 0; a < 3; a++) {
+
+            // bins span the centroids, not the boxes, so every bin can receive items
+            float centroidMin = FLT_MAX;
+            float centroidMax = -FLT_MAX;
+            for (uint32_t i = 0; i < node.count; i++) {
+
+                float c = centroids[itemOrder[node.leftFirst + i]][a];
+                centroidMin = std::min(centroidMin, c);
+                centroidMax = std::max(centroidMax, c);
+            }
+
+            if (centroidMax <= centroidMin) {
+                continue;
+            }
+
+            Bin bins[SAH_BINS];
+            for (int b = 0; b < SAH_BINS; b++) {
+
+                bins[b].min = glm::vec3(FLT_MAX);
+                bins[b].max = glm::vec3(-FLT_MAX);
+                bins[b].count = 0;
+            }
+
+            float scale = SAH_BINS / (centroidMax - centroidMin);
+            for (uint32_t i = 0; i < node.count; i++) {
+
+                uint32_t item = itemOrder[node.leftFirst + i];
+                int b = std::min(SAH_BINS - 1, (int)((centroids[item][a] - centroidMin) * scale));
+                bins[b].min = glm::min(bins[b].min, bounds[item].min);
+                bins[b].max = glm::max(bins[b].max, bounds[item].max);
+                bins[b].count++;
+            }
+
+            // sweep from both ends to get the area and count on each side of every plane
+            float leftArea[SAH_BINS - 1], rightArea[SAH_BINS - 1];
+            uint32_t leftCount[SAH_BINS - 1], rightCount[SAH_BINS - 1];
+
+            glm::vec3 leftMin(FLT_MAX), leftMax(-FLT_MAX), rightMin(FLT_MAX), rightMax(-FLT_MAX);
+            uint32_t leftSum = 0, rightSum = 0;
+
+            for (int b = 0; b < SAH_BINS - 1; b++) {
+
+                leftSum += bins[b].count;
+                leftCount[b] = leftSum;
+                leftMin = glm::min(leftMin, bins[b].min);
+                leftMax = glm::max(leftMax, bins[b].max);
+                leftArea[b] = leftSum > 0 ? surfaceArea(leftMin, leftMax) : 0.0f;
+
+                rightSum += bins[SAH_BINS - 1 - b].count;
+                rightCount[SAH_BINS - 2 - b] = rightSum;
+                rightMin = glm::min(rightMin, bins[SAH_BINS - 1 - b].min);
+                rightMax = glm::max(rightMax, bins[SAH_BINS - 1 - b].max);
+                rightArea[SAH_BINS - 2 - b] = rightSum > 0 ? surfaceArea(rightMin, rightMax) : 0.0f;
+            }
+
+            for (int b = 0; b < SAH_BINS - 1; b++) {
+
+                float cost = leftCount[b] * leftArea[b] + rightCount[b] * rightArea[b];
+                if (leftCount[b] > 0 && rightCount[b] > 0 && cost < bestCost) {
+
+                    bestCost = cost;
+                    axis = a;
+                    position = centroidMin + (b + 1) / scale;
+                }
+            }
+        }
+
+        return bestCost;
+    }
+
+    void Bvh::subdivide(uint32_t nodeIndex, const std::vector<glm::vec3>& centroids) {
+
+        if (nodes[nodeIndex].count <= 2) {
+            return;
+        }
+
+        int axis = 0;
+        float position = 0.0f;
+        float splitCost = findSplit(nodes[nodeIndex], centroids, axis, position);
+
+        // stay a leaf when no split beats testing every item, unless the leaf would be too big
+        float leafCost = nodes[nodeIndex].count * surfaceArea(nodes[nodeIndex].min, nodes[nodeIndex].max);
+        if (splitCost == FLT_MAX || (splitCost >= leafCost && nodes[nodeIndex].count <= MAX_LEAF_ITEMS)) {
+            return;
+        }
+
+        uint32_t first = nodes[nodeIndex].leftFirst;
+        uint32_t count = nodes[nodeIndex].count;
+        uint32_t* middle = std::partition(&itemOrder[first], &itemOrder[first] + count,
+            [&](uint32_t item) { return centroids[item][axis] < position; });
+        uint32_t leftCount = (uint32_t)(middle - &itemOrder[first]);
+
+        if (leftCount == 0 || leftCount == count) {
+            return;
+        }
+
+        uint32_t leftIndex = (uint32_t)nodes.size();
+        Node left, right;
+        left.leftFirst = first;
+        left.count = leftCount;
+        right.leftFirst = first + leftCount;
+        right.count = count - leftCount;
+        nodes.push_back(left);
+        nodes.push_back(right);
+
+        nodes[nodeIndex].leftFirst = leftIndex;
+        nodes[nodeIndex].count = 0;
+
+        updateNodeBounds(leftIndex);
+        updateNodeBounds(leftIndex + 1);
+        subdivide(leftIndex, centroids);
+        subdivide(leftIndex + 1, centroids);
+    }
+
+    void Bvh::refit(const std::vector<Aabb>& itemBounds) {
+
+        bounds = itemBounds;
+
+        // children come after their parent, walking backwards visits them first
+        for (size_t i = nodes.size(); i-- > 0; ) {
+
+            Node& node = nodes[i];
+            if (node.count > 0) {
+
+                updateNodeBounds((uint32_t)i);
+            }
+            else {
+
+                const Node& left = nodes[node.leftFirst];
+                const Node& right = nodes[node.leftFirst + 1];
+                node.min = glm::min(left.min, right.min);
+                node.max = glm::max(left.max, right.max);
+            }
+        }
+    }
+
+    void Bvh::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& items) const {
+
+        if (nodes.empty()) {
+            return;
+        }
+
+        // inside entries need no further tests, everything below them is visible
+        struct Entry {
+            uint32_t node;
+            bool inside;
+        };
+        std::vector<Entry> stack;
+        stack.reserve(64);
+        Entry root = { 0, false };
+        stack.push_back(root);
+
+        // items of leaves that cross a plane, tested together once the walk is over
+        leafItems.clear();
+        leafSpheres.clear();
+
+        while (!stack.empty()) {
+
+            Entry entry = stack.back();
+            stack.pop_back();
+            const Node& node = nodes[entry.node];
+
+            bool inside = entry.inside;
+            if (!inside) {
+
+                FrustumTest test = frustum.classifyBox(node.min, node.max);
+                if (test == FRUSTUM_OUTSIDE) {
+                    continue;
+                }
+                inside = test == FRUSTUM_INSIDE;
+            }
+
+            if (node.count > 0) {
+
+                for (uint32_t i = 0; i < node.count; i++) {
+
+                    uint32_t item = itemOrder[node.leftFirst + i];
+                    if (inside) {
+                        items.push_back(item);
+                        continue;
+                    }
+
+                    leafItems.push_back(item);
+                    leafSpheres.push((bounds[item].min + bounds[item].max) * 0.5f,
+                        glm::length(bounds[item].max - bounds[item].min) * 0.5f);
+                }
+            }
+            else {
+
+                Entry right = { node.leftFirst + 1, inside };
+                Entry left = { node.leftFirst, inside };
+                stack.push_back(right);
+                stack.push_back(left);
+            }
+        }
+
+        // the spheres around their boxes four at a time, then the tighter box for the survivors
+        frustum.testSpheres(leafSpheres, leafVisible);
+        for (size_t i = 0; i < leafItems.size(); i++) {
+
+            uint32_t item = leafItems[i];
+            if (leafVisible[i] && frustum.testBox(bounds[item].min, bounds[item].max)) {
+                items.push_back(item);
+            }
+        }
+    }
+
+    size_t Bvh::getItemCount() const {
+
+        return bounds.size();
+    }
+
+    size_t Bvh::getNodeCount() const {
+
+        return nodes.size();
+    }
+}
@@ -0,0 +1,67 @@
+#ifndef Bvh_hpp
+#define Bvh_hpp
+
+#include <glm/glm.hpp>
+
+#include "Frustum.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    struct Aabb {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    // Bounding volume hierarchy over a set of boxes, built with the binned surface area
+    // heuristic. Items are the indices of the boxes given to build(). Moving items only
+    // need refit() while they stay close to where they were built.
+    class Bvh {
+
+    public:
+        void build(const std::vector<Aabb>& itemBounds);
+
+        // Recomputes every node from new item bounds, the tree shape stays the same
+        void refit(const std::vector<Aabb>& itemBounds);
+
+        // Appends the items whose boxes touch the frustum. Items of leaves the frustum cuts
+        // through are tested by their bounding spheres first (Frustum::testSpheres), then by
+        // their boxes.
+        void queryFrustum(const Frustum& frustum, std::vector<uint32_t>& items) const;
+
+        size_t getItemCount() const;
+        size_t getNodeCount() const;
+
+    private:
+        // Interior nodes have count 0 and their children at leftFirst and leftFirst + 1,
+        // leaves hold count entries of itemOrder starting at leftFirst.
+        // Children always come after their parent.
+        struct Node {
+            glm::vec3 min;
+            uint32_t leftFirst;
+            glm::vec3 max;
+            uint32_t count;
+        };
+
+        static const uint32_t MAX_LEAF_ITEMS = 4;
+        static const int SAH_BINS = 12;
+
+        void updateNodeBounds(uint32_t nodeIndex);
+        void subdivide(uint32_t nodeIndex, const std::vector<glm::vec3>& centroids);
+        // Cheapest binned split of the node, returns its SAH cost
+        float findSplit(const Node& node, const std::vector<glm::vec3>& centroids, int& axis, float& position) const;
+
+        std::vector<Node> nodes;
+        std::vector<uint32_t> itemOrder;
+        std::vector<Aabb> bounds;
+
+        // reused by every queryFrustum
+        mutable std::vector<uint32_t> leafItems;
+        mutable BoundingSpheres leafSpheres;
+        mutable std::vector<unsigned char> leafVisible;
+    };
+}
+
+#endif /* Bvh_hpp */
@@ -0,0 +1,298 @@
+#include "DeferredRenderer.hpp"
+#include "GpuMemory.hpp"
+#include "GLStateCache.hpp"
+#include "Layouts.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+namespace gps {
+
+    // tessellation of the light volume sphere
+    static const int SPHERE_SLICES = 16;
+    static const int SPHERE_STACKS = 8;
+
+    static const float PI = 3.14159265f;
+
+    void DeferredRenderer::init(int width, int height) {
+
+        this->width = width;
+        this->height = height;
+        createTargets();
+        createSphere();
+
+        glGenVertexArrays(1, &emptyVertexArray);
+
+        std::cout << "[INFO] Deferred shading: " << width << "x" << height << " G-buffer" << std::endl;
+    }
+
+    void DeferredRenderer::resize(int width, int height) {
+
+        if (framebuffer == 0 || (width == this->width && height == this->height) || width <= 0 || height <= 0) {
+            return;
+        }
+
+        this->width = width;
+        this->height = height;
+        deleteTargets();
+        createTargets();
+    }
+
+    void DeferredRenderer::createTargets() {
+
+        struct Target {
+            GLuint* texture;
+            GLenum internalFormat;
+            GLenum format;
+            GLenum type;
+            int bytesPerPixel;
+        };
+        Target targets[] = {
+            { &albedoTexture, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+            { &normalTexture, GL_RGBA16F, GL_RGBA, GL_FLOAT, 8 },
+            { &specularTexture, GL_SRGB8_ALPHA8, GL_RGBA, GL_UNSIGNED_BYTE, 4 },
+            // the lighting rebuilds positions from it, far away ones need the float precision
+            { &depthTexture, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 4 },
+            { &lightTexture, GL_RGBA16F, GL_RGBA, GL_FLOAT, 8 },
+            // the lighting pass writes the G-buffer depth here for the light volumes to test
+            // against, the G-buffer's own cannot be attached while those passes read it
+            { &lightDepthTexture, GL_DEPTH_COMPONENT32F, GL_DEPTH_COMPONENT, GL_FLOAT, 4 }
+        };
+
+        for (int i = 0; i < 6; i++) {
+
+            glGenTextures(1, targets[i].texture);
+            GLStateCache::get().bindTexture(GL_TEXTURE_2D, *targets[i].texture);
+            glTexImage2D(GL_TEXTURE_2D, 0, targets[i].internalFormat, width, height, 0,
+                targets[i].format, targets[i].type, NULL);
+            GpuMemory::get().track(GPU_MEMORY_RENDER_TARGET, *targets[i].texture,
+                GpuMemory::imageBytes(width, height, 1, targets[i].bytesPerPixel, false));
+
+            // read with texelFetch, one texel per pixel
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        }
+        GLStateCache::get().bindTexture(GL_TEXTURE_2D, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, specularTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+        GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, drawBuffers);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "ERROR: G-buffer framebuffer is not complete\n");
+        }
+
+        glGenFramebuffers(1, &lightFramebuffer);
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, lightFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, lightDepthTexture, 0);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "ERROR: deferred light framebuffer is not complete\n");
+        }
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void DeferredRenderer::deleteTargets() {
+
+        GLuint* textures[] = { &albedoTexture, &normalTexture, &specularTexture, &depthTexture,
+            &lightTexture, &lightDepthTexture };
+        for (int i = 0; i < 6; i++) {
+
+            if (*textures[i] != 0) {
+                GpuMemory::get().release(GPU_MEMORY_RENDER_TARGET, *textures[i]);
+                GLStateCache::get().deleteTextures(1, textures[i]);
+                *textures[i] = 0;
+            }
+        }
+
+        if (framebuffer != 0) {
+            GLStateCache::get().deleteFramebuffers(1, &framebuffer);
+            framebuffer = 0;
+        }
+        if (lightFramebuffer != 0) {
+            GLStateCache::get().deleteFramebuffers(1, &lightFramebuffer);
+            lightFramebuffer = 0;
+        }
+    }
+
+    void DeferredRenderer::createSphere() {
+
+        // the faces of a tessellated unit sphere cut inside it, by at most the angle from a
+        // face's corner to its center; pushing the vertices out by that much keeps every
+        // face outside, so the volume never clips the light's reach
+        float halfSlice = PI / SPHERE_SLICES;
+        float halfStack = PI / (2.0f * SPHERE_STACKS);
+        float scale = 1.0f / std::cos(std::sqrt(halfSlice * halfSlice + halfStack * halfStack));
+
+        std::vector<PositionVertex> vertices;
+        for (int stack = 0; stack <= SPHERE_STACKS; stack++) {
+
+            float latitude = PI * stack / SPHERE_STACKS;
+            for (int slice = 0; slice <= SPHERE_SLICES; slice++) {
+
+                float longitude = 2.0f * PI * slice / SPHERE_SLICES;
+                PositionVertex vertex;
+                vertex.position = scale * glm::vec3(std::sin(latitude) * std::cos(longitude),
+                    std::cos(latitude), std::sin(latitude) * std::sin(longitude));
+                vertices.push_back(vertex);
+            }
+        }
+
+        // counter-clockwise seen from outside, front face culling keeps the inner side
+        std::vector<GLuint> indices;
+        for (int stack = 0; stack < SPHERE_STACKS; stack++) {
+            for (int slice = 0; slice < SPHERE_SLICES; slice++) {
+
+                GLuint topLeft = stack * (SPHERE_SLICES + 1) + slice;
+                GLuint bottomLeft = topLeft + SPHERE_SLICES + 1;
+                indices.push_back(topLeft);
+                indices.push_back(topLeft + 1);
+                indices.push_back(bottomLeft);
+                indices.push_back(topLeft + 1);
+                indices.push_back(bottomLeft + 1);
+                indices.push_back(bottomLeft);
+            }
+        }
+        sphereIndexCount = (GLsizei)indices.size();
+
+        glGenVertexArrays(1, &sphereVertexArray);
+        glGenBuffers(1, &sphereVertexBuffer);
+        glGenBuffers(1, &sphereIndexBuffer);
+
+        GLStateCache::get().bindVertexArray(sphereVertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, sphereVertexBuffer);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(PositionVertex), &vertices[0], GL_STATIC_DRAW);
+        GpuMemory::get().track(GPU_MEMORY_BUFFER, sphereVertexBuffer, vertices.size() * sizeof(PositionVertex));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereIndexBuffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+        GpuMemory::get().track(GPU_MEMORY_BUFFER, sphereIndexBuffer, indices.size() * sizeof(GLuint));
+
+        PositionVertex::setupAttributes();
+
+        GLStateCache::get().bindVertexArray(0);
+    }
+
+    void DeferredRenderer::beginGeometryPass() {
+
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        GLStateCache::get().viewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    void DeferredRenderer::bind(GLuint firstUnit) const {
+
+        GLStateCache::get().bindTexture(firstUnit, GL_TEXTURE_2D, albedoTexture);
+        GLStateCache::get().bindTexture(firstUnit + 1, GL_TEXTURE_2D, normalTexture);
+        GLStateCache::get().bindTexture(firstUnit + 2, GL_TEXTURE_2D, specularTexture);
+        GLStateCache::get().bindTexture(firstUnit + 3, GL_TEXTURE_2D, depthTexture);
+    }
+
+    void DeferredRenderer::drawLighting(Shader& lightingShader) {
+
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, lightFramebuffer);
+        GLStateCache::get().viewport(0, 0, width, height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // every covered pixel exactly once, its depth comes from the G-buffer
+        GLStateCache::get().disable(GL_CULL_FACE);
+        GLStateCache::get().depthFunc(GL_ALWAYS);
+        GLStateCache::get().depthMask(GL_TRUE);
+
+        lightingShader.useShaderProgram();
+        GLStateCache::get().bindVertexArray(emptyVertexArray);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        GLStateCache::get().depthFunc(GL_LESS);
+    }
+
+    void DeferredRenderer::drawLightVolumes(Shader& volumeShader, int lightCount) {
+
+        if (lightCount <= 0) {
+            return;
+        }
+
+        // the back faces cover the light's pixels once, wherever the camera is; they pass
+        // where the scene lies in front of them, the shader drops what is out of range.
+        // Depth clamping keeps the back faces of lights past the far plane.
+        GLStateCache::get().enable(GL_CULL_FACE);
+        GLStateCache::get().cullFace(GL_FRONT);
+        GLStateCache::get().depthFunc(GL_GEQUAL);
+        GLStateCache::get().depthMask(GL_FALSE);
+        GLStateCache::get().enable(GL_DEPTH_CLAMP);
+        GLStateCache::get().enable(GL_BLEND);
+        GLStateCache::get().blendFunc(GL_ONE, GL_ONE);
+
+        volumeShader.useShaderProgram();
+        GLStateCache::get().bindVertexArray(sphereVertexArray);
+        glDrawElementsInstanced(GL_TRIANGLES, sphereIndexCount, GL_UNSIGNED_INT, 0, lightCount);
+
+        GLStateCache::get().disable(GL_BLEND);
+        GLStateCache::get().disable(GL_DEPTH_CLAMP);
+        GLStateCache::get().depthMask(GL_TRUE);
+        GLStateCache::get().depthFunc(GL_LESS);
+        GLStateCache::get().cullFace(GL_BACK);
+        GLStateCache::get().disable(GL_CULL_FACE);
+    }
+
+    void DeferredRenderer::drawComposite(Shader& compositeShader, GLuint unit) {
+
+        // every covered pixel exactly once, like the lighting pass
+        GLStateCache::get().disable(GL_CULL_FACE);
+        GLStateCache::get().depthFunc(GL_ALWAYS);
+        GLStateCache::get().depthMask(GL_TRUE);
+
+        GLStateCache::get().bindTexture(unit, GL_TEXTURE_2D, lightTexture);
+        compositeShader.useShaderProgram();
+        GLStateCache::get().bindVertexArray(emptyVertexArray);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        GLStateCache::get().depthFunc(GL_LESS);
+    }
+
+    int DeferredRenderer::getWidth() const {
+
+        return width;
+    }
+
+    int DeferredRenderer::getHeight() const {
+
+        return height;
+    }
+
+    void DeferredRenderer::destroy() {
+
+        deleteTargets();
+
+        if (sphereVertexBuffer != 0) {
+            GpuMemory::get().release(GPU_MEMORY_BUFFER, sphereVertexBuffer);
+            glDeleteBuffers(1, &sphereVertexBuffer);
+            sphereVertexBuffer = 0;
+        }
+        if (sphereIndexBuffer != 0) {
+            GpuMemory::get().release(GPU_MEMORY_BUFFER, sphereIndexBuffer);
+            glDeleteBuffers(1, &sphereIndexBuffer);
+            sphereIndexBuffer = 0;
+        }
+        if (sphereVertexArray != 0) {
+            GLStateCache::get().deleteVertexArrays(1, &sphereVertexArray);
+            sphereVertexArray = 0;
+        }
+        if (emptyVertexArray != 0) {
+            GLStateCache::get().deleteVertexArrays(1, &emptyVertexArray);
+            emptyVertexArray = 0;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef DeferredRenderer_hpp
+#define DeferredRenderer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "Shader.hpp"
+
+namespace gps {
+
+    // Deferred shading, the alternative to lighting every fragment in the opaque pass: the
+    // opaque pass only writes the surface attributes into a G-buffer, then full-screen and
+    // light volume passes light each covered pixel once, so the lighting cost follows the
+    // screen and the lights instead of the geometry.
+    //
+    //   albedo    GL_SRGB8_ALPHA8    diffuse texture
+    //   normal    GL_RGBA16F         view space normal
+    //   specular  GL_SRGB8_ALPHA8    specular texture
+    //   depth     GL_DEPTH_COMPONENT32F, positions are rebuilt from it
+    //
+    // The sun and the light volumes add up in a GL_RGBA16F light target with its own depth,
+    // which reaches the screen in one last pass: every light blended straight into the 8-bit
+    // sRGB screen would round the sum once per light and drift brighter than the forward
+    // shader, which rounds it once.
+    //
+    // The G-buffer is not multisampled, edges of the deferred path are not antialiased.
+    class DeferredRenderer {
+
+    public:
+        // Allocates the G-buffer at the framebuffer size and the light volume sphere
+        void init(int width, int height);
+        // Reallocates the G-buffer when the framebuffer size changed, nothing before init
+        void resize(int width, int height);
+
+        // Binds and clears the G-buffer, the opaque pass then draws into it
+        void beginGeometryPass();
+
+        // Binds the albedo, normal, specular and depth targets to firstUnit and the next
+        // three units (shaders: gbufferAlbedo, gbufferNormal, gbufferSpecular, gbufferDepth)
+        void bind(GLuint firstUnit) const;
+
+        // Binds and clears the light target, then lights every covered pixel with the sun, its
+        // shadows, fog and thunder (deferredLighting.frag) and writes the G-buffer depth under it
+        void drawLighting(Shader& lightingShader);
+        // Adds lightCount point lights, one instanced sphere per light bounding its radius
+        // (lightVolume.vert), blended over the lit pixels of the light target
+        void drawLightVolumes(Shader& volumeShader, int lightCount);
+        // Copies the light target and the G-buffer depth into the bound framebuffer
+        // (deferredComposite.frag), the light target is bound to unit (shaders: lightAccumulation)
+        void drawComposite(Shader& compositeShader, GLuint unit);
+
+        int getWidth() const;
+        int getHeight() const;
+
+        void destroy();
+
+    private:
+        void createTargets();
+        void deleteTargets();
+        void createSphere();
+
+        int width = 0;
+        int height = 0;
+
+        GLuint framebuffer = 0;
+        GLuint albedoTexture = 0;
+        GLuint normalTexture = 0;
+        GLuint specularTexture = 0;
+        GLuint depthTexture = 0;
+
+        GLuint lightFramebuffer = 0;
+        GLuint lightTexture = 0;
+        GLuint lightDepthTexture = 0;
+
+        // the full-screen triangle is made from gl_VertexID, core profile still needs a VAO
+        GLuint emptyVertexArray = 0;
+
+        GLuint sphereVertexArray = 0;
+        GLuint sphereVertexBuffer = 0;
+        GLuint sphereIndexBuffer = 0;
+        GLsizei sphereIndexCount = 0;
+    };
+}
+
+#endif /* DeferredRenderer_hpp */
@@ -0,0 +1,197 @@
+#include "Frustum.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define GPS_FRUSTUM_SSE
+    #include <xmmintrin.h>
+#endif
+
+namespace gps {
+
+    void BoundingSpheres::clear() {
+
+        x.clear();
+        y.clear();
+        z.clear();
+        radius.clear();
+    }
+
+    void BoundingSpheres::push(const glm::vec3& center, float sphereRadius) {
+
+        x.push_back(center.x);
+        y.push_back(center.y);
+        z.push_back(center.z);
+        radius.push_back(sphereRadius);
+    }
+
+    size_t BoundingSpheres::size() const {
+
+        return radius.size();
+    }
+
+    Frustum::Frustum() {
+
+        // w = 1 keeps every point on the inner side
+        for (int i = 0; i < 6; i++) {
+            planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        }
+    }
+
+    Frustum Frustum::fromMatrix(const glm::mat4& viewProjection) {
+
+        // Gribb-Hartmann: each plane is the last row of the matrix plus or minus another row
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++) {
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        }
+
+        Frustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];   // left
+        frustum.planes[1] = rows[3] - rows[0];   // right
+        frustum.planes[2] = rows[3] + rows[1];   // bottom
+        frustum.planes[3] = rows[3] - rows[1];   // top
+        frustum.planes[4] = rows[3] + rows[2];   // near
+        frustum.planes[5] = rows[3] - rows[2];   // far
+
+        // unit normals, so the plane equation gives distances comparable with radii
+        for (int i = 0; i < 6; i++) {
+
+            float length = glm::length(glm::vec3(frustum.planes[i]));
+            if (length > 0.0f) {
+                frustum.planes[i] /= length;
+            }
+        }
+
+        return frustum;
+    }
+
+    void Frustum::testSpheres(const BoundingSpheres& spheres, std::vector<unsigned char>& visible) const {
+
+        size_t count = spheres.size();
+        visible.resize(count);
+
+        size_t i = 0;
+
+#ifdef GPS_FRUSTUM_SSE
+        __m128 planeX[6], planeY[6], planeZ[6], planeW[6];
+        for (int p = 0; p < 6; p++) {
+
+            planeX[p] = _mm_set1_ps(planes[p].x);
+            planeY[p] = _mm_set1_ps(planes[p].y);
+            planeZ[p] = _mm_set1_ps(planes[p].z);
+            planeW[p] = _mm_set1_ps(planes[p].w);
+        }
+
+        for (; i + 4 <= count; i += 4) {
+
+            __m128 x = _mm_loadu_ps(&spheres.x[i]);
+            __m128 y = _mm_loadu_ps(&spheres.y[i]);
+            __m128 z = _mm_loadu_ps(&spheres.z[i]);
+            __m128 negativeRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&spheres.radius[i]));
+
+            // a sphere is out once it lies entirely behind any plane
+            __m128 inside = _mm_cmpeq_ps(x, x);
+            for (int p = 0; p < 6; p++) {
+
+                __m128 distance = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(planeX[p], x), _mm_mul_ps(planeY[p], y)),
+                    _mm_add_ps(_mm_mul_ps(planeZ[p], z), planeW[p]));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negativeRadius));
+            }
+
+            int mask = _mm_movemask_ps(inside);
+            visible[i] = (unsigned char)(mask & 1);
+            visible[i + 1] = (unsigned char)((mask >> 1) & 1);
+            visible[i + 2] = (unsigned char)((mask >> 2) & 1);
+            visible[i + 3] = (unsigned char)((mask >> 3) & 1);
+        }
+#endif
+
+        // remainder, or every sphere without SSE
+        for (; i < count; i++) {
+
+            bool inside = true;
+            for (int p = 0; p < 6 && inside; p++) {
+
+                float distance = planes[p].x * spheres.x[i] + planes[p].y * spheres.y[i] + planes[p].z * spheres.z[i] + planes[p].w;
+                inside = distance >= -spheres.radius[i];
+            }
+            visible[i] = inside ? 1 : 0;
+        }
+    }
+
+    bool Frustum::testBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+
+        for (int p = 0; p < 6; p++) {
+
+            // corner furthest along the plane normal
+            glm::vec3 positive(
+                planes[p].x >= 0.0f ? boxMax.x : boxMin.x,
+                planes[p].y >= 0.0f ? boxMax.y : boxMin.y,
+                planes[p].z >= 0.0f ? boxMax.z : boxMin.z);
+
+            if (glm::dot(glm::vec3(planes[p]), positive) + planes[p].w < 0.0f) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    FrustumTest Frustum::classifyBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const {
+
+        FrustumTest result = FRUSTUM_INSIDE;
+
+        for (int p = 0; p < 6; p++) {
+
+            glm::vec3 normal(planes[p]);
+            glm::vec3 positive(
+                normal.x >= 0.0f ? boxMax.x : boxMin.x,
+                normal.y >= 0.0f ? boxMax.y : boxMin.y,
+                normal.z >= 0.0f ? boxMax.z : boxMin.z);
+
+            if (glm::dot(normal, positive) + planes[p].w < 0.0f) {
+                return FRUSTUM_OUTSIDE;
+            }
+
+            // the corner nearest to the plane is behind it, the box straddles the plane
+            glm::vec3 negative(
+                normal.x >= 0.0f ? boxMin.x : boxMax.x,
+                normal.y >= 0.0f ? boxMin.y : boxMax.y,
+                normal.z >= 0.0f ? boxMin.z : boxMax.z);
+
+            if (glm::dot(normal, negative) + planes[p].w < 0.0f) {
+                result = FRUSTUM_INTERSECTS;
+            }
+        }
+
+        return result;
+    }
+
+    void transformBox(const glm::mat4& model, const glm::vec3& boxMin, const glm::vec3& boxMax,
+        glm::vec3& outMin, glm::vec3& outMax) {
+
+        // Arvo: the extent along each world axis sums the absolute contributions of the local axes
+        glm::vec3 center = glm::vec3(model * glm::vec4((boxMin + boxMax) * 0.5f, 1.0f));
+        glm::vec3 halfExtent = (boxMax - boxMin) * 0.5f;
+
+        glm::mat3 linear(model);
+        glm::vec3 worldHalfExtent(0.0f);
+        for (int column = 0; column < 3; column++) {
+            worldHalfExtent += glm::abs(linear[column]) * halfExtent[column];
+        }
+
+        outMin = center - worldHalfExtent;
+        outMax = center + worldHalfExtent;
+    }
+
+    float maxScale(const glm::mat4& model) {
+
+        float x = glm::length(glm::vec3(model[0]));
+        float y = glm::length(glm::vec3(model[1]));
+        float z = glm::length(glm::vec3(model[2]));
+        return std::max(x, std::max(y, z));
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef Frustum_hpp
+#define Frustum_hpp
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Bounding spheres in structure-of-arrays layout, four of them are tested per instruction
+    struct BoundingSpheres {
+        std::vector<float> x;
+        std::vector<float> y;
+        std::vector<float> z;
+        std::vector<float> radius;
+
+        void clear();
+        void push(const glm::vec3& center, float sphereRadius);
+        size_t size() const;
+    };
+
+    enum FrustumTest {
+        FRUSTUM_OUTSIDE,
+        FRUSTUM_INTERSECTS,
+        FRUSTUM_INSIDE
+    };
+
+    // The six planes of a view volume, normals pointing inwards
+    class Frustum {
+
+    public:
+        // A frustum that contains everything
+        Frustum();
+
+        // Planes of the volume clip space maps to [-1, 1], for perspective and orthographic matrices
+        static Frustum fromMatrix(const glm::mat4& viewProjection);
+
+        // visible[i] becomes 1 when sphere i is at least partly inside, 0 otherwise
+        void testSpheres(const BoundingSpheres& spheres, std::vector<unsigned char>& visible) const;
+
+        // true when the box is at least partly inside, conservative near the corners
+        bool testBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+        // Like testBox, but also tells boxes entirely inside apart, whose contents need no test
+        FrustumTest classifyBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const;
+
+    private:
+        glm::vec4 planes[6];
+    };
+
+    // Axis aligned box around the transformed box
+    void transformBox(const glm::mat4& model, const glm::vec3& boxMin, const glm::vec3& boxMax,
+        glm::vec3& outMin, glm::vec3& outMax);
+
+    // Largest scale the matrix applies along any axis, for transforming sphere radii
+    float maxScale(const glm::mat4& model);
+}
+
+#endif /* Frustum_hpp */
@@ -0,0 +1,330 @@
+#include "GLStateCache.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    // value of a shadow that does not match anything, so the next call is issued
+    static const GLuint UNKNOWN_STATE = 0xFFFFFFFFu;
+
+    static const GLenum textureTargets[] = { GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY, GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BUFFER };
+
+    GLStateCache& GLStateCache::get() {
+
+        static GLStateCache instance;
+        return instance;
+    }
+
+    GLStateCache::GLStateCache() {
+
+        invalidate();
+
+        issuedCalls = 0;
+        elidedCalls = 0;
+        lastFrameIssuedCalls = 0;
+        lastFrameElidedCalls = 0;
+    }
+
+    bool GLStateCache::changed(GLuint& shadow, GLuint value) {
+
+        if (shadow == value) {
+
+            elidedCalls++;
+            return false;
+        }
+
+        shadow = value;
+        issuedCalls++;
+        return true;
+    }
+
+    int GLStateCache::textureTargetIndex(GLenum target) const {
+
+        for (int i = 0; i < TEXTURE_TARGET_COUNT; i++) {
+
+            if (textureTargets[i] == target) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    void GLStateCache::useProgram(GLuint program) {
+
+        if (changed(this->program, program)) {
+            glUseProgram(program);
+        }
+    }
+
+    void GLStateCache::bindVertexArray(GLuint vertexArray) {
+
+        if (changed(this->vertexArray, vertexArray)) {
+            glBindVertexArray(vertexArray);
+        }
+    }
+
+    void GLStateCache::activeTexture(GLenum unit) {
+
+        if (changed(this->activeUnit, unit - GL_TEXTURE0)) {
+            glActiveTexture(unit);
+        }
+    }
+
+    void GLStateCache::bindTexture(GLenum target, GLuint texture) {
+
+        int targetIndex = textureTargetIndex(target);
+
+        //targets and units the cache does not shadow always go through
+        if (targetIndex < 0 || activeUnit >= MAX_TEXTURE_UNITS) {
+
+            issuedCalls++;
+            glBindTexture(target, texture);
+            return;
+        }
+
+        if (changed(textures[activeUnit][targetIndex], texture)) {
+            glBindTexture(target, texture);
+        }
+    }
+
+    void GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+
+        int targetIndex = textureTargetIndex(target);
+
+        //skip the unit switch too when the texture is already there
+        if (targetIndex >= 0 && unit < MAX_TEXTURE_UNITS && textures[unit][targetIndex] == texture) {
+
+            elidedCalls++;
+            return;
+        }
+
+        activeTexture(GL_TEXTURE0 + unit);
+        bindTexture(target, texture);
+    }
+
+    void GLStateCache::bindFramebuffer(GLenum target, GLuint framebuffer) {
+
+        bool drawChanged = target != GL_READ_FRAMEBUFFER && drawFramebuffer != framebuffer;
+        bool readChanged = target != GL_DRAW_FRAMEBUFFER && readFramebuffer != framebuffer;
+
+        if (!drawChanged && !readChanged) {
+
+            elidedCalls++;
+            return;
+        }
+
+        if (target != GL_READ_FRAMEBUFFER) {
+            drawFramebuffer = framebuffer;
+        }
+        if (target != GL_DRAW_FRAMEBUFFER) {
+            readFramebuffer = framebuffer;
+        }
+
+        issuedCalls++;
+        glBindFramebuffer(target, framebuffer);
+    }
+
+    void GLStateCache::viewport(GLint x, GLint y, GLsizei width, GLsizei height) {
+
+        if (viewportRect[0] == (GLuint)x && viewportRect[1] == (GLuint)y
+            && viewportRect[2] == (GLuint)width && viewportRect[3] == (GLuint)height) {
+
+            elidedCalls++;
+            return;
+        }
+
+        viewportRect[0] = (GLuint)x;
+        viewportRect[1] = (GLuint)y;
+        viewportRect[2] = (GLuint)width;
+        viewportRect[3] = (GLuint)height;
+
+        issuedCalls++;
+        glViewport(x, y, width, height);
+    }
+
+    void GLStateCache::setCapability(GLenum capability, bool enabled) {
+
+        std::map<GLenum, GLuint>::iterator it = capabilities.find(capability);
+        if (it == capabilities.end()) {
+            it = capabilities.insert(std::make_pair(capability, UNKNOWN_STATE)).first;
+        }
+
+        if (changed(it->second, enabled ? GL_TRUE : GL_FALSE)) {
+
+            if (enabled) {
+                glEnable(capability);
+            }
+            else {
+                glDisable(capability);
+            }
+        }
+    }
+
+    void GLStateCache::enable(GLenum capability) {
+
+        setCapability(capability, true);
+    }
+
+    void GLStateCache::disable(GLenum capability) {
+
+        setCapability(capability, false);
+    }
+
+    void GLStateCache::depthFunc(GLenum func) {
+
+        if (changed(depthFuncValue, func)) {
+            glDepthFunc(func);
+        }
+    }
+
+    void GLStateCache::depthMask(GLboolean flag) {
+
+        if (changed(depthMaskValue, flag)) {
+            glDepthMask(flag);
+        }
+    }
+
+    void GLStateCache::colorMask(GLboolean flag) {
+
+        if (changed(colorMaskValue, flag)) {
+            glColorMask(flag, flag, flag, flag);
+        }
+    }
+
+    void GLStateCache::cullFace(GLenum mode) {
+
+        if (changed(cullFaceValue, mode)) {
+            glCullFace(mode);
+        }
+    }
+
+    void GLStateCache::frontFace(GLenum mode) {
+
+        if (changed(frontFaceValue, mode)) {
+            glFrontFace(mode);
+        }
+    }
+
+    void GLStateCache::blendFunc(GLenum sourceFactor, GLenum destinationFactor) {
+
+        if (blendSource == sourceFactor && blendDestination == destinationFactor) {
+
+            elidedCalls++;
+            return;
+        }
+
+        blendSource = sourceFactor;
+        blendDestination = destinationFactor;
+
+        issuedCalls++;
+        glBlendFunc(sourceFactor, destinationFactor);
+    }
+
+    void GLStateCache::deleteProgram(GLuint program) {
+
+        //a program in use stays current until the next glUseProgram, but its name may come back
+        if (this->program == program) {
+            this->program = UNKNOWN_STATE;
+        }
+        glDeleteProgram(program);
+    }
+
+    void GLStateCache::deleteVertexArrays(GLsizei count, const GLuint* vertexArrays) {
+
+        for (GLsizei i = 0; i < count; i++) {
+
+            if (vertexArrays[i] != 0 && vertexArray == vertexArrays[i]) {
+                vertexArray = 0;
+            }
+        }
+        glDeleteVertexArrays(count, vertexArrays);
+    }
+
+    void GLStateCache::deleteTextures(GLsizei count, const GLuint* textures) {
+
+        for (GLsizei i = 0; i < count; i++) {
+
+            if (textures[i] == 0) {
+                continue;
+            }
+
+            for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+
+                for (int target = 0; target < TEXTURE_TARGET_COUNT; target++) {
+
+                    if (this->textures[unit][target] == textures[i]) {
+                        this->textures[unit][target] = 0;
+                    }
+                }
+            }
+        }
+        glDeleteTextures(count, textures);
+    }
+
+    void GLStateCache::deleteFramebuffers(GLsizei count, const GLuint* framebuffers) {
+
+        for (GLsizei i = 0; i < count; i++) {
+
+            if (framebuffers[i] == 0) {
+                continue;
+            }
+            if (drawFramebuffer == framebuffers[i]) {
+                drawFramebuffer = 0;
+            }
+            if (readFramebuffer == framebuffers[i]) {
+                readFramebuffer = 0;
+            }
+        }
+        glDeleteFramebuffers(count, framebuffers);
+    }
+
+    void GLStateCache::invalidate() {
+
+        program = UNKNOWN_STATE;
+        vertexArray = UNKNOWN_STATE;
+        activeUnit = UNKNOWN_STATE;
+        for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+
+            for (int target = 0; target < TEXTURE_TARGET_COUNT; target++) {
+                textures[unit][target] = UNKNOWN_STATE;
+            }
+        }
+        drawFramebuffer = UNKNOWN_STATE;
+        readFramebuffer = UNKNOWN_STATE;
+        for (int i = 0; i < 4; i++) {
+            viewportRect[i] = UNKNOWN_STATE;
+        }
+        depthFuncValue = UNKNOWN_STATE;
+        depthMaskValue = UNKNOWN_STATE;
+        colorMaskValue = UNKNOWN_STATE;
+        cullFaceValue = UNKNOWN_STATE;
+        frontFaceValue = UNKNOWN_STATE;
+        blendSource = UNKNOWN_STATE;
+        blendDestination = UNKNOWN_STATE;
+        capabilities.clear();
+    }
+
+    void GLStateCache::beginFrame() {
+
+        lastFrameIssuedCalls = issuedCalls;
+        lastFrameElidedCalls = elidedCalls;
+        issuedCalls = 0;
+        elidedCalls = 0;
+    }
+
+    unsigned int GLStateCache::getIssuedCalls() const {
+
+        return lastFrameIssuedCalls;
+    }
+
+    unsigned int GLStateCache::getElidedCalls() const {
+
+        return lastFrameElidedCalls;
+    }
+
+    void GLStateCache::report() const {
+
+        std::cout << "[INFO] GL state calls last frame: " << lastFrameIssuedCalls << " issued, "
+            << lastFrameElidedCalls << " elided" << std::endl;
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef GLStateCache_hpp
+#define GLStateCache_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <map>
+
+namespace gps {
+
+    // Shadow copy of the GL state the renderer touches. Calls that would not change
+    // anything are dropped. All binds and toggles must go through it, a direct GL call
+    // leaves the shadow stale until invalidate().
+    class GLStateCache {
+
+    public:
+        static GLStateCache& get();
+
+        void useProgram(GLuint program);
+        void bindVertexArray(GLuint vertexArray);
+
+        // unit is GL_TEXTURE0 + i
+        void activeTexture(GLenum unit);
+        // binds to the active unit
+        void bindTexture(GLenum target, GLuint texture);
+        // unit is the index, as given to the sampler uniform
+        void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+        void bindFramebuffer(GLenum target, GLuint framebuffer);
+        void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+        void enable(GLenum capability);
+        void disable(GLenum capability);
+        void depthFunc(GLenum func);
+        void depthMask(GLboolean flag);
+        // all four channels at once
+        void colorMask(GLboolean flag);
+        void cullFace(GLenum mode);
+        void frontFace(GLenum mode);
+        void blendFunc(GLenum sourceFactor, GLenum destinationFactor);
+
+        // Deleting a bound object resets its binding, the shadow has to follow
+        void deleteProgram(GLuint program);
+        void deleteVertexArrays(GLsizei count, const GLuint* vertexArrays);
+        void deleteTextures(GLsizei count, const GLuint* textures);
+        void deleteFramebuffers(GLsizei count, const GLuint* framebuffers);
+
+        // Forgets everything, the next call of each kind is always issued
+        void invalidate();
+
+        // Closes the statistics of the previous frame
+        void beginFrame();
+        unsigned int getIssuedCalls() const;
+        unsigned int getElidedCalls() const;
+        void report() const;
+
+    private:
+        GLStateCache();
+
+        static const int MAX_TEXTURE_UNITS = 16;
+        static const int TEXTURE_TARGET_COUNT = 4;
+
+        // true when the call has to be issued, counts it either way
+        bool changed(GLuint& shadow, GLuint value);
+        int textureTargetIndex(GLenum target) const;
+        void setCapability(GLenum capability, bool enabled);
+
+        GLuint program;
+        GLuint vertexArray;
+        GLuint activeUnit;
+        GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGET_COUNT];
+        GLuint drawFramebuffer;
+        GLuint readFramebuffer;
+        GLuint viewportRect[4];
+        GLuint depthFuncValue;
+        GLuint depthMaskValue;
+        GLuint colorMaskValue;
+        GLuint cullFaceValue;
+        GLuint frontFaceValue;
+        GLuint blendSource;
+        GLuint blendDestination;
+        std::map<GLenum, GLuint> capabilities;
+
+        unsigned int issuedCalls;
+        unsigned int elidedCalls;
+        unsigned int lastFrameIssuedCalls;
+        unsigned int lastFrameElidedCalls;
+    };
+}
+
+#endif /* GLStateCache_hpp */
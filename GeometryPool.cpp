@@ -0,0 +1,187 @@
+#include "GeometryPool.hpp"
+#include "GLStateCache.hpp"
+#include "Layouts.hpp"
+
+#include <cstring>
+#include <iostream>
+
+namespace gps {
+
+    // default heap buffer sizes, larger meshes get a buffer of their own
+    static const uint32_t BLOCK_VERTICES = 512 * 1024;
+    static const uint32_t BLOCK_INDICES = 2 * 1024 * 1024;
+
+    GeometryPool::GeometryPool(GLsizei vertexSize, size_t positionOffset, void (*setupAttributes)())
+        : vertexHeap("mesh vertices", GL_STATIC_DRAW, vertexSize, BLOCK_VERTICES),
+          positionHeap("mesh positions", GL_STATIC_DRAW, sizeof(PositionVertex), BLOCK_VERTICES),
+          indexHeap("mesh indices", GL_STATIC_DRAW, sizeof(GLuint), BLOCK_INDICES) {
+
+        this->vertexSize = vertexSize;
+        this->positionOffset = positionOffset;
+        this->setupAttributes = setupAttributes;
+    }
+
+    GLuint GeometryPool::vertexArray(const GpuAllocation& vertices, const GpuAllocation& indices, bool positionOnly) {
+
+        std::map<std::pair<int, int>, GLuint>& arrays = positionOnly ? positionVertexArrays : vertexArrays;
+        std::pair<int, int> key(vertices.block, indices.block);
+        std::map<std::pair<int, int>, GLuint>::iterator it = arrays.find(key);
+        if (it != arrays.end()) {
+            return it->second;
+        }
+
+        GLuint vertexArray;
+        glGenVertexArrays(1, &vertexArray);
+        GLStateCache::get().bindVertexArray(vertexArray);
+
+        // the element buffer binding is VAO state, the VAO keeps it
+        glBindBuffer(GL_ARRAY_BUFFER, vertices.buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.buffer);
+        if (positionOnly) {
+            // vertexPosition shares location 0 with the position of every mesh format
+            PositionVertex::setupAttributes();
+        }
+        else {
+            setupAttributes();
+        }
+
+        GLStateCache::get().bindVertexArray(0);
+
+        arrays[key] = vertexArray;
+        return vertexArray;
+    }
+
+    void GeometryPool::resolve(Entry& entry) {
+
+        const GpuAllocation& vertices = vertexHeap.get(entry.vertices);
+        const GpuAllocation& positions = positionHeap.get(entry.positions);
+        const GpuAllocation& indices = indexHeap.get(entry.indices);
+
+        entry.range.vertexArray = vertexArray(vertices, indices, false);
+        entry.range.baseVertex = (GLint)(vertices.offset / vertexSize);
+        entry.range.positionVertexArray = vertexArray(positions, indices, true);
+        entry.range.positionBaseVertex = (GLint)(positions.offset / sizeof(PositionVertex));
+        entry.range.firstIndex = (GLuint)(indices.offset / sizeof(GLuint));
+    }
+
+    GeometryPool::Handle GeometryPool::allocate(const void* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount) {
+
+        if (vertexCount <= 0 || indexCount <= 0) {
+            return -1;
+        }
+
+        Entry entry;
+        entry.vertices = vertexHeap.allocate((GLsizeiptr)vertexCount * vertexSize);
+        entry.positions = positionHeap.allocate((GLsizeiptr)vertexCount * sizeof(PositionVertex));
+        entry.indices = indexHeap.allocate((GLsizeiptr)indexCount * sizeof(GLuint));
+        entry.range.indexCount = indexCount;
+        entry.range.vertexCount = vertexCount;
+
+        vertexHeap.upload(entry.vertices, vertices, (GLsizeiptr)vertexCount * vertexSize);
+
+        std::vector<PositionVertex> positions(vertexCount);
+        const unsigned char* source = (const unsigned char*)vertices + positionOffset;
+        for (GLsizei i = 0; i < vertexCount; i++) {
+            memcpy(&positions[i].position, source + (size_t)i * vertexSize, sizeof(glm::vec3));
+        }
+        positionHeap.upload(entry.positions, &positions[0], (GLsizeiptr)vertexCount * sizeof(PositionVertex));
+        indexHeap.upload(entry.indices, indices, (GLsizeiptr)indexCount * sizeof(GLuint));
+
+        Handle handle;
+        if (!freeEntries.empty()) {
+
+            handle = freeEntries.back();
+            freeEntries.pop_back();
+        }
+        else {
+
+            handle = (Handle)entries.size();
+            entries.push_back(Entry());
+        }
+
+        entries[handle] = entry;
+        resolve(entries[handle]);
+        return handle;
+    }
+
+    void GeometryPool::release(Handle handle) {
+
+        if (handle < 0 || handle >= (Handle)entries.size() || entries[handle].vertices < 0) {
+            return;
+        }
+
+        vertexHeap.free(entries[handle].vertices);
+        positionHeap.free(entries[handle].positions);
+        indexHeap.free(entries[handle].indices);
+        entries[handle] = Entry();
+        entries[handle].vertices = -1;
+        entries[handle].positions = -1;
+        entries[handle].indices = -1;
+        freeEntries.push_back(handle);
+        released = true;
+    }
+
+    bool GeometryPool::defragment() {
+
+        if (!released) {
+            return false;
+        }
+        released = false;
+
+        bool movedVertices = vertexHeap.defragment();
+        bool movedPositions = positionHeap.defragment();
+        bool movedIndices = indexHeap.defragment();
+        if (!movedVertices && !movedPositions && !movedIndices) {
+            return false;
+        }
+
+        // block indices may now name other buffers, rebuild the VAOs for the new places
+        deleteVertexArrays();
+        for (size_t i = 0; i < entries.size(); i++) {
+
+            if (entries[i].vertices >= 0) {
+                resolve(entries[i]);
+            }
+        }
+        return true;
+    }
+
+    const GeometryRange& GeometryPool::getRange(Handle handle) const {
+
+        static const GeometryRange empty;
+        return handle >= 0 && handle < (Handle)entries.size() ? entries[handle].range : empty;
+    }
+
+    void GeometryPool::deleteVertexArrays() {
+
+        for (std::map<std::pair<int, int>, GLuint>::iterator it = vertexArrays.begin(); it != vertexArrays.end(); ++it) {
+            GLStateCache::get().deleteVertexArrays(1, &it->second);
+        }
+        vertexArrays.clear();
+
+        for (std::map<std::pair<int, int>, GLuint>::iterator it = positionVertexArrays.begin(); it != positionVertexArrays.end(); ++it) {
+            GLStateCache::get().deleteVertexArrays(1, &it->second);
+        }
+        positionVertexArrays.clear();
+    }
+
+    void GeometryPool::destroy() {
+
+        deleteVertexArrays();
+        vertexHeap.destroy();
+        positionHeap.destroy();
+        indexHeap.destroy();
+        entries.clear();
+        freeEntries.clear();
+        released = false;
+    }
+
+    void GeometryPool::report() const {
+
+        std::cout << "[INFO] Geometry pool: " << entries.size() - freeEntries.size() << " meshes in "
+            << vertexArrays.size() + positionVertexArrays.size() << " vertex arrays" << std::endl;
+        vertexHeap.report();
+        positionHeap.report();
+        indexHeap.report();
+    }
+}
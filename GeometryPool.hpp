@@ -0,0 +1,100 @@
+#ifndef GeometryPool_hpp
+#define GeometryPool_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include "GpuHeap.hpp"
+
+#include <cstddef>
+#include <map>
+#include <utility>
+#include <vector>
+
+namespace gps {
+
+    // Where a mesh lives inside a pool: draw with its VAO, GL_UNSIGNED_INT indices starting
+    // at firstIndex and baseVertex added to every index. The position VAO reads the same
+    // indices from a stream holding only the positions, for depth-only passes.
+    struct GeometryRange {
+        GLuint vertexArray = 0;
+        GLint baseVertex = 0;
+        GLuint positionVertexArray = 0;
+        GLint positionBaseVertex = 0;
+        GLuint firstIndex = 0;
+        GLsizei indexCount = 0;
+        GLsizei vertexCount = 0;
+    };
+
+    // Static meshes of one vertex format sub-allocated from a vertex heap and an index heap,
+    // with one VAO per pair of heap buffers, so that draws of different meshes share the
+    // bindings and can be merged into multi-draws. The positions are also copied into a
+    // tightly packed stream of their own, which depth-only passes read instead. Released
+    // space is only compacted by defragment(), which can move the other meshes: call it
+    // between frames and look ranges up by handle when drawing.
+    class GeometryPool {
+
+    public:
+        typedef int Handle;
+
+        // The pool of a GPS_DECLARE_VERTEX_FORMAT type with a glm::vec3 Position member
+        template<typename Format>
+        static GeometryPool& get() {
+            static GeometryPool pool(sizeof(Format), offsetof(Format, Position), &Format::setupAttributes);
+            return pool;
+        }
+
+        // Copies the mesh into the heaps, -1 for an empty mesh
+        Handle allocate(const void* vertices, GLsizei vertexCount, const GLuint* indices, GLsizei indexCount);
+        void release(Handle handle);
+
+        // Compacts the heaps after releases and moves the ranges with them, true when any
+        // range changed. Only between frames: queued packets hold the VAOs and base vertices
+        // of the current places.
+        bool defragment();
+
+        // Current range of the mesh, empty for -1
+        const GeometryRange& getRange(Handle handle) const;
+
+        void destroy();
+        void report() const;
+
+    private:
+        struct Entry {
+            GpuHeap::Handle vertices;
+            GpuHeap::Handle positions;
+            GpuHeap::Handle indices;
+            GeometryRange range;
+        };
+
+        GeometryPool(GLsizei vertexSize, size_t positionOffset, void (*setupAttributes)());
+
+        // VAO reading the heap buffers of the two allocations, created on first use, with the
+        // attributes of the format or only the position at location 0
+        GLuint vertexArray(const GpuAllocation& vertices, const GpuAllocation& indices, bool positionOnly);
+        void resolve(Entry& entry);
+        void deleteVertexArrays();
+
+        GLsizei vertexSize;
+        size_t positionOffset;
+        void (*setupAttributes)();
+        GpuHeap vertexHeap;
+        GpuHeap positionHeap;
+        GpuHeap indexHeap;
+
+        // released entries have a vertices handle of -1
+        std::vector<Entry> entries;
+        std::vector<Handle> freeEntries;
+        std::map<std::pair<int, int>, GLuint> vertexArrays;
+        std::map<std::pair<int, int>, GLuint> positionVertexArrays;
+        // meshes were released since the last defragment
+        bool released = false;
+    };
+}
+
+#endif /* GeometryPool_hpp */
@@ -0,0 +1,344 @@
+#include "GpuHeap.hpp"
+#include "GpuMemory.hpp"
+
+#include <cstdio>
+#include <iostream>
+
+namespace gps {
+
+    // blocks used below this fraction are emptied into the others by defragment
+    static const uint32_t DEFRAGMENT_OCCUPANCY_DIVISOR = 4;
+
+    BuddyAllocator::BuddyAllocator(uint32_t capacity) {
+
+        this->maxOrder = orderFor(capacity);
+        this->capacity = 1u << maxOrder;
+        this->used = 0;
+
+        freeLists.resize(maxOrder + 1);
+        freeLists[maxOrder].insert(0);
+    }
+
+    int BuddyAllocator::orderFor(uint32_t count) {
+
+        int order = 0;
+        while ((1u << order) < count) {
+            order++;
+        }
+        return order;
+    }
+
+    bool BuddyAllocator::allocate(uint32_t count, uint32_t& offset) {
+
+        int order = orderFor(count > 0 ? count : 1);
+        if (order > maxOrder) {
+            return false;
+        }
+
+        int found = order;
+        while (found <= maxOrder && freeLists[found].empty()) {
+            found++;
+        }
+        if (found > maxOrder) {
+            return false;
+        }
+
+        // lowest free range, so that allocations pack towards the start of the buffer
+        offset = *freeLists[found].begin();
+        freeLists[found].erase(freeLists[found].begin());
+
+        // split down to the requested order, the upper halves stay free
+        while (found > order) {
+
+            found--;
+            freeLists[found].insert(offset + (1u << found));
+        }
+
+        allocatedOrders[offset] = order;
+        used += 1u << order;
+        return true;
+    }
+
+    void BuddyAllocator::free(uint32_t offset) {
+
+        std::map<uint32_t, int>::iterator it = allocatedOrders.find(offset);
+        if (it == allocatedOrders.end()) {
+            return;
+        }
+
+        int order = it->second;
+        allocatedOrders.erase(it);
+        used -= 1u << order;
+
+        // merge with the buddy for as long as it is free too
+        while (order < maxOrder) {
+
+            uint32_t buddy = offset ^ (1u << order);
+            std::set<uint32_t>::iterator found = freeLists[order].find(buddy);
+            if (found == freeLists[order].end()) {
+                break;
+            }
+
+            freeLists[order].erase(found);
+            offset = offset < buddy ? offset : buddy;
+            order++;
+        }
+
+        freeLists[order].insert(offset);
+    }
+
+    uint32_t BuddyAllocator::getCapacity() const {
+
+        return capacity;
+    }
+
+    uint32_t BuddyAllocator::getUsed() const {
+
+        return used;
+    }
+
+    uint32_t BuddyAllocator::getLargestFree() const {
+
+        for (int order = maxOrder; order >= 0; order--) {
+
+            if (!freeLists[order].empty()) {
+                return 1u << order;
+            }
+        }
+        return 0;
+    }
+
+    GpuHeap::GpuHeap(const char* name, GLenum usage, GLsizeiptr unitSize, uint32_t blockUnits) {
+
+        this->name = name;
+        this->usage = usage;
+        this->unitSize = unitSize;
+        this->blockUnits = blockUnits;
+    }
+
+    uint32_t GpuHeap::unitsFor(GLsizeiptr size) const {
+
+        return (uint32_t)((size + unitSize - 1) / unitSize);
+    }
+
+    int GpuHeap::createBlock(uint32_t units) {
+
+        // larger allocations get a buffer of their own
+        Block block = { 0, BuddyAllocator(units > blockUnits ? units : blockUnits) };
+        GLsizeiptr bytes = (GLsizeiptr)block.allocator.getCapacity() * unitSize;
+
+        // the copy targets leave GL_ARRAY_BUFFER and the VAO element buffers alone
+        glGenBuffers(1, &block.buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, block.buffer);
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, usage);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        GpuMemory::get().track(GPU_MEMORY_BUFFER, block.buffer, (size_t)bytes);
+
+        for (size_t i = 0; i < blocks.size(); i++) {
+
+            if (blocks[i].buffer == 0) {
+
+                blocks[i] = block;
+                return (int)i;
+            }
+        }
+
+        blocks.push_back(block);
+        return (int)blocks.size() - 1;
+    }
+
+    void GpuHeap::releaseBlock(int block) {
+
+        GpuMemory::get().release(GPU_MEMORY_BUFFER, blocks[block].buffer);
+        glDeleteBuffers(1, &blocks[block].buffer);
+        blocks[block].buffer = 0;
+    }
+
+    bool GpuHeap::allocateIn(int block, uint32_t units, GpuAllocation& allocation) {
+
+        uint32_t offset;
+        if (blocks[block].buffer == 0 || !blocks[block].allocator.allocate(units, offset)) {
+            return false;
+        }
+
+        allocation.buffer = blocks[block].buffer;
+        allocation.offset = (GLintptr)offset * unitSize;
+        allocation.block = block;
+        return true;
+    }
+
+    GpuHeap::Handle GpuHeap::allocate(GLsizeiptr size) {
+
+        if (size <= 0) {
+            return -1;
+        }
+
+        GpuAllocation allocation;
+        allocation.size = size;
+        uint32_t units = unitsFor(size);
+
+        bool placed = false;
+        for (size_t i = 0; i < blocks.size() && !placed; i++) {
+            placed = allocateIn((int)i, units, allocation);
+        }
+        if (!placed) {
+            allocateIn(createBlock(units), units, allocation);
+        }
+
+        Handle handle;
+        if (!freeHandles.empty()) {
+
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+            allocations[handle] = allocation;
+        }
+        else {
+
+            handle = (Handle)allocations.size();
+            allocations.push_back(allocation);
+        }
+        return handle;
+    }
+
+    void GpuHeap::free(Handle handle) {
+
+        if (handle < 0 || handle >= (Handle)allocations.size() || allocations[handle].block < 0) {
+            return;
+        }
+
+        GpuAllocation& allocation = allocations[handle];
+        if (blocks[allocation.block].buffer != 0) {
+            blocks[allocation.block].allocator.free((uint32_t)(allocation.offset / unitSize));
+        }
+
+        allocation = GpuAllocation();
+        freeHandles.push_back(handle);
+    }
+
+    const GpuAllocation& GpuHeap::get(Handle handle) const {
+
+        static const GpuAllocation none;
+        return handle >= 0 && handle < (Handle)allocations.size() ? allocations[handle] : none;
+    }
+
+    void GpuHeap::upload(Handle handle, const void* data, GLsizeiptr size, GLintptr offset) {
+
+        const GpuAllocation& allocation = get(handle);
+        if (allocation.buffer == 0 || offset + size > allocation.size) {
+
+            fprintf(stderr, "ERROR: upload outside of the %s heap allocation\n", name);
+            return;
+        }
+
+        glBindBuffer(GL_COPY_WRITE_BUFFER, allocation.buffer);
+        glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.offset + offset, size, data);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    bool GpuHeap::defragment() {
+
+        bool changed = false;
+
+        for (size_t b = 0; b < blocks.size(); b++) {
+
+            BuddyAllocator& sparse = blocks[b].allocator;
+            if (blocks[b].buffer == 0 || sparse.getUsed() * DEFRAGMENT_OCCUPANCY_DIVISOR >= sparse.getCapacity()) {
+                continue;
+            }
+
+            // evacuate into the blocks that are not sparse themselves, never into new ones
+            for (size_t h = 0; h < allocations.size() && sparse.getUsed() > 0; h++) {
+
+                GpuAllocation& allocation = allocations[h];
+                if (allocation.block != (int)b) {
+                    continue;
+                }
+
+                uint32_t units = unitsFor(allocation.size);
+                GpuAllocation moved = allocation;
+                bool placed = false;
+                for (size_t target = 0; target < blocks.size() && !placed; target++) {
+
+                    const BuddyAllocator& other = blocks[target].allocator;
+                    if (target == b || blocks[target].buffer == 0 ||
+                        other.getUsed() * DEFRAGMENT_OCCUPANCY_DIVISOR < other.getCapacity()) {
+                        continue;
+                    }
+                    placed = allocateIn((int)target, units, moved);
+                }
+
+                if (!placed) {
+                    break;
+                }
+
+                glBindBuffer(GL_COPY_READ_BUFFER, allocation.buffer);
+                glBindBuffer(GL_COPY_WRITE_BUFFER, moved.buffer);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, allocation.offset, moved.offset, allocation.size);
+
+                sparse.free((uint32_t)(allocation.offset / unitSize));
+                allocation = moved;
+                movedBytes += (size_t)allocation.size;
+                changed = true;
+            }
+
+            if (sparse.getUsed() == 0) {
+
+                releaseBlock((int)b);
+                changed = true;
+            }
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+        return changed;
+    }
+
+    void GpuHeap::destroy() {
+
+        for (size_t i = 0; i < blocks.size(); i++) {
+
+            if (blocks[i].buffer != 0) {
+                releaseBlock((int)i);
+            }
+        }
+        blocks.clear();
+        allocations.clear();
+        freeHandles.clear();
+    }
+
+    void GpuHeap::report() const {
+
+        size_t blockCount = 0;
+        size_t reserved = 0;
+        size_t used = 0;
+        size_t freeBytes = 0;
+        size_t largestFree = 0;
+
+        for (size_t i = 0; i < blocks.size(); i++) {
+
+            if (blocks[i].buffer == 0) {
+                continue;
+            }
+
+            const BuddyAllocator& allocator = blocks[i].allocator;
+            size_t capacity = (size_t)allocator.getCapacity() * unitSize;
+            size_t blockUsed = (size_t)allocator.getUsed() * unitSize;
+            size_t blockLargest = (size_t)allocator.getLargestFree() * unitSize;
+
+            blockCount++;
+            reserved += capacity;
+            used += blockUsed;
+            freeBytes += capacity - blockUsed;
+            largestFree = blockLargest > largestFree ? blockLargest : largestFree;
+        }
+
+        // share of the free space outside the largest free range
+        float fragmentation = freeBytes > 0 ? 1.0f - (float)largestFree / (float)freeBytes : 0.0f;
+
+        std::cout << "[INFO] GPU heap " << name << ": " << blockCount << " buffers, " << used / 1024 << "/" << reserved / 1024
+            << " KB used by " << allocations.size() - freeHandles.size() << " allocations, largest free range "
+            << largestFree / 1024 << " KB, " << (int)(fragmentation * 100.0f) << "% fragmented, "
+            << movedBytes / 1024 << " KB moved by defragmentation" << std::endl;
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef GpuHeap_hpp
+#define GpuHeap_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+namespace gps {
+
+    // Binary buddy allocator over a power of two number of units: ranges are rounded up
+    // to a power of two and freed ranges merge back with their buddy.
+    class BuddyAllocator {
+
+    public:
+        explicit BuddyAllocator(uint32_t capacity);
+
+        // Start of a free range of at least count units, false when none is large enough
+        bool allocate(uint32_t count, uint32_t& offset);
+        void free(uint32_t offset);
+
+        uint32_t getCapacity() const;
+        // units held by allocated ranges, rounding included
+        uint32_t getUsed() const;
+        uint32_t getLargestFree() const;
+
+    private:
+        static int orderFor(uint32_t count);
+
+        uint32_t capacity;
+        int maxOrder;
+        uint32_t used;
+        // free range starts per order, a range of order k spans 1 << k units
+        std::vector<std::set<uint32_t> > freeLists;
+        // order of every allocated range by its start
+        std::map<uint32_t, int> allocatedOrders;
+    };
+
+    // Where an allocation currently lives, offset is a multiple of the heap's unit size
+    struct GpuAllocation {
+        GLuint buffer = 0;
+        GLintptr offset = 0;
+        GLsizeiptr size = 0;
+        int block = -1;
+    };
+
+    // Large GL buffers reserved up front and handed out in ranges by a buddy allocator
+    // per buffer. Allocations are referred to by handle, defragment() may move them to
+    // another buffer, so owners look their range up again after it returns true.
+    class GpuHeap {
+
+    public:
+        typedef int Handle;
+
+        // Offsets are multiples of unitSize (the vertex size for vertex data, so that
+        // offset / unitSize is a base vertex); blockUnits must be a power of two
+        GpuHeap(const char* name, GLenum usage, GLsizeiptr unitSize, uint32_t blockUnits);
+
+        // Heap of one vertex format for data rewritten every frame
+        template<typename Format>
+        static GpuHeap& getDynamic() {
+            static GpuHeap heap("dynamic vertices", GL_DYNAMIC_DRAW, sizeof(Format), 64 * 1024);
+            return heap;
+        }
+
+        // -1 when size is 0
+        Handle allocate(GLsizeiptr size);
+        void free(Handle handle);
+        const GpuAllocation& get(Handle handle) const;
+
+        // Writes data at offset bytes into the allocation, without touching the VAO bindings
+        void upload(Handle handle, const void* data, GLsizeiptr size, GLintptr offset = 0);
+
+        // Moves the allocations out of sparsely used buffers into the others and deletes
+        // the emptied buffers, true when any allocation moved or buffer went away
+        bool defragment();
+
+        void destroy();
+        void report() const;
+
+    private:
+        struct Block {
+            GLuint buffer;
+            BuddyAllocator allocator;
+        };
+
+        int createBlock(uint32_t units);
+        void releaseBlock(int block);
+        bool allocateIn(int block, uint32_t units, GpuAllocation& allocation);
+        uint32_t unitsFor(GLsizeiptr size) const;
+
+        const char* name;
+        GLenum usage;
+        GLsizeiptr unitSize;
+        uint32_t blockUnits;
+
+        // released blocks keep their slot with buffer 0, block indices stay stable
+        std::vector<Block> blocks;
+        std::vector<GpuAllocation> allocations;
+        std::vector<Handle> freeHandles;
+
+        size_t movedBytes = 0;
+    };
+}
+
+#endif /* GpuHeap_hpp */
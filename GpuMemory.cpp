@@ -0,0 +1,128 @@
+#include "GpuMemory.hpp"
+
+#include <iostream>
+
+namespace gps {
+
+    static const QualitySettings qualityTiers[QUALITY_TIER_COUNT] = {
+        // textureMipDrop, shadowMapSize (per cascade), rainDensity
+        { 0, 1024, 1.0f },
+        { 1, 768, 0.5f },
+        { 2, 512, 0.25f }
+    };
+
+    static const char* qualityTierNames[QUALITY_TIER_COUNT] = { "high", "medium", "low" };
+    static const char* categoryNames[GPU_MEMORY_CATEGORY_COUNT] = { "textures", "buffers", "render targets" };
+
+    GpuMemory& GpuMemory::get() {
+
+        static GpuMemory instance;
+        return instance;
+    }
+
+    GpuMemory::GpuMemory() {
+
+        budget = (size_t)1024 * 1024 * 1024;
+        used = 0;
+        tier = QUALITY_HIGH;
+
+        for (int i = 0; i < GPU_MEMORY_CATEGORY_COUNT; i++) {
+
+            usedPerCategory[i] = 0;
+        }
+    }
+
+    void GpuMemory::setBudget(size_t bytes) {
+
+        budget = bytes;
+    }
+
+    size_t GpuMemory::getBudget() const {
+
+        return budget;
+    }
+
+    size_t GpuMemory::getUsed() const {
+
+        return used;
+    }
+
+    const QualitySettings& GpuMemory::fit(GpuMemoryCategory category, std::function<size_t(const QualitySettings&)> cost) {
+
+        while (used + cost(qualityTiers[tier]) > budget && tier + 1 < QUALITY_TIER_COUNT) {
+
+            tier = (QualityTier)(tier + 1);
+            std::cout << "[INFO] GPU memory budget exceeded by " << categoryNames[category]
+                << ", quality tier lowered to " << qualityTierNames[tier] << std::endl;
+        }
+
+        if (used + cost(qualityTiers[tier]) > budget) {
+
+            std::cerr << "[WARNING] " << categoryNames[category]
+                << " allocation exceeds the GPU memory budget even at the lowest quality tier" << std::endl;
+        }
+
+        return qualityTiers[tier];
+    }
+
+    const QualitySettings& GpuMemory::getSettings() const {
+
+        return qualityTiers[tier];
+    }
+
+    QualityTier GpuMemory::getTier() const {
+
+        return tier;
+    }
+
+    void GpuMemory::track(GpuMemoryCategory category, GLuint name, size_t bytes) {
+
+        // re-tracking a name replaces its previous size
+        release(category, name);
+
+        allocations[std::make_pair((int)category, name)] = bytes;
+        usedPerCategory[category] += bytes;
+        used += bytes;
+    }
+
+    void GpuMemory::release(GpuMemoryCategory category, GLuint name) {
+
+        std::map<std::pair<int, GLuint>, size_t>::iterator it = allocations.find(std::make_pair((int)category, name));
+
+        if (it == allocations.end()) {
+
+            return;
+        }
+
+        usedPerCategory[category] -= it->second;
+        used -= it->second;
+        allocations.erase(it);
+    }
+
+    void GpuMemory::report() const {
+
+        const double MB = 1024.0 * 1024.0;
+
+        std::cout << "[INFO] GPU memory: " << used / MB << " / " << budget / MB << " MB"
+            << " (quality tier " << qualityTierNames[tier] << ")" << std::endl;
+
+        for (int i = 0; i < GPU_MEMORY_CATEGORY_COUNT; i++) {
+
+            std::cout << "       " << categoryNames[i] << ": " << usedPerCategory[i] / MB << " MB" << std::endl;
+        }
+    }
+
+    size_t GpuMemory::imageBytes(int width, int height, int layers, int bytesPerPixel, bool mipmapped) {
+
+        size_t bytes = (size_t)width * height * layers * bytesPerPixel;
+
+        while (mipmapped && (width > 1 || height > 1)) {
+
+            width = width > 1 ? width / 2 : 1;
+            height = height > 1 ? height / 2 : 1;
+            bytes += (size_t)width * height * layers * bytesPerPixel;
+        }
+
+        return bytes;
+    }
+}
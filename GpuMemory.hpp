@@ -0,0 +1,69 @@
+#ifndef GpuMemory_hpp
+#define GpuMemory_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <utility>
+
+namespace gps {
+
+    enum GpuMemoryCategory { GPU_MEMORY_TEXTURE, GPU_MEMORY_BUFFER, GPU_MEMORY_RENDER_TARGET, GPU_MEMORY_CATEGORY_COUNT };
+
+    enum QualityTier { QUALITY_HIGH, QUALITY_MEDIUM, QUALITY_LOW, QUALITY_TIER_COUNT };
+
+    // What an allocation path should do at a given quality tier
+    struct QualitySettings {
+
+        // top mip levels skipped when uploading material textures
+        int textureMipDrop;
+        // resolution of every shadow cascade
+        int shadowMapSize;
+        // fraction of the requested rain drops that get allocated
+        float rainDensity;
+    };
+
+    // Central accountant for GPU memory, every allocation path reports here
+    class GpuMemory {
+
+    public:
+        static GpuMemory& get();
+
+        void setBudget(size_t bytes);
+        size_t getBudget() const;
+        size_t getUsed() const;
+
+        // Returns the settings the allocation should use so that cost(settings) fits the budget,
+        // lowering the quality tier for this and every later allocation when it does not
+        const QualitySettings& fit(GpuMemoryCategory category, std::function<size_t(const QualitySettings&)> cost);
+        const QualitySettings& getSettings() const;
+        QualityTier getTier() const;
+
+        void track(GpuMemoryCategory category, GLuint name, size_t bytes);
+        void release(GpuMemoryCategory category, GLuint name);
+
+        void report() const;
+
+        // Size of an image with the given dimensions, including its mip chain when mipmapped
+        static size_t imageBytes(int width, int height, int layers, int bytesPerPixel, bool mipmapped);
+
+    private:
+        GpuMemory();
+
+        size_t budget;
+        size_t used;
+        size_t usedPerCategory[GPU_MEMORY_CATEGORY_COUNT];
+        QualityTier tier;
+        std::map<std::pair<int, GLuint>, size_t> allocations;
+    };
+}
+
+#endif /* GpuMemory_hpp */
@@ -0,0 +1,110 @@
+#include "GpuTimer.hpp"
+
+#include <iostream>
+#include <string>
+
+namespace gps {
+
+    GpuTimer::GpuTimer(const char* name) {
+
+        this->name = name;
+        for (int i = 0; i < QUERY_COUNT; i++) {
+
+            queries[i] = 0;
+            pending[i] = false;
+        }
+    }
+
+    void GpuTimer::begin() {
+
+        if (queries[0] == 0) {
+            glGenQueries(QUERY_COUNT, queries);
+        }
+
+        // a result still not there after a full ring is waited for rather than dropped, the
+        // late ones are the slow frames and leaving them out would bias the average low
+        collect(next);
+
+        glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+    }
+
+    void GpuTimer::collect(int query) {
+
+        if (!pending[query]) {
+            return;
+        }
+
+        GLint available = 0;
+        glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            stalls++;
+        }
+
+        // blocks until the GPU is done with the range when it was not available
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &elapsed);
+        totalNanoseconds += elapsed;
+        samples++;
+        pending[query] = false;
+    }
+
+    void GpuTimer::collectPending() {
+
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            collect((next + i) % QUERY_COUNT);
+        }
+    }
+
+    void GpuTimer::end() {
+
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[next] = true;
+        next = (next + 1) % QUERY_COUNT;
+    }
+
+    double GpuTimer::getAverageMilliseconds() const {
+
+        return samples > 0 ? (double)totalNanoseconds / samples / 1000000.0 : 0.0;
+    }
+
+    unsigned int GpuTimer::getSampleCount() const {
+
+        return samples;
+    }
+
+    void GpuTimer::reset() {
+
+        totalNanoseconds = 0;
+        samples = 0;
+        stalls = 0;
+        // ranges measured before the reset do not count
+        for (int i = 0; i < QUERY_COUNT; i++) {
+            pending[i] = false;
+        }
+    }
+
+    void GpuTimer::destroy() {
+
+        if (queries[0] != 0) {
+
+            glDeleteQueries(QUERY_COUNT, queries);
+            for (int i = 0; i < QUERY_COUNT; i++) {
+
+                queries[i] = 0;
+                pending[i] = false;
+            }
+        }
+    }
+
+    void GpuTimer::report() const {
+
+        if (samples == 0) {
+
+            std::cout << "[INFO] GPU time of " << name << ": not measured yet" << std::endl;
+            return;
+        }
+        std::cout << "[INFO] GPU time of " << name << ": " << getAverageMilliseconds()
+            << " ms on average over " << samples << " frames"
+            << (stalls > 0 ? ", waited for " + std::to_string(stalls) + " late results" : std::string()) << std::endl;
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef GpuTimer_hpp
+#define GpuTimer_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    // GPU time of a range of commands, measured with GL_TIME_ELAPSED queries. Each range
+    // takes the next query of a small ring and the result is read when that query comes
+    // around again, frames later, so timing rarely waits for the GPU; when a result is
+    // still not there it is waited for, and counted, rather than dropped.
+    class GpuTimer {
+
+    public:
+        explicit GpuTimer(const char* name);
+
+        // Only one GL_TIME_ELAPSED query can be active, ranges of timers must not overlap
+        void begin();
+        void end();
+
+        // Reads the results of every range still in flight, waiting for the GPU, so that an
+        // average taken now covers all the ranges measured so far
+        void collectPending();
+
+        // Over the ranges measured since the last reset
+        double getAverageMilliseconds() const;
+        unsigned int getSampleCount() const;
+        void reset();
+
+        void destroy();
+        void report() const;
+
+    private:
+        enum { QUERY_COUNT = 4 };
+
+        // adds the result of the query if it is in flight
+        void collect(int query);
+
+        const char* name;
+        GLuint queries[QUERY_COUNT];
+        bool pending[QUERY_COUNT];
+        int next = 0;
+
+        GLuint64 totalNanoseconds = 0;
+        unsigned int samples = 0;
+        // results that had to be waited for
+        unsigned int stalls = 0;
+    };
+}
+
+#endif /* GpuTimer_hpp */
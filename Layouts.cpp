@@ -0,0 +1,29 @@
+#include "Layouts.hpp"
+#include "UniformBuffers.hpp"
+#include "Mesh.hpp"
+
+namespace gps {
+
+    std::string glslLayoutSource(const std::string& name) {
+
+        if (name == FrameUniforms::blockName()) {
+            return FrameUniforms::glslDeclaration();
+        }
+        if (name == LightUniforms::blockName()) {
+            return LightUniforms::glslDeclaration();
+        }
+        if (name == MaterialUniforms::blockName()) {
+            return MaterialUniforms::glslDeclaration();
+        }
+        if (name == "ProgramUniforms") {
+            return programUniformsGlsl();
+        }
+        if (name == "MeshVertex") {
+            return Vertex::glslInputs();
+        }
+        if (name == "PositionVertex") {
+            return PositionVertex::glslInputs();
+        }
+        return std::string();
+    }
+}
@@ -0,0 +1,170 @@
+#ifndef Layouts_hpp
+#define Layouts_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <sstream>
+#include <string>
+
+// Uniform blocks, plain uniforms and vertex formats are declared once, as lists of
+// (type, name) entries. The macros below expand a list into the C++ struct, the
+// std140 checks, the attribute setup and the GLSL text the shaders #include, so
+// the two sides cannot drift apart. A type without a GlslType specialization, or
+// a block member whose C++ size differs from its std140 size, does not compile.
+
+namespace gps {
+
+    // GLSL counterpart of a C++ type
+    template<typename T> struct GlslType;
+
+#define GPS_GLSL_TYPE(CppType, GlslName, Std140Alignment, Std140Size, Components, ComponentType) \
+    template<> struct GlslType<CppType> { \
+        enum : size_t { std140Alignment = Std140Alignment, std140Size = Std140Size }; \
+        /* 0 for types that cannot be a vertex attribute */ \
+        enum : GLint { components = Components }; \
+        enum : GLenum { componentType = ComponentType }; \
+        static const char* name() { return GlslName; } \
+    };
+
+    GPS_GLSL_TYPE(GLfloat, "float", 4, 4, 1, GL_FLOAT)
+    GPS_GLSL_TYPE(GLint, "int", 4, 4, 1, GL_INT)
+    GPS_GLSL_TYPE(glm::vec2, "vec2", 8, 8, 2, GL_FLOAT)
+    GPS_GLSL_TYPE(glm::vec3, "vec3", 16, 12, 3, GL_FLOAT)
+    GPS_GLSL_TYPE(glm::vec4, "vec4", 16, 16, 4, GL_FLOAT)
+    GPS_GLSL_TYPE(glm::ivec4, "ivec4", 16, 16, 4, GL_INT)
+    GPS_GLSL_TYPE(glm::mat3, "mat3", 16, 48, 0, GL_FLOAT)
+    GPS_GLSL_TYPE(glm::mat4, "mat4", 16, 64, 0, GL_FLOAT)
+
+    // Points the attribute at location to a member of the vertex bound to GL_ARRAY_BUFFER
+    template<typename T>
+    void setVertexAttribute(GLuint location, GLsizei stride, size_t offset) {
+
+        static_assert(GlslType<T>::components > 0, "type cannot be a vertex attribute");
+
+        if (GlslType<T>::componentType == GL_INT) {
+            glVertexAttribIPointer(location, GlslType<T>::components, GL_INT, stride, (GLvoid*)offset);
+        }
+        else {
+            glVertexAttribPointer(location, GlslType<T>::components, GlslType<T>::componentType, GL_FALSE, stride, (GLvoid*)offset);
+        }
+        glEnableVertexAttribArray(location);
+    }
+
+    // GLSL source for an "#include <Name>" line, empty when Name is unknown
+    std::string glslLayoutSource(const std::string& name);
+}
+
+// ----------------------------------------------------------------------
+// Vertex formats: ATTRIBUTES(A) lists A(type, member, glslName),
+// attribute locations follow the list order
+// ----------------------------------------------------------------------
+#define GPS_VERTEX_MEMBER(Type, Member, GlslName) Type Member;
+#define GPS_VERTEX_SETUP(Type, Member, GlslName) \
+    gps::setVertexAttribute<Type>(location++, sizeof(Self), offsetof(Self, Member));
+#define GPS_VERTEX_GLSL(Type, Member, GlslName) \
+    glsl << "layout(location = " << location++ << ") in " << gps::GlslType<Type>::name() << " " #GlslName ";\n";
+
+#define GPS_DECLARE_VERTEX_FORMAT(Name, ATTRIBUTES) \
+    struct Name { \
+        ATTRIBUTES(GPS_VERTEX_MEMBER) \
+        /* sets up the attributes of the bound VAO from the bound GL_ARRAY_BUFFER */ \
+        static void setupAttributes() { \
+            typedef Name Self; \
+            GLuint location = 0; \
+            ATTRIBUTES(GPS_VERTEX_SETUP) \
+        } \
+        static std::string glslInputs() { \
+            std::stringstream glsl; \
+            GLuint location = 0; \
+            ATTRIBUTES(GPS_VERTEX_GLSL) \
+            return glsl.str(); \
+        } \
+    };
+
+// ----------------------------------------------------------------------
+// std140 uniform blocks: MEMBERS(M, A) lists M(type, member) and A(type, member, count)
+// ----------------------------------------------------------------------
+#define GPS_BLOCK_MEMBER(Type, Member) \
+    static_assert(sizeof(Type) == gps::GlslType<Type>::std140Size, #Type " does not have its std140 size"); \
+    alignas(gps::GlslType<Type>::std140Alignment) Type Member;
+#define GPS_BLOCK_ARRAY(Type, Member, Count) \
+    static_assert(sizeof(Type) == gps::GlslType<Type>::std140Size && sizeof(Type) % 16 == 0, \
+        "std140 array elements are padded to 16 bytes, " #Type " would not match"); \
+    alignas(16) Type Member[Count];
+#define GPS_BLOCK_MEMBER_GLSL(Type, Member) \
+    glsl << "    " << gps::GlslType<Type>::name() << " " #Member ";\n";
+#define GPS_BLOCK_ARRAY_GLSL(Type, Member, Count) \
+    glsl << "    " << gps::GlslType<Type>::name() << " " #Member "[" << (Count) << "];\n";
+
+#define GPS_DECLARE_UNIFORM_BLOCK(Name, BlockName, MEMBERS) \
+    struct Name { \
+        MEMBERS(GPS_BLOCK_MEMBER, GPS_BLOCK_ARRAY) \
+        static const char* blockName() { return #BlockName; } \
+        static std::string glslDeclaration() { \
+            std::stringstream glsl; \
+            glsl << "layout(std140) uniform " #BlockName " {\n"; \
+            MEMBERS(GPS_BLOCK_MEMBER_GLSL, GPS_BLOCK_ARRAY_GLSL) \
+            glsl << "};\n"; \
+            return glsl.str(); \
+        } \
+    }; \
+    static_assert(sizeof(Name) % 16 == 0, #Name " is not padded like the std140 " #BlockName);
+
+// ----------------------------------------------------------------------
+// Plain uniforms: UNIFORMS(U, S) lists U(type, name) and S(samplerType, name).
+// Declares gps::UniformId, the typed UniformTraits used by Shader::set<Id>()
+// and the GLSL declarations of every entry.
+// ----------------------------------------------------------------------
+#define GPS_UNIFORM_ID(Type, Name) Name,
+#define GPS_SAMPLER_ID(SamplerType, Name) Name,
+#define GPS_UNIFORM_TRAITS(Type, Name) \
+    template<> struct UniformTraits<UniformId::Name> { \
+        typedef Type ValueType; \
+        static const char* name() { return #Name; } \
+    };
+#define GPS_SAMPLER_TRAITS(SamplerType, Name) \
+    template<> struct UniformTraits<UniformId::Name> { \
+        /* texture unit */ \
+        typedef GLint ValueType; \
+        static const char* name() { return #Name; } \
+    };
+#define GPS_UNIFORM_NAME(Type, Name) #Name,
+#define GPS_SAMPLER_NAME(SamplerType, Name) #Name,
+#define GPS_UNIFORM_GLSL(Type, Name) \
+    glsl << "uniform " << gps::GlslType<Type>::name() << " " #Name ";\n";
+#define GPS_SAMPLER_GLSL(SamplerType, Name) \
+    glsl << "uniform " #SamplerType " " #Name ";\n";
+
+#define GPS_DECLARE_PROGRAM_UNIFORMS(UNIFORMS) \
+    enum class UniformId { UNIFORMS(GPS_UNIFORM_ID, GPS_SAMPLER_ID) Count }; \
+    template<UniformId Id> struct UniformTraits; \
+    UNIFORMS(GPS_UNIFORM_TRAITS, GPS_SAMPLER_TRAITS) \
+    inline const char* uniformName(UniformId id) { \
+        static const char* names[] = { UNIFORMS(GPS_UNIFORM_NAME, GPS_SAMPLER_NAME) }; \
+        return names[(int)id]; \
+    } \
+    inline std::string programUniformsGlsl() { \
+        std::stringstream glsl; \
+        UNIFORMS(GPS_UNIFORM_GLSL, GPS_SAMPLER_GLSL) \
+        return glsl.str(); \
+    }
+
+namespace gps {
+
+#define GPS_POSITION_VERTEX(ATTRIBUTE) \
+    ATTRIBUTE(glm::vec3, position, vertexPosition)
+
+    // Position-only vertex of the rain lines and the skybox cube (shaders: #include <PositionVertex>)
+    GPS_DECLARE_VERTEX_FORMAT(PositionVertex, GPS_POSITION_VERTEX)
+}
+
+#endif /* Layouts_hpp */
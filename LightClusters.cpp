@@ -0,0 +1,405 @@
+#include "LightClusters.hpp"
+#include "GLStateCache.hpp"
+#include "GpuMemory.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <thread>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define GPS_CLUSTERS_SSE
+    #include <xmmintrin.h>
+#endif
+
+namespace gps {
+
+    static const int CLUSTER_COUNT = LightClusters::CLUSTERS_X * LightClusters::CLUSTERS_Y * LightClusters::CLUSTERS_Z;
+
+    // slice 0 runs from the near plane to here, slices 1 and up split the rest exponentially
+    static const float FIRST_SLICE_DEPTH = 5.0f;
+
+    // fewer lights than this are binned on the calling thread
+    static const size_t THREADED_LIGHTS = 64;
+
+    // padding lights, never inside any froxel
+    static const float FAR_AWAY = 1e18f;
+
+    static unsigned int workerCount() {
+
+        unsigned int threads = std::thread::hardware_concurrency();
+        return std::max(1u, std::min(threads, 8u));
+    }
+
+    float pointLightRange(float constant, float linear, float quadratic, float cutoff) {
+
+        // quadratic d^2 + linear d + constant - 1 / cutoff = 0
+        float c = constant - 1.0f / cutoff;
+        if (quadratic > 0.0f) {
+            return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+        }
+        return linear > 0.0f ? -c / linear : 0.0f;
+    }
+
+    void LightClusters::init() {
+
+        GLuint buffers[3];
+        glGenBuffers(3, buffers);
+        lightBuffer = buffers[0];
+        rangeBuffer = buffers[1];
+        indexBuffer = buffers[2];
+
+        // the names only become buffers once bound, glTexBuffer rejects them before
+        for (int i = 0; i < 3; i++) {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        GLuint textures[3];
+        glGenTextures(3, textures);
+        lightTexture = textures[0];
+        rangeTexture = textures[1];
+        indexTexture = textures[2];
+
+        // the texture keeps the buffer name, storage respecified later stays attached
+        GLStateCache::get().bindTexture(GL_TEXTURE_BUFFER, lightTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, lightBuffer);
+        GLStateCache::get().bindTexture(GL_TEXTURE_BUFFER, rangeTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, rangeBuffer);
+        GLStateCache::get().bindTexture(GL_TEXTURE_BUFFER, indexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, indexBuffer);
+        GLStateCache::get().bindTexture(GL_TEXTURE_BUFFER, 0);
+
+        boundsMin.resize(CLUSTER_COUNT);
+        boundsMax.resize(CLUSTER_COUNT);
+        rangeData.assign(CLUSTER_COUNT * 2, 0);
+    }
+
+    void LightClusters::setProjection(float fovY, float aspect, float nearPlane, float farPlane, int viewportWidth, int viewportHeight) {
+
+        if (fovY == this->fovY && aspect == this->aspect && nearPlane == this->nearPlane && farPlane == this->farPlane &&
+            viewportWidth == this->viewportWidth && viewportHeight == this->viewportHeight) {
+            return;
+        }
+
+        this->fovY = fovY;
+        this->aspect = aspect;
+        this->nearPlane = nearPlane;
+        this->farPlane = farPlane;
+        this->viewportWidth = viewportWidth;
+        this->viewportHeight = viewportHeight;
+
+        // slice = floor(log(depth) * sliceScale + sliceBias), clamped to the grid: slice k >= 1
+        // starts at firstDepth * (far / firstDepth)^((k - 1) / (CLUSTERS_Z - 1)), so slice 1 starts
+        // at firstDepth and everything closer lands below 1, in slice 0
+        float firstDepth = std::max(nearPlane, std::min(FIRST_SLICE_DEPTH, farPlane * 0.5f));
+        float logRange = std::log(farPlane / firstDepth);
+        sliceScale = (CLUSTERS_Z - 1) / logRange;
+        sliceBias = 1.0f - (CLUSTERS_Z - 1) * std::log(firstDepth) / logRange;
+
+        sliceNear[0] = nearPlane;
+        sliceFar[0] = firstDepth;
+        for (int k = 1; k < CLUSTERS_Z; k++) {
+
+            sliceNear[k] = firstDepth * std::pow(farPlane / firstDepth, (float)(k - 1) / (CLUSTERS_Z - 1));
+            sliceFar[k] = k == CLUSTERS_Z - 1 ? farPlane : firstDepth * std::pow(farPlane / firstDepth, (float)k / (CLUSTERS_Z - 1));
+        }
+
+        float tanHalfY = std::tan(fovY * 0.5f);
+        float tanHalfX = tanHalfY * aspect;
+
+        for (int k = 0; k < CLUSTERS_Z; k++) {
+            for (int row = 0; row < CLUSTERS_Y; row++) {
+                for (int column = 0; column < CLUSTERS_X; column++) {
+
+                    // tile edges in NDC, at both ends of the slice
+                    float x0 = -1.0f + 2.0f * column / CLUSTERS_X;
+                    float x1 = -1.0f + 2.0f * (column + 1) / CLUSTERS_X;
+                    float y0 = -1.0f + 2.0f * row / CLUSTERS_Y;
+                    float y1 = -1.0f + 2.0f * (row + 1) / CLUSTERS_Y;
+
+                    glm::vec3 low(FAR_AWAY), high(-FAR_AWAY);
+                    float depths[2] = { sliceNear[k], sliceFar[k] };
+                    for (int d = 0; d < 2; d++) {
+
+                        float xs[2] = { x0 * depths[d] * tanHalfX, x1 * depths[d] * tanHalfX };
+                        float ys[2] = { y0 * depths[d] * tanHalfY, y1 * depths[d] * tanHalfY };
+                        low.x = std::min(low.x, std::min(xs[0], xs[1]));
+                        high.x = std::max(high.x, std::max(xs[0], xs[1]));
+                        low.y = std::min(low.y, std::min(ys[0], ys[1]));
+                        high.y = std::max(high.y, std::max(ys[0], ys[1]));
+                    }
+                    low.z = -sliceFar[k];
+                    high.z = -sliceNear[k];
+
+                    int cluster = (k * CLUSTERS_Y + row) * CLUSTERS_X + column;
+                    boundsMin[cluster] = low;
+                    boundsMax[cluster] = high;
+                }
+            }
+        }
+    }
+
+    void LightClusters::update(const std::vector<PointLight>& lights, const glm::mat4& view) {
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        uploadLights(lights, view);
+        listsCurrent = true;
+
+        // slices are independent, workers take them in turn
+        nextSlice = 0;
+        if (lights.size() >= THREADED_LIGHTS) {
+
+            std::vector<std::future<void>> jobs;
+            unsigned int workers = workerCount();
+            for (unsigned int i = 0; i < workers; i++) {
+                jobs.push_back(std::async(std::launch::async, [this]() { binSlices(); }));
+            }
+            for (size_t i = 0; i < jobs.size(); i++) {
+                jobs[i].get();
+            }
+        }
+        else {
+            binSlices();
+        }
+
+        // the slices hold their froxel lists in froxel order already
+        indexData.clear();
+        litClusters = 0;
+        busiestCluster = 0;
+        for (int k = 0; k < CLUSTERS_Z; k++) {
+
+            int firstCluster = k * CLUSTERS_X * CLUSTERS_Y;
+            GLuint offset = (GLuint)indexData.size();
+            for (int c = 0; c < CLUSTERS_X * CLUSTERS_Y; c++) {
+
+                uint32_t count = clusterLightCounts[firstCluster + c];
+                rangeData[(firstCluster + c) * 2] = offset;
+                rangeData[(firstCluster + c) * 2 + 1] = count;
+                offset += count;
+                litClusters += count > 0 ? 1 : 0;
+                busiestCluster = std::max(busiestCluster, (unsigned int)count);
+            }
+            indexData.insert(indexData.end(), slices[k].indices.begin(), slices[k].indices.end());
+        }
+        if (indexData.empty()) {
+            indexData.push_back(0);
+        }
+
+        uploadBuffer(rangeBuffer, rangeCapacity, &rangeData[0], (GLsizeiptr)(rangeData.size() * sizeof(GLuint)));
+        uploadBuffer(indexBuffer, indexCapacity, &indexData[0], (GLsizeiptr)(indexData.size() * sizeof(GLuint)));
+
+        binMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void LightClusters::uploadLights(const std::vector<PointLight>& lights, const glm::mat4& view) {
+
+        // the froxel lists are for the previous lights until update bins these
+        listsCurrent = false;
+
+        viewLights.resize(lights.size());
+        lightData.resize(std::max<size_t>(lights.size(), 1) * 2, glm::vec4(0.0f));
+        for (size_t i = 0; i < lights.size(); i++) {
+
+            glm::vec3 position = glm::vec3(view * glm::vec4(lights[i].position, 1.0f));
+            viewLights[i] = glm::vec4(position, lights[i].radius);
+            lightData[i * 2] = viewLights[i];
+            lightData[i * 2 + 1] = glm::vec4(lights[i].color, 0.0f);
+        }
+
+        uploadBuffer(lightBuffer, lightCapacity, &lightData[0], (GLsizeiptr)(lightData.size() * sizeof(glm::vec4)));
+    }
+
+    void LightClusters::binSlices() {
+
+        for (int slice = nextSlice++; slice < CLUSTERS_Z; slice = nextSlice++) {
+            binSlice(slice);
+        }
+    }
+
+    void LightClusters::binSlice(int k) {
+
+        Slice& slice = slices[k];
+        slice.x.clear();
+        slice.y.clear();
+        slice.z.clear();
+        slice.radius.clear();
+        slice.lights.clear();
+        slice.indices.clear();
+
+        // only lights reaching into the slice's depth range go on to the froxel tests
+        for (size_t i = 0; i < viewLights.size(); i++) {
+
+            float depth = -viewLights[i].z;
+            float radius = viewLights[i].w;
+            if (depth + radius < sliceNear[k] || depth - radius > sliceFar[k]) {
+                continue;
+            }
+
+            slice.x.push_back(viewLights[i].x);
+            slice.y.push_back(viewLights[i].y);
+            slice.z.push_back(viewLights[i].z);
+            slice.radius.push_back(radius);
+            slice.lights.push_back((uint32_t)i);
+        }
+        while (slice.x.size() % 4 != 0) {
+
+            slice.x.push_back(FAR_AWAY);
+            slice.y.push_back(FAR_AWAY);
+            slice.z.push_back(FAR_AWAY);
+            slice.radius.push_back(0.0f);
+            slice.lights.push_back(0);
+        }
+
+        size_t count = slice.x.size();
+        int firstCluster = k * CLUSTERS_X * CLUSTERS_Y;
+        for (int c = 0; c < CLUSTERS_X * CLUSTERS_Y; c++) {
+
+            const glm::vec3& low = boundsMin[firstCluster + c];
+            const glm::vec3& high = boundsMax[firstCluster + c];
+            size_t before = slice.indices.size();
+
+            // a sphere reaches the box when the box point nearest its center is within the radius
+#ifdef GPS_CLUSTERS_SSE
+            __m128 lowX = _mm_set1_ps(low.x), lowY = _mm_set1_ps(low.y), lowZ = _mm_set1_ps(low.z);
+            __m128 highX = _mm_set1_ps(high.x), highY = _mm_set1_ps(high.y), highZ = _mm_set1_ps(high.z);
+            __m128 zero = _mm_setzero_ps();
+
+            for (size_t i = 0; i < count; i += 4) {
+
+                __m128 x = _mm_loadu_ps(&slice.x[i]);
+                __m128 y = _mm_loadu_ps(&slice.y[i]);
+                __m128 z = _mm_loadu_ps(&slice.z[i]);
+                __m128 radius = _mm_loadu_ps(&slice.radius[i]);
+
+                __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowX, x), _mm_sub_ps(x, highX)), zero);
+                __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowY, y), _mm_sub_ps(y, highY)), zero);
+                __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(lowZ, z), _mm_sub_ps(z, highZ)), zero);
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+
+                int mask = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(radius, radius)));
+                for (int lane = 0; mask != 0; lane++, mask >>= 1) {
+                    if (mask & 1) {
+                        slice.indices.push_back(slice.lights[i + lane]);
+                    }
+                }
+            }
+#else
+            for (size_t i = 0; i < count; i++) {
+
+                float dx = std::max(std::max(low.x - slice.x[i], slice.x[i] - high.x), 0.0f);
+                float dy = std::max(std::max(low.y - slice.y[i], slice.y[i] - high.y), 0.0f);
+                float dz = std::max(std::max(low.z - slice.z[i], slice.z[i] - high.z), 0.0f);
+                if (dx * dx + dy * dy + dz * dz <= slice.radius[i] * slice.radius[i]) {
+                    slice.indices.push_back(slice.lights[i]);
+                }
+            }
+#endif
+
+            clusterLightCounts[firstCluster + c] = (uint32_t)(slice.indices.size() - before);
+        }
+    }
+
+    void LightClusters::uploadBuffer(GLuint buffer, GLsizeiptr& capacity, const void* data, GLsizeiptr size) {
+
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+        if (size > capacity) {
+
+            capacity = std::max(size, capacity * 2);
+            GpuMemory::get().track(GPU_MEMORY_BUFFER, buffer, (size_t)capacity);
+        }
+
+        // orphaned every upload, the previous frame may still read it
+        glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, size, data);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+
+    void LightClusters::fillUniforms(LightUniforms& uniforms) const {
+
+        uniforms.clusterCounts = glm::ivec4(CLUSTERS_X, CLUSTERS_Y, CLUSTERS_Z, 0);
+        uniforms.clusterScales = glm::vec4(
+            viewportWidth > 0 ? (float)viewportWidth / CLUSTERS_X : 1.0f,
+            viewportHeight > 0 ? (float)viewportHeight / CLUSTERS_Y : 1.0f,
+            sliceScale, sliceBias);
+    }
+
+    void LightClusters::bind(GLuint firstUnit) const {
+
+        GLStateCache::get().bindTexture(firstUnit, GL_TEXTURE_BUFFER, lightTexture);
+        GLStateCache::get().bindTexture(firstUnit + 1, GL_TEXTURE_BUFFER, rangeTexture);
+        GLStateCache::get().bindTexture(firstUnit + 2, GL_TEXTURE_BUFFER, indexTexture);
+    }
+
+    void LightClusters::destroy() {
+
+        GLuint textures[3] = { lightTexture, rangeTexture, indexTexture };
+        GLStateCache::get().deleteTextures(3, textures);
+
+        GLuint buffers[3] = { lightBuffer, rangeBuffer, indexBuffer };
+        for (int i = 0; i < 3; i++) {
+            GpuMemory::get().release(GPU_MEMORY_BUFFER, buffers[i]);
+        }
+        glDeleteBuffers(3, buffers);
+
+        lightTexture = rangeTexture = indexTexture = 0;
+        lightBuffer = rangeBuffer = indexBuffer = 0;
+        lightCapacity = rangeCapacity = indexCapacity = 0;
+    }
+
+    void LightClusters::checkBinning(unsigned int& missing, unsigned int& extra) const {
+
+        missing = 0;
+        extra = 0;
+
+        std::vector<unsigned char> listed(viewLights.size());
+        for (int cluster = 0; cluster < CLUSTER_COUNT; cluster++) {
+
+            std::fill(listed.begin(), listed.end(), 0);
+            GLuint first = rangeData[cluster * 2];
+            GLuint count = rangeData[cluster * 2 + 1];
+            for (GLuint i = 0; i < count; i++) {
+                listed[indexData[first + i]] = 1;
+            }
+
+            // every light against the froxel, no slice prefilter and no SIMD
+            const glm::vec3& low = boundsMin[cluster];
+            const glm::vec3& high = boundsMax[cluster];
+            for (size_t i = 0; i < viewLights.size(); i++) {
+
+                glm::vec3 center = glm::vec3(viewLights[i]);
+                glm::vec3 offset = glm::clamp(center, low, high) - center;
+                bool reaches = glm::dot(offset, offset) <= viewLights[i].w * viewLights[i].w;
+                if (reaches && !listed[i]) {
+                    missing++;
+                }
+                else if (!reaches && listed[i]) {
+                    extra++;
+                }
+            }
+        }
+    }
+
+    void LightClusters::report() const {
+
+        std::cout << "[INFO] Light clusters: " << viewLights.size() << " lights binned in " << binMilliseconds << " ms, "
+            << litClusters << " of " << CLUSTER_COUNT << " froxels lit, "
+            << (litClusters > 0 ? (double)(indexData.size()) / litClusters : 0.0) << " lights per lit froxel on average, "
+            << busiestCluster << " at most" << std::endl;
+
+        if (!listsCurrent) {
+            return;
+        }
+
+        unsigned int missing, extra;
+        checkBinning(missing, extra);
+        std::cout << "[INFO] Light clusters checked against every light in every froxel: "
+            << missing << " missing, " << extra << " extra" << std::endl;
+        if (missing > 0 || extra > 0) {
+            fprintf(stderr, "ERROR: the light clusters disagree with the brute force binning\n");
+        }
+    }
+}
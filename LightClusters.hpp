@@ -0,0 +1,132 @@
+#ifndef LightClusters_hpp
+#define LightClusters_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "UniformBuffers.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Point light that adds nothing past its radius
+    struct PointLight {
+        // world space
+        glm::vec3 position;
+        float radius;
+        glm::vec3 color;
+    };
+
+    // Distance where the attenuation 1 / (constant + linear d + quadratic d^2) drops to cutoff
+    float pointLightRange(float constant, float linear, float quadratic, float cutoff);
+
+    // Clustered forward lighting: the view frustum is cut into froxels, screen tiles by
+    // exponential depth slices, and every froxel lists the point lights whose range reaches
+    // it. The binning runs on the CPU, workers take one depth slice at a time and test the
+    // lights overlapping it four at a time against its froxels. Lights, froxel ranges and
+    // light lists go to buffer textures (shaders: pointLightData, clusterLightRanges and
+    // clusterLightIndices), a fragment only loops over the list of its froxel.
+    class LightClusters {
+
+    public:
+        static const int CLUSTERS_X = 16;
+        static const int CLUSTERS_Y = 9;
+        static const int CLUSTERS_Z = 24;
+
+        void init();
+
+        // Rebuilds the froxel bounds, only when the perspective or the viewport changed
+        void setProjection(float fovY, float aspect, float nearPlane, float farPlane, int viewportWidth, int viewportHeight);
+
+        // Bins the lights as seen through view and uploads the buffers
+        void update(const std::vector<PointLight>& lights, const glm::mat4& view);
+        // Only uploads the lights as seen through view, for renderers that do not need the
+        // froxel lists (light volumes read pointLightData by instance)
+        void uploadLights(const std::vector<PointLight>& lights, const glm::mat4& view);
+
+        // Grid size and depth slice mapping of the light block
+        void fillUniforms(LightUniforms& uniforms) const;
+
+        // Binds the light, range and index buffer textures to firstUnit and the next two units
+        void bind(GLuint firstUnit) const;
+
+        void destroy();
+        // Light distribution and binning time of the last update, and the froxel lists checked
+        // against testing every light against every froxel
+        void report() const;
+
+    private:
+        // Lights overlapping one depth slice, padded to a multiple of four, and the light
+        // lists of the slice's froxels, one after the other
+        struct Slice {
+            std::vector<float> x, y, z, radius;
+            std::vector<uint32_t> lights;
+            std::vector<uint32_t> indices;
+        };
+
+        void binSlices();
+        void binSlice(int slice);
+        // Lights of the last update the froxel lists lack, and list entries that do not reach
+        // their froxel, found by testing every light against every froxel
+        void checkBinning(unsigned int& missing, unsigned int& extra) const;
+        static void uploadBuffer(GLuint buffer, GLsizeiptr& capacity, const void* data, GLsizeiptr size);
+
+        // view space froxel bounds, by (slice * CLUSTERS_Y + row) * CLUSTERS_X + column
+        std::vector<glm::vec3> boundsMin;
+        std::vector<glm::vec3> boundsMax;
+        // view depth where every slice starts and ends
+        float sliceNear[CLUSTERS_Z];
+        float sliceFar[CLUSTERS_Z];
+
+        float fovY = 0.0f;
+        float aspect = 0.0f;
+        float nearPlane = 0.0f;
+        float farPlane = 0.0f;
+        int viewportWidth = 0;
+        int viewportHeight = 0;
+        float sliceScale = 0.0f;
+        float sliceBias = 0.0f;
+
+        // view space lights of the current update
+        std::vector<glm::vec4> viewLights;
+        Slice slices[CLUSTERS_Z];
+        uint32_t clusterLightCounts[CLUSTERS_X * CLUSTERS_Y * CLUSTERS_Z];
+        std::atomic<int> nextSlice;
+
+        // two texels per light: view position and radius, color
+        std::vector<glm::vec4> lightData;
+        // first index and count per froxel
+        std::vector<GLuint> rangeData;
+        std::vector<GLuint> indexData;
+
+        GLuint lightBuffer = 0;
+        GLuint lightTexture = 0;
+        GLsizeiptr lightCapacity = 0;
+        GLuint rangeBuffer = 0;
+        GLuint rangeTexture = 0;
+        GLsizeiptr rangeCapacity = 0;
+        GLuint indexBuffer = 0;
+        GLuint indexTexture = 0;
+        GLsizeiptr indexCapacity = 0;
+
+        // whether the froxel lists were binned from the lights uploaded last
+        bool listsCurrent = false;
+
+        // statistics of the last update
+        double binMilliseconds = 0.0;
+        unsigned int litClusters = 0;
+        unsigned int busiestCluster = 0;
+    };
+}
+
+#endif /* LightClusters_hpp */
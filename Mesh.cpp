@@ -1,4 +1,8 @@
 #include "Mesh.hpp"
+#include "GLStateCache.hpp"
+
+#include <algorithm>
+
 namespace gps {
 
 	/* Mesh Constructor */
@@ -8,65 +12,116 @@ namespace gps {
 		this->indices = indices;
 		this->textures = textures;
 
-		this->setupMesh();
+		this->diffuseLayer = 0;
+		this->specularLayer = 0;
+		for (size_t i = 0; i < textures.size(); i++) {
+
+			if (textures[i].type == "diffuseTexture")
+				this->diffuseLayer = textures[i].layer;
+			else if (textures[i].type == "specularTexture")
+				this->specularLayer = textures[i].layer;
+		}
+
+		this->geometry = -1;
+
+		this->boundsMin = vertices.empty() ? glm::vec3(0.0f) : vertices[0].Position;
+		this->boundsMax = this->boundsMin;
+		for (size_t i = 0; i < vertices.size(); i++) {
+
+			this->boundsMin = glm::min(this->boundsMin, vertices[i].Position);
+			this->boundsMax = glm::max(this->boundsMax, vertices[i].Position);
+		}
+
+		// tighter than half the box diagonal for most meshes
+		glm::vec3 sphereCenter = this->getSphereCenter();
+		this->sphereRadius = 0.0f;
+		for (size_t i = 0; i < vertices.size(); i++) {
+
+			this->sphereRadius = std::max(this->sphereRadius, glm::length(vertices[i].Position - sphereCenter));
+		}
 	}
 
-	Buffers Mesh::getBuffers() {
-	    return this->buffers;
+	const GeometryRange& Mesh::getGeometry() const {
+	    return GeometryPool::get<Vertex>().getRange(this->geometry);
 	}
 
-	/* Mesh drawing function - also applies associated textures */
-	void Mesh::Draw(gps::Shader shader)	{
+	GLint Mesh::getDiffuseLayer() const {
+	    return this->diffuseLayer;
+	}
 
-		shader.useShaderProgram();
+	GLint Mesh::getSpecularLayer() const {
+	    return this->specularLayer;
+	}
 
-		//set textures
-		for (GLuint i = 0; i < textures.size(); i++) {
+	void Mesh::setMaterialIndex(GLint index) {
+	    for (size_t i = 0; i < this->vertices.size(); i++)
+	        this->vertices[i].MaterialIndex = index;
+	}
 
-			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
-			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
-		}
+	glm::vec3 Mesh::getBoundsMin() const {
+	    return this->boundsMin;
+	}
+
+	glm::vec3 Mesh::getBoundsMax() const {
+	    return this->boundsMax;
+	}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
-		glBindVertexArray(0);
+	glm::vec3 Mesh::getSphereCenter() const {
+	    return (this->boundsMin + this->boundsMax) * 0.5f;
+	}
+
+	float Mesh::getSphereRadius() const {
+	    return this->sphereRadius;
+	}
 
-        for(GLuint i = 0; i < this->textures.size(); i++) {
+	/* Mesh drawing function - the vertices carry their material entry, the texture
+	   array and the material block are bound by Model3D::Draw */
+	void Mesh::Draw(gps::Shader& shader)	{
 
-            glActiveTexture(GL_TEXTURE0 + i);
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+		shader.useShaderProgram();
 
+		//left bound, the meshes of one pool buffer share the VAO
+		const GeometryRange& geometry = this->getGeometry();
+		GLStateCache::get().bindVertexArray(geometry.vertexArray);
+		glDrawElementsBaseVertex(GL_TRIANGLES, geometry.indexCount, GL_UNSIGNED_INT,
+			(GLvoid*)(geometry.firstIndex * sizeof(GLuint)), geometry.baseVertex);
     }
 
-	// Initializes all the buffer objects/arrays
+	/* Queues the mesh, sorted by the center of its bounds */
+	void Mesh::Submit(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shader,
+		const gps::RenderMaterial* material, GLint transform, const glm::mat4& model) {
+
+		gps::DrawPacket packet;
+		packet.shader = &shader;
+		packet.material = material;
+		// looked up every frame, unloading other meshes can move this one
+		const GeometryRange& geometry = this->getGeometry();
+		bool positionOnly = material != NULL && material->positionOnly;
+		packet.vertexArray = positionOnly ? geometry.positionVertexArray : geometry.vertexArray;
+		packet.mode = GL_TRIANGLES;
+		packet.count = geometry.indexCount;
+		packet.indexed = true;
+		packet.first = (GLint)geometry.firstIndex;
+		packet.baseVertex = positionOnly ? geometry.positionBaseVertex : geometry.baseVertex;
+		packet.transform = transform;
+
+		glm::vec3 center = glm::vec3(model * glm::vec4(this->getSphereCenter(), 1.0f));
+		queue.submit(pass, packet, center);
+	}
+
+	// Copies the vertices and indices into the shared pool of the Vertex format
 	void Mesh::setupMesh() {
 
-		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
-
-		glBindVertexArray(this->buffers.VAO);
-		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
-
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
-
-		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
-
-		glBindVertexArray(0);
+		if (this->vertices.empty() || this->indices.empty())
+			return;
+
+		this->geometry = GeometryPool::get<Vertex>().allocate(&this->vertices[0], (GLsizei)this->vertices.size(),
+			&this->indices[0], (GLsizei)this->indices.size());
+	}
+
+	void Mesh::releaseMesh() {
+
+		GeometryPool::get<Vertex>().release(this->geometry);
+		this->geometry = -1;
 	}
 }
@@ -12,6 +12,9 @@
 #include <glm/glm.hpp>
 
 #include "Shader.hpp"
+#include "Layouts.hpp"
+#include "RenderQueue.hpp"
+#include "GeometryPool.hpp"
 
 #include <string>
 #include <vector>
@@ -19,16 +22,20 @@
 
 namespace gps {
 
-    struct Vertex {
+#define GPS_MESH_VERTEX(ATTRIBUTE) \
+    ATTRIBUTE(glm::vec3, Position, vPosition) \
+    ATTRIBUTE(glm::vec3, Normal, vNormal) \
+    ATTRIBUTE(glm::vec2, TexCoords, vTexCoords) \
+    ATTRIBUTE(GLint, MaterialIndex, vMaterialIndex)
 
-        glm::vec3 Position;
-        glm::vec3 Normal;
-        glm::vec2 TexCoords;
-    };
+    // Vertex of every model mesh (shaders: #include <MeshVertex>)
+    GPS_DECLARE_VERTEX_FORMAT(Vertex, GPS_MESH_VERTEX)
 
     struct Texture {
 
-        GLuint id;
+        // number of the texture in its model, the layer it takes when one texture array holds
+        // them all (Model3D maps it to the layer of the mesh's array otherwise)
+        GLint layer;
         //ambientTexture, diffuseTexture, specularTexture
         std::string type;
         std::string path;
@@ -41,12 +48,6 @@ namespace gps {
         glm::vec3 specular;
     };
 
-    struct Buffers {
-        GLuint VAO;
-        GLuint VBO;
-        GLuint EBO;
-    };
-
     class Mesh {
 
     public:
@@ -56,16 +57,42 @@ namespace gps {
 
 	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
 
-	    Buffers getBuffers();
+	    // Current range of the mesh in the shared geometry pool, empty until setupMesh
+	    const GeometryRange& getGeometry() const;
 
-	    void Draw(gps::Shader shader);
+	    void Draw(gps::Shader& shader);
 
-    private:
-        /*  Render data  */
-        Buffers buffers;
+	    // Queues the draw of the mesh, material is NULL when the pass samples no textures
+	    void Submit(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shader,
+	        const gps::RenderMaterial* material, GLint transform, const glm::mat4& model);
 
-	    // Initializes all the buffer objects/arrays
+	    GLint getDiffuseLayer() const;
+	    GLint getSpecularLayer() const;
+	    // Entry of the model's MaterialBlock holding the layers of this mesh, stored in
+	    // every vertex so that meshes of one model can share a multi-draw
+	    void setMaterialIndex(GLint index);
+
+	    // Copies the vertices into the shared geometry pool, after setMaterialIndex
 	    void setupMesh();
+	    // Gives the range back to the pool, the copies of a mesh share it
+	    void releaseMesh();
+
+	    // Object space bounding box of the vertices
+	    glm::vec3 getBoundsMin() const;
+	    glm::vec3 getBoundsMax() const;
+	    // Object space bounding sphere, centered on the box
+	    glm::vec3 getSphereCenter() const;
+	    float getSphereRadius() const;
+
+    private:
+        /*  Render data  */
+        GeometryPool::Handle geometry;
+        // Texture array layers sampled by this mesh, 0 (empty layer) when missing
+        GLint diffuseLayer;
+        GLint specularLayer;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        float sphereRadius;
 
     };
 
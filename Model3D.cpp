@@ -1,23 +1,147 @@
 #include "Model3D.hpp"
 
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <memory>
+
 namespace gps {
 
+	// Bilinear resize of an RGBA image, used for textures whose size differs from the texture array
+	static std::vector<unsigned char> ResampleImage(const unsigned char* src, int srcWidth, int srcHeight, int width, int height) {
+
+		std::vector<unsigned char> dst((size_t)width * height * 4);
+
+		for (int y = 0; y < height; y++) {
+
+			float sy = ((y + 0.5f) * srcHeight) / height - 0.5f;
+			int y0 = sy < 0.0f ? 0 : (int)sy;
+			int y1 = y0 + 1 < srcHeight ? y0 + 1 : srcHeight - 1;
+			float fy = sy < 0.0f ? 0.0f : sy - y0;
+
+			for (int x = 0; x < width; x++) {
+
+				float sx = ((x + 0.5f) * srcWidth) / width - 0.5f;
+				int x0 = sx < 0.0f ? 0 : (int)sx;
+				int x1 = x0 + 1 < srcWidth ? x0 + 1 : srcWidth - 1;
+				float fx = sx < 0.0f ? 0.0f : sx - x0;
+
+				for (int c = 0; c < 4; c++) {
+
+					float top = src[(y0 * srcWidth + x0) * 4 + c] * (1.0f - fx) + src[(y0 * srcWidth + x1) * 4 + c] * fx;
+					float bottom = src[(y1 * srcWidth + x0) * 4 + c] * (1.0f - fx) + src[(y1 * srcWidth + x1) * 4 + c] * fx;
+					dst[((size_t)y * width + x) * 4 + c] = (unsigned char)(top * (1.0f - fy) + bottom * fy + 0.5f);
+				}
+			}
+		}
+
+		return dst;
+	}
+
 	void Model3D::LoadModel(std::string fileName) {
 
         std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
 		ReadOBJ(fileName, basePath);
+		BuildTextureArrays();
+		BuildMaterialBuffers();
+		UploadMeshes();
 	}
 
     void Model3D::LoadModel(std::string fileName, std::string basePath)	{
 
 		ReadOBJ(fileName, basePath);
+		BuildTextureArrays();
+		BuildMaterialBuffers();
+		UploadMeshes();
 	}
 
 	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram) {
+	void Model3D::Draw(gps::Shader& shaderProgram) {
+
+		shaderProgram.useShaderProgram();
+
+		for (int i = 0; i < meshes.size(); i++) {
+
+			if (i == 0 || meshArrays[i] != meshArrays[i - 1])
+				BindMaterial(shaderProgram, meshArrays[i]);
 
-		for (int i = 0; i < meshes.size(); i++)
 			meshes[i].Draw(shaderProgram);
+		}
+	}
+
+	// Queue each mesh from the model, they share one transform
+	void Model3D::Submit(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shaderProgram, const glm::mat4& model) {
+
+		GLint transform = queue.addTransform(model);
+		const gps::Frustum& frustum = queue.getFrustum(pass);
+
+		// spheres first, four at a time, then the tighter box for the survivors
+		float radiusScale = gps::maxScale(model);
+		cullSpheres.clear();
+		for (size_t i = 0; i < meshes.size(); i++)
+			cullSpheres.push(glm::vec3(model * glm::vec4(meshes[i].getSphereCenter(), 1.0f)), meshes[i].getSphereRadius() * radiusScale);
+
+		frustum.testSpheres(cullSpheres, cullVisible);
+
+		unsigned int culled = 0;
+		for (size_t i = 0; i < meshes.size(); i++) {
+
+			glm::vec3 boxMin, boxMax;
+			if (cullVisible[i])
+				gps::transformBox(model, meshes[i].getBoundsMin(), meshes[i].getBoundsMax(), boxMin, boxMax);
+
+			if (!cullVisible[i] || !frustum.testBox(boxMin, boxMax)) {
+
+				culled++;
+				continue;
+			}
+
+			meshes[i].Submit(queue, pass, shaderProgram, this->PassMaterial(queue, pass, i), transform, model);
+		}
+
+		queue.addCulled(pass, culled);
+	}
+
+	void Model3D::SubmitMesh(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shaderProgram,
+		size_t meshIndex, GLint transform, const glm::mat4& model) {
+
+		const gps::RenderMaterial* meshMaterial = this->PassMaterial(queue, pass, meshIndex);
+		meshes[meshIndex].Submit(queue, pass, shaderProgram, meshMaterial, transform, model);
+	}
+
+	// The material the pass imposes, else none for shadow passes and the one of the mesh's
+	// texture array for the rest
+	const gps::RenderMaterial* Model3D::PassMaterial(const gps::RenderQueue& queue, gps::RenderPass pass, size_t meshIndex) const {
+
+		if (queue.getPassMaterial(pass) != NULL)
+			return queue.getPassMaterial(pass);
+
+		return gps::isShadowPass(pass) ? NULL : &this->materials[meshArrays[meshIndex]];
+	}
+
+	size_t Model3D::GetMeshCount() const {
+
+		return meshes.size();
+	}
+
+	const gps::Mesh& Model3D::GetMesh(size_t meshIndex) const {
+
+		return meshes[meshIndex];
+	}
+
+	void Model3D::BindMaterial(gps::Shader& shaderProgram, int array) {
+
+		// one texture binding for all the meshes of an array, they only select their layers
+		if (array < (int)textureArrays.size()) {
+
+			GLStateCache::get().bindTexture(0, GL_TEXTURE_2D_ARRAY, textureArrays[array]);
+			shaderProgram.set<gps::UniformId::materialTextures>(0);
+		}
+
+		if (materialBuffers[array] != 0) {
+
+			glBindBufferBase(GL_UNIFORM_BUFFER, MATERIAL_BLOCK_BINDING, materialBuffers[array]);
+		}
 	}
 
 	// Does the parsing of the .obj file and fills in the data structure
@@ -158,12 +282,16 @@ namespace gps {
 				if (loadedTextures[i].path == path)	{
 
 					//already loaded texture
-					return loadedTextures[i];
+					gps::Texture loadedTexture = loadedTextures[i];
+					loadedTexture.type = std::string(type);
+					return loadedTexture;
 				}
 			}
 
+			// the arrays are only made by BuildTextureArrays, once every texture is known
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			// layer 0 is kept empty for meshes missing a texture type
+			currentTexture.layer = (GLint)loadedTextures.size() + 1;
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
 
@@ -172,8 +300,245 @@ namespace gps {
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	// Packs the associated textures into the layers of the texture arrays
+	void Model3D::BuildTextureArrays() {
+
+		meshArrays.assign(meshes.size(), 0);
+		arrayLayers.assign(1, std::vector<GLint>(loadedTextures.size() + 1, 0));
+
+		if (loadedTextures.empty()) {
+
+			return;
+		}
+
+		GLint maxLayers = 0;
+		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+		// the model texture held by each layer of each array, layer 0 is kept empty for
+		// meshes missing a texture type
+		std::vector<std::vector<GLint>> arrayTextures;
+
+		if ((GLint)loadedTextures.size() + 1 <= maxLayers) {
+
+			arrayTextures.push_back(std::vector<GLint>(1, 0));
+			for (size_t i = 0; i < loadedTextures.size(); i++)
+				arrayTextures[0].push_back((GLint)i + 1);
+		}
+		else {
+
+			// each mesh goes to the first array already holding its diffuse and specular textures,
+			// else to the one that needs the fewest new layers for them; a texture used from two
+			// arrays takes a layer in both
+			fprintf(
+				stderr, "WARNING: %d textures and the empty layer exceed the texture array limit of %d layers, splitting them\n",
+				(int)loadedTextures.size(), maxLayers
+			);
+
+			for (size_t i = 0; i < meshes.size(); i++) {
+
+				GLint needed[2] = { meshes[i].getDiffuseLayer(), meshes[i].getSpecularLayer() };
+				if (needed[1] == needed[0])
+					needed[1] = 0;
+
+				int chosen = -1;
+				int chosenMissing = 0;
+
+				for (size_t array = 0; array < arrayTextures.size() && (chosen < 0 || chosenMissing > 0); array++) {
+
+					int missing = 0;
+					for (int k = 0; k < 2; k++) {
+
+						if (needed[k] != 0 && std::find(arrayTextures[array].begin(), arrayTextures[array].end(), needed[k]) == arrayTextures[array].end())
+							missing++;
+					}
+
+					if ((GLint)arrayTextures[array].size() + missing <= maxLayers && (chosen < 0 || missing < chosenMissing)) {
+
+						chosen = (int)array;
+						chosenMissing = missing;
+					}
+				}
+
+				if (chosen < 0) {
+
+					arrayTextures.push_back(std::vector<GLint>(1, 0));
+					chosen = (int)arrayTextures.size() - 1;
+				}
+
+				std::vector<GLint>& textures = arrayTextures[chosen];
+				for (int k = 0; k < 2; k++) {
+
+					if (needed[k] != 0 && std::find(textures.begin(), textures.end(), needed[k]) == textures.end())
+						textures.push_back(needed[k]);
+				}
+
+				meshArrays[i] = chosen;
+			}
+		}
+
+		arrayLayers.assign(arrayTextures.size(), std::vector<GLint>(loadedTextures.size() + 1, 0));
+		GLsizei totalLayers = 0;
+
+		for (size_t array = 0; array < arrayTextures.size(); array++) {
+
+			for (size_t layer = 1; layer < arrayTextures[array].size(); layer++)
+				arrayLayers[array][arrayTextures[array][layer]] = (GLint)layer;
+
+			totalLayers += (GLsizei)arrayTextures[array].size();
+		}
+
+		// only the image headers are read here, decoding happens on the upload workers
+		std::vector<int> widths(loadedTextures.size(), 0);
+		std::vector<int> heights(loadedTextures.size(), 0);
+		std::map<std::pair<int, int>, int> sizeCount;
+
+		for (size_t i = 0; i < loadedTextures.size(); i++) {
+
+			int n;
+			if (stbi_info(loadedTextures[i].path.c_str(), &widths[i], &heights[i], &n)) {
+
+				sizeCount[std::make_pair(widths[i], heights[i])]++;
+			}
+		}
+
+		// the most common size becomes the layer size, the other textures are resampled to it
+		int width = 1;
+		int height = 1;
+		int bestCount = 0;
+
+		for (std::map<std::pair<int, int>, int>::iterator it = sizeCount.begin(); it != sizeCount.end(); it++) {
+
+			if (it->second > bestCount) {
+
+				bestCount = it->second;
+				width = it->first.first;
+				height = it->first.second;
+			}
+		}
+
+		// drop top mips when the arrays would not fit the GPU memory budget
+		const QualitySettings& quality = GpuMemory::get().fit(GPU_MEMORY_TEXTURE, [&](const QualitySettings& settings) {
+			return GpuMemory::imageBytes(std::max(width >> settings.textureMipDrop, 1), std::max(height >> settings.textureMipDrop, 1), totalLayers, 4, true);
+		});
+		width = std::max(width >> quality.textureMipDrop, 1);
+		height = std::max(height >> quality.textureMipDrop, 1);
+
+		textureArrays.assign(arrayTextures.size(), 0);
+		glGenTextures((GLsizei)textureArrays.size(), textureArrays.data());
+
+		for (size_t array = 0; array < arrayTextures.size(); array++) {
+
+			UploadTextureArray(textureArrays[array], arrayTextures[array], width, height);
+		}
+
+		std::cout << "# of layers    : " << totalLayers << " (" << width << "x" << height << ")";
+		if (textureArrays.size() > 1)
+			std::cout << " in " << textureArrays.size() << " texture arrays";
+		std::cout << std::endl;
+	}
+
+	void Model3D::UploadTextureArray(GLuint array, const std::vector<GLint>& textures, int width, int height) {
+
+		GLsizei layers = (GLsizei)textures.size();
+
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D_ARRAY, array);
+		glTexImage3D(
+			GL_TEXTURE_2D_ARRAY,
+			0,
+			GL_SRGB8_ALPHA8,
+			width,
+			height,
+			layers,
+			0,
+			GL_RGBA,
+			GL_UNSIGNED_BYTE,
+			NULL
+		);
+
+		// until the mipmaps are built only level 0 is sampled, the layers already there show
+		// and the missing ones read black instead of the whole array being incomplete
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+		GLStateCache::get().bindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+		// every layer is streamed through the texture uploader, the last one builds the mipmaps
+		size_t layerBytes = (size_t)width * height * 4;
+		std::shared_ptr<int> remainingLayers = std::make_shared<int>(layers);
+
+		for (GLint layer = 0; layer < layers; layer++) {
+
+			std::string path = textures[layer] > 0 ? loadedTextures[textures[layer] - 1].path : std::string();
+
+			TextureUploader::FillFunction fill = [this, path, width, height, layerBytes](unsigned char* staging) {
+
+				int x = 0, y = 0;
+				unsigned char* image = path.empty() ? NULL : ReadTextureFromFile(path.c_str(), x, y);
+
+				if (!image) {
+
+					memset(staging, 0, layerBytes);
+				}
+				else if (x != width || y != height) {
+
+					fprintf(
+						stderr, "WARNING: texture %s resampled from %dx%d to %dx%d\n",
+						path.c_str(), x, y, width, height
+					);
+					std::vector<unsigned char> resampled = ResampleImage(image, x, y, width, height);
+					memcpy(staging, resampled.data(), layerBytes);
+				}
+				else {
+
+					memcpy(staging, image, layerBytes);
+				}
+
+				if (image) {
+
+					stbi_image_free(image);
+				}
+
+				return true;
+			};
+
+			TextureUploader::SubmitFunction submit = [array, layer, width, height, remainingLayers](const void* pixels, bool filled) {
+
+				GLStateCache::get().bindTexture(GL_TEXTURE_2D_ARRAY, array);
+
+				if (filled) {
+
+					glTexSubImage3D(
+						GL_TEXTURE_2D_ARRAY,
+						0,
+						0, 0, layer,
+						width, height, 1,
+						GL_RGBA,
+						GL_UNSIGNED_BYTE,
+						pixels
+					);
+				}
+
+				if (--*remainingLayers == 0) {
+
+					// back to the GL default, so every level built here is sampled
+					glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 1000);
+					glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+				}
+
+				GLStateCache::get().bindTexture(GL_TEXTURE_2D_ARRAY, 0);
+			};
+
+			TextureUploader::get().enqueue(layerBytes, fill, submit);
+		}
+
+
+		GpuMemory::get().track(GPU_MEMORY_TEXTURE, array, GpuMemory::imageBytes(width, height, layers, 4, true));
+	}
+
+	// Reads the pixel data from an image file, bottom row first
+	unsigned char* Model3D::ReadTextureFromFile(const char* file_name, int& width, int& height) {
 
 		int x, y, n;
 		int force_channels = 4;
@@ -181,7 +546,7 @@ namespace gps {
 
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+			return NULL;
 		}
 		// NPOT check
 		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
@@ -211,46 +576,101 @@ namespace gps {
 			}
 		}
 
-		GLuint textureID;
-		glGenTextures(1, &textureID);
-		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		width = x;
+		height = y;
+
+		return image_data;
+	}
+
+	void Model3D::BuildMaterialBuffers() {
+
+		size_t arrayCount = arrayLayers.size();
+		materialBuffers.assign(arrayCount, 0);
+		materials.assign(arrayCount, gps::RenderMaterial());
+
+		for (size_t array = 0; array < arrayCount; array++) {
+
+			// models are never copied, the materials can keep pointing at this one
+			int arrayIndex = (int)array;
+			materials[array].bind = [this, arrayIndex](gps::Shader& shaderProgram) { BindMaterial(shaderProgram, arrayIndex); };
+
+			// entries of MaterialUniforms::materialLayers, only the used ones are uploaded
+			std::vector<glm::ivec4> entries;
+			std::map<std::pair<GLint, GLint>, GLint> materialIndices;
+
+			for (size_t i = 0; i < meshes.size(); i++) {
+
+				if (meshArrays[i] != arrayIndex)
+					continue;
 
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glBindTexture(GL_TEXTURE_2D, 0);
+				std::pair<GLint, GLint> layers(arrayLayers[array][meshes[i].getDiffuseLayer()], arrayLayers[array][meshes[i].getSpecularLayer()]);
+				std::map<std::pair<GLint, GLint>, GLint>::iterator found = materialIndices.find(layers);
 
-		return textureID;
+				if (found == materialIndices.end()) {
+
+					if ((int)entries.size() == MAX_MATERIALS) {
+
+						fprintf(stderr, "ERROR: more than %d materials, reusing the last one\n", MAX_MATERIALS);
+						meshes[i].setMaterialIndex(MAX_MATERIALS - 1);
+						continue;
+					}
+
+					found = materialIndices.insert(std::make_pair(layers, (GLint)entries.size())).first;
+					entries.push_back(glm::ivec4(layers.first, layers.second, 0, 0));
+				}
+
+				meshes[i].setMaterialIndex(found->second);
+			}
+
+			if (entries.empty()) {
+				continue;
+			}
+
+			// the block is declared with MAX_MATERIALS entries, the bound range has to cover all of them
+			GLsizeiptr bufferSize = sizeof(MaterialUniforms);
+
+			glGenBuffers(1, &materialBuffers[array]);
+			glBindBuffer(GL_UNIFORM_BUFFER, materialBuffers[array]);
+			glBufferData(GL_UNIFORM_BUFFER, bufferSize, NULL, GL_STATIC_DRAW);
+			glBufferSubData(GL_UNIFORM_BUFFER, 0, entries.size() * sizeof(glm::ivec4), entries.data());
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			GpuMemory::get().track(GPU_MEMORY_BUFFER, materialBuffers[array], bufferSize);
+
+			std::cout << "# of materials : " << entries.size() << std::endl;
+		}
+	}
+
+	// The material indices are part of the vertices, so the meshes go to the pool last
+	void Model3D::UploadMeshes() {
+
+		for (size_t i = 0; i < meshes.size(); i++)
+			meshes[i].setupMesh();
 	}
 
-	Model3D::~Model3D() {
+	void Model3D::Destroy() {
 
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
+        for (size_t i = 0; i < textureArrays.size(); i++) {
 
-            glDeleteTextures(1, &loadedTextures.at(i).id);
+            GpuMemory::get().release(GPU_MEMORY_TEXTURE, textureArrays[i]);
         }
+        if (!textureArrays.empty()) {
 
-        for (size_t i = 0; i < meshes.size(); i++) {
+            GLStateCache::get().deleteTextures((GLsizei)textureArrays.size(), textureArrays.data());
+            textureArrays.clear();
+        }
 
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
+        for (size_t i = 0; i < materialBuffers.size(); i++) {
+
+            if (materialBuffers[i] != 0) {
+
+                GpuMemory::get().release(GPU_MEMORY_BUFFER, materialBuffers[i]);
+                glDeleteBuffers(1, &materialBuffers[i]);
+                materialBuffers[i] = 0;
+            }
+        }
+
+        for (size_t i = 0; i < meshes.size(); i++) {
+            meshes[i].releaseMesh();
         }
 	}
 }
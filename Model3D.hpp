@@ -2,6 +2,11 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "GpuMemory.hpp"
+#include "TextureUploader.hpp"
+#include "UniformBuffers.hpp"
+#include "GLStateCache.hpp"
+#include "RenderQueue.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
@@ -15,19 +20,46 @@ namespace gps {
     class Model3D {
 
     public:
-        ~Model3D();
-
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
-		void Draw(gps::Shader shaderProgram);
+		void Draw(gps::Shader& shaderProgram);
+
+		// Queues every mesh inside the pass frustum with the given model matrix, the shadow
+		// pass skips the material
+		void Submit(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shaderProgram, const glm::mat4& model);
+
+		// Queues one mesh without culling it, for callers that already did (SceneHierarchy)
+		void SubmitMesh(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shaderProgram,
+			size_t meshIndex, GLint transform, const glm::mat4& model);
+
+		size_t GetMeshCount() const;
+		const gps::Mesh& GetMesh(size_t meshIndex) const;
+
+		// Releases the texture arrays, the material blocks and the meshes' geometry, while the
+		// GL context is still current; the destructor only frees what lives on the CPU
+		void Destroy();
 
     private:
 		// Component meshes - group of objects
         std::vector<gps::Mesh> meshes;
 		// Associated textures
         std::vector<gps::Texture> loadedTextures;
+		// Texture arrays packing the associated textures, one layer per texture; a single one
+		// unless the textures exceed GL_MAX_ARRAY_TEXTURE_LAYERS
+		std::vector<GLuint> textureArrays;
+		// Layer of every model texture (Mesh layer numbering) in each array, 0 when not in it
+		std::vector<std::vector<GLint>> arrayLayers;
+		// Texture array of each mesh
+		std::vector<int> meshArrays;
+		// MaterialBlock of each texture array, one entry per distinct pair of layers
+		std::vector<GLuint> materialBuffers;
+		// texture array and material block, bound once per run of meshes sharing them
+		std::vector<gps::RenderMaterial> materials;
+		// world space bounds of the meshes, reused by every Submit
+		gps::BoundingSpheres cullSpheres;
+		std::vector<unsigned char> cullVisible;
 
 		// Does the parsing of the .obj file and fills in the data structure
 		void ReadOBJ(std::string fileName, std::string basePath);
@@ -35,8 +67,26 @@ namespace gps {
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Packs the associated textures into the layers of the texture arrays
+		void BuildTextureArrays();
+
+		// Streams the given model textures into the layers of an array, layer 0 left empty
+		void UploadTextureArray(GLuint array, const std::vector<GLint>& textures, int width, int height);
+
+		// Fills the material blocks and points every mesh at its entry
+		void BuildMaterialBuffers();
+
+		// Copies every mesh into the shared geometry pool
+		void UploadMeshes();
+
+		// Binds a texture array and its material block for the program
+		void BindMaterial(gps::Shader& shaderProgram, int array);
+
+		// Material of a mesh in the given pass
+		const gps::RenderMaterial* PassMaterial(const gps::RenderQueue& queue, gps::RenderPass pass, size_t meshIndex) const;
+
+		// Reads the pixel data from an image file, bottom row first
+		unsigned char* ReadTextureFromFile(const char* file_name, int& width, int& height);
     };
 }
 
@@ -0,0 +1,406 @@
+#include "OcclusionCuller.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+    #define GPS_OCCLUSION_SSE
+    #include <xmmintrin.h>
+#endif
+
+namespace gps {
+
+    // clip space w below this is never divided by, even for matrices without a near plane
+    static const float NEAR_W = 1e-4f;
+
+    static unsigned int workerCount() {
+
+        unsigned int threads = std::thread::hardware_concurrency();
+        return std::max(1u, std::min(threads, 8u));
+    }
+
+    void OcclusionCuller::addOccluders(const gps::Model3D& model, const glm::mat4& transform, size_t triangleBudget) {
+
+        // the biggest meshes hide the most, by the surface of their world space bounds
+        std::vector<std::pair<float, size_t>> candidates;
+        for (size_t i = 0; i < model.GetMeshCount(); i++) {
+
+            glm::vec3 boxMin, boxMax;
+            gps::transformBox(transform, model.GetMesh(i).getBoundsMin(), model.GetMesh(i).getBoundsMax(), boxMin, boxMax);
+            glm::vec3 extent = boxMax - boxMin;
+            candidates.push_back(std::make_pair(extent.x * extent.y + extent.y * extent.z + extent.z * extent.x, i));
+        }
+        std::sort(candidates.begin(), candidates.end(), std::greater<std::pair<float, size_t>>());
+
+        size_t added = 0;
+        for (size_t c = 0; c < candidates.size(); c++) {
+
+            const gps::Mesh& mesh = model.GetMesh(candidates[c].second);
+            size_t triangles = mesh.indices.size() / 3;
+            if (triangles > triangleBudget) {
+                continue;
+            }
+            triangleBudget -= triangles;
+
+            uint32_t base = (uint32_t)positions.size();
+            for (size_t v = 0; v < mesh.vertices.size(); v++) {
+                positions.push_back(glm::vec3(transform * glm::vec4(mesh.vertices[v].Position, 1.0f)));
+            }
+            for (size_t i = 0; i < triangles * 3; i++) {
+                indices.push_back(base + mesh.indices[i]);
+            }
+            added++;
+        }
+
+        std::cout << "[INFO] Occlusion culling: " << added << " occluder meshes, "
+            << indices.size() / 3 << " triangles" << std::endl;
+    }
+
+    void OcclusionCuller::begin(const glm::mat4& viewProjection) {
+
+        finish();
+
+        this->viewProjection = viewProjection;
+        ready = false;
+        testedBoxes = 0;
+        occludedBoxes = 0;
+
+        job = std::async(std::launch::async, [this]() { rasterize(); });
+    }
+
+    void OcclusionCuller::finish() {
+
+        if (job.valid()) {
+
+            job.get();
+            buildHierarchicalZ();
+            ready = true;
+        }
+    }
+
+    void OcclusionCuller::rasterize() {
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        depthLevels.resize(1);
+        depthLevels[0].assign(WIDTH * HEIGHT, 1.0f);
+        screenPositions.resize(positions.size());
+
+        unsigned int workers = workerCount();
+
+        // 1) vertices to pixels, in slices
+        std::vector<std::future<void>> jobs;
+        size_t slice = (positions.size() + workers - 1) / workers;
+        for (size_t first = 0; first < positions.size(); first += slice) {
+
+            size_t end = std::min(first + slice, positions.size());
+            jobs.push_back(std::async(std::launch::async, [this, first, end]() { transformVertices(first, end); }));
+        }
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].get();
+        }
+        jobs.clear();
+
+        // 2) triangles to the tiles their bounds touch
+        binTriangles();
+
+        // 3) tiles are independent, workers take them in turn
+        nextTile = 0;
+        for (unsigned int i = 0; i < workers; i++) {
+            jobs.push_back(std::async(std::launch::async, [this]() { rasterizeTiles(); }));
+        }
+        for (size_t i = 0; i < jobs.size(); i++) {
+            jobs[i].get();
+        }
+
+        rasterMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void OcclusionCuller::transformVertices(size_t first, size_t end) {
+
+        for (size_t i = first; i < end; i++) {
+
+            // closer than the near plane (clip.z < -clip.w) would project to a depth below 0
+            // and hide everything behind it, such vertices take their triangles out
+            glm::vec4 clip = viewProjection * glm::vec4(positions[i], 1.0f);
+            if (clip.w < NEAR_W || clip.z < -clip.w) {
+
+                screenPositions[i] = glm::vec4(0.0f, 0.0f, 0.0f, -1.0f);
+                continue;
+            }
+
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            screenPositions[i] = glm::vec4(
+                (ndc.x * 0.5f + 0.5f) * WIDTH,
+                (ndc.y * 0.5f + 0.5f) * HEIGHT,
+                ndc.z * 0.5f + 0.5f,
+                1.0f);
+        }
+    }
+
+    void OcclusionCuller::binTriangles() {
+
+        for (int tile = 0; tile < TILES_X * TILES_Y; tile++) {
+            tileBins[tile].clear();
+        }
+        rasterizedTriangles = 0;
+
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+
+            const glm::vec4& a = screenPositions[indices[t]];
+            const glm::vec4& b = screenPositions[indices[t + 1]];
+            const glm::vec4& c = screenPositions[indices[t + 2]];
+
+            // a vertex is closer than the near plane: clipping would only add occlusion,
+            // dropping the triangle stays conservative
+            if (a.w < 0.0f || b.w < 0.0f || c.w < 0.0f) {
+                continue;
+            }
+            if (std::min(a.z, std::min(b.z, c.z)) > 1.0f) {
+                continue;
+            }
+
+            float minX = std::min(a.x, std::min(b.x, c.x));
+            float maxX = std::max(a.x, std::max(b.x, c.x));
+            float minY = std::min(a.y, std::min(b.y, c.y));
+            float maxY = std::max(a.y, std::max(b.y, c.y));
+            if (maxX < 0.0f || maxY < 0.0f || minX >= WIDTH || minY >= HEIGHT) {
+                continue;
+            }
+
+            int tileMinX = std::max(0, (int)minX / TILE_WIDTH);
+            int tileMaxX = std::min(TILES_X - 1, (int)maxX / TILE_WIDTH);
+            int tileMinY = std::max(0, (int)minY / TILE_HEIGHT);
+            int tileMaxY = std::min(TILES_Y - 1, (int)maxY / TILE_HEIGHT);
+
+            for (int y = tileMinY; y <= tileMaxY; y++) {
+                for (int x = tileMinX; x <= tileMaxX; x++) {
+                    tileBins[y * TILES_X + x].push_back((uint32_t)t);
+                }
+            }
+            rasterizedTriangles++;
+        }
+    }
+
+    void OcclusionCuller::rasterizeTiles() {
+
+        for (int tile = nextTile++; tile < TILES_X * TILES_Y; tile = nextTile++) {
+
+            int tileMinX = (tile % TILES_X) * TILE_WIDTH;
+            int tileMinY = (tile / TILES_X) * TILE_HEIGHT;
+
+            const std::vector<uint32_t>& bin = tileBins[tile];
+            for (size_t i = 0; i < bin.size(); i++) {
+                rasterizeTriangle(bin[i], tileMinX, tileMinY, tileMinX + TILE_WIDTH, tileMinY + TILE_HEIGHT);
+            }
+        }
+    }
+
+    void OcclusionCuller::rasterizeTriangle(uint32_t triangle, int tileMinX, int tileMinY, int tileMaxX, int tileMaxY) {
+
+        glm::vec4 v0 = screenPositions[indices[triangle]];
+        glm::vec4 v1 = screenPositions[indices[triangle + 1]];
+        glm::vec4 v2 = screenPositions[indices[triangle + 2]];
+
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (std::fabs(area) < 1e-6f) {
+            return;
+        }
+        // both windings are occluders, make every edge function positive inside
+        if (area < 0.0f) {
+
+            std::swap(v1, v2);
+            area = -area;
+        }
+
+        // edge i is opposite vertex i: e(x, y) = a * x + b * y + c
+        const glm::vec4* from[3] = { &v1, &v2, &v0 };
+        const glm::vec4* to[3] = { &v2, &v0, &v1 };
+        float edgeA[3], edgeB[3], edgeC[3];
+        for (int e = 0; e < 3; e++) {
+
+            edgeA[e] = -(to[e]->y - from[e]->y);
+            edgeB[e] = to[e]->x - from[e]->x;
+            edgeC[e] = -edgeA[e] * from[e]->x - edgeB[e] * from[e]->y;
+        }
+
+        // depth is linear in screen space: the edge functions are its barycentric weights
+        float depthA = (edgeA[0] * v0.z + edgeA[1] * v1.z + edgeA[2] * v2.z) / area;
+        float depthB = (edgeB[0] * v0.z + edgeB[1] * v1.z + edgeB[2] * v2.z) / area;
+        float depthC = (edgeC[0] * v0.z + edgeC[1] * v1.z + edgeC[2] * v2.z) / area;
+
+        // pixels whose centers can be covered, x aligned to the 4-pixel groups
+        int minX = std::max(tileMinX, (int)std::floor(std::min(v0.x, std::min(v1.x, v2.x))));
+        int maxX = std::min(tileMaxX, (int)std::ceil(std::max(v0.x, std::max(v1.x, v2.x))));
+        int minY = std::max(tileMinY, (int)std::floor(std::min(v0.y, std::min(v1.y, v2.y))));
+        int maxY = std::min(tileMaxY, (int)std::ceil(std::max(v0.y, std::max(v1.y, v2.y))));
+        minX &= ~3;
+
+        std::vector<float>& depth = depthLevels[0];
+
+#ifdef GPS_OCCLUSION_SSE
+        __m128 pixelOffsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+        __m128 zero = _mm_setzero_ps();
+        __m128 a0 = _mm_set1_ps(edgeA[0]), a1 = _mm_set1_ps(edgeA[1]), a2 = _mm_set1_ps(edgeA[2]);
+        __m128 za = _mm_set1_ps(depthA);
+
+        for (int y = minY; y < maxY; y++) {
+
+            float centerY = y + 0.5f;
+            __m128 row0 = _mm_set1_ps(edgeB[0] * centerY + edgeC[0]);
+            __m128 row1 = _mm_set1_ps(edgeB[1] * centerY + edgeC[1]);
+            __m128 row2 = _mm_set1_ps(edgeB[2] * centerY + edgeC[2]);
+            __m128 rowDepth = _mm_set1_ps(depthB * centerY + depthC);
+
+            for (int x = minX; x < maxX; x += 4) {
+
+                __m128 centerX = _mm_add_ps(_mm_set1_ps((float)x), pixelOffsets);
+
+                __m128 inside = _mm_and_ps(
+                    _mm_and_ps(
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a0, centerX), row0), zero),
+                        _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a1, centerX), row1), zero)),
+                    _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a2, centerX), row2), zero));
+
+                if (_mm_movemask_ps(inside) == 0) {
+                    continue;
+                }
+
+                float* target = &depth[y * WIDTH + x];
+                __m128 current = _mm_loadu_ps(target);
+                __m128 nearest = _mm_min_ps(current, _mm_add_ps(_mm_mul_ps(za, centerX), rowDepth));
+                _mm_storeu_ps(target, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+            }
+        }
+#else
+        for (int y = minY; y < maxY; y++) {
+
+            float centerY = y + 0.5f;
+            for (int x = minX; x < maxX; x++) {
+
+                float centerX = x + 0.5f;
+                if (edgeA[0] * centerX + edgeB[0] * centerY + edgeC[0] < 0.0f ||
+                    edgeA[1] * centerX + edgeB[1] * centerY + edgeC[1] < 0.0f ||
+                    edgeA[2] * centerX + edgeB[2] * centerY + edgeC[2] < 0.0f) {
+                    continue;
+                }
+
+                float& target = depth[y * WIDTH + x];
+                target = std::min(target, depthA * centerX + depthB * centerY + depthC);
+            }
+        }
+#endif
+    }
+
+    void OcclusionCuller::buildHierarchicalZ() {
+
+        int width = WIDTH;
+        int height = HEIGHT;
+        size_t level = 0;
+
+        while (width > 1 && height > 1) {
+
+            int levelWidth = width / 2;
+            int levelHeight = height / 2;
+            if (depthLevels.size() <= level + 1) {
+                depthLevels.push_back(std::vector<float>());
+            }
+            depthLevels[level + 1].resize(levelWidth * levelHeight);
+
+            const std::vector<float>& below = depthLevels[level];
+            std::vector<float>& above = depthLevels[level + 1];
+            for (int y = 0; y < levelHeight; y++) {
+                for (int x = 0; x < levelWidth; x++) {
+
+                    const float* texels = &below[(2 * y) * width + 2 * x];
+                    above[y * levelWidth + x] = std::max(std::max(texels[0], texels[1]),
+                        std::max(texels[width], texels[width + 1]));
+                }
+            }
+
+            width = levelWidth;
+            height = levelHeight;
+            level++;
+        }
+        depthLevels.resize(level + 1);
+    }
+
+    bool OcclusionCuller::isVisible(const glm::vec3& boxMin, const glm::vec3& boxMax) {
+
+        if (!ready || indices.empty()) {
+            return true;
+        }
+        testedBoxes++;
+
+        float minX = (float)WIDTH, maxX = 0.0f, minY = (float)HEIGHT, maxY = 0.0f;
+        float nearestDepth = 1.0f;
+
+        for (int corner = 0; corner < 8; corner++) {
+
+            glm::vec3 point(
+                corner & 1 ? boxMax.x : boxMin.x,
+                corner & 2 ? boxMax.y : boxMin.y,
+                corner & 4 ? boxMax.z : boxMin.z);
+            glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+
+            // the box reaches the camera, nothing can be in front of all of it
+            if (clip.w < NEAR_W) {
+                return true;
+            }
+
+            glm::vec3 ndc = glm::vec3(clip) / clip.w;
+            float x = (ndc.x * 0.5f + 0.5f) * WIDTH;
+            float y = (ndc.y * 0.5f + 0.5f) * HEIGHT;
+            minX = std::min(minX, x);
+            maxX = std::max(maxX, x);
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+            nearestDepth = std::min(nearestDepth, ndc.z * 0.5f + 0.5f);
+        }
+
+        int pixelMinX = std::max(0, (int)std::floor(minX));
+        int pixelMaxX = std::min(WIDTH - 1, (int)std::floor(maxX));
+        int pixelMinY = std::max(0, (int)std::floor(minY));
+        int pixelMaxY = std::min(HEIGHT - 1, (int)std::floor(maxY));
+        if (pixelMinX > pixelMaxX || pixelMinY > pixelMaxY) {
+            return true;
+        }
+
+        // the level where the box covers at most 2x2 texels, 3x3 when it straddles them
+        int size = std::max(pixelMaxX - pixelMinX, pixelMaxY - pixelMinY) + 1;
+        size_t level = 0;
+        while ((size >> level) > 2 && level + 1 < depthLevels.size()) {
+            level++;
+        }
+
+        int levelWidth = WIDTH >> level;
+        const std::vector<float>& depth = depthLevels[level];
+        for (int y = pixelMinY >> level; y <= (pixelMaxY >> level); y++) {
+            for (int x = pixelMinX >> level; x <= (pixelMaxX >> level); x++) {
+
+                if (nearestDepth <= depth[y * levelWidth + x]) {
+                    return true;
+                }
+            }
+        }
+
+        occludedBoxes++;
+        return false;
+    }
+
+    size_t OcclusionCuller::getOccluderTriangleCount() const {
+
+        return indices.size() / 3;
+    }
+
+    void OcclusionCuller::report() const {
+
+        std::cout << "[INFO] Occlusion culling last frame: " << rasterizedTriangles << " occluder triangles in "
+            << rasterMilliseconds << " ms, " << occludedBoxes << " of " << testedBoxes << " boxes occluded" << std::endl;
+    }
+}
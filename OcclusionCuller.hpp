@@ -0,0 +1,77 @@
+#ifndef OcclusionCuller_hpp
+#define OcclusionCuller_hpp
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <vector>
+
+namespace gps {
+
+    // Software occlusion culling: a few large occluder meshes are rasterized depth-only
+    // into a small CPU buffer on worker threads, tile by tile. A hierarchical-Z pyramid of
+    // that buffer then rejects boxes that lie entirely behind the occluders.
+    class OcclusionCuller {
+
+    public:
+        static const int WIDTH = 256;
+        static const int HEIGHT = 128;
+        static const int TILE_WIDTH = 32;
+        static const int TILE_HEIGHT = 16;
+
+        // Takes the largest meshes of the model, by bounds, until triangleBudget is used up.
+        // Occluders are static, the transform is applied once here.
+        void addOccluders(const gps::Model3D& model, const glm::mat4& transform, size_t triangleBudget);
+
+        // Starts rasterizing the occluders as seen through viewProjection, returns at once
+        void begin(const glm::mat4& viewProjection);
+        // Waits for the rasterization and builds the hierarchical-Z, needed before isVisible
+        void finish();
+
+        // false only when the world space box is certainly hidden by the occluders
+        bool isVisible(const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+        size_t getOccluderTriangleCount() const;
+        void report() const;
+
+    private:
+        static const int TILES_X = WIDTH / TILE_WIDTH;
+        static const int TILES_Y = HEIGHT / TILE_HEIGHT;
+
+        void rasterize();
+        void transformVertices(size_t first, size_t end);
+        void binTriangles();
+        void rasterizeTiles();
+        void rasterizeTriangle(uint32_t triangle, int tileMinX, int tileMinY, int tileMaxX, int tileMaxY);
+        void buildHierarchicalZ();
+
+        // world space occluder triangles
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t> indices;
+
+        // pixel x, y, depth in [0, 1], w < 0 when closer than the near plane
+        std::vector<glm::vec4> screenPositions;
+        std::vector<uint32_t> tileBins[TILES_X * TILES_Y];
+        std::atomic<int> nextTile;
+
+        // level 0 holds the nearest occluder depth per pixel, every further level the
+        // farthest depth of the 2x2 texels below it
+        std::vector<std::vector<float>> depthLevels;
+
+        glm::mat4 viewProjection;
+        std::future<void> job;
+        bool ready = false;
+
+        // statistics of the last frame
+        double rasterMilliseconds = 0.0;
+        unsigned int rasterizedTriangles = 0;
+        unsigned int testedBoxes = 0;
+        unsigned int occludedBoxes = 0;
+    };
+}
+
+#endif /* OcclusionCuller_hpp */
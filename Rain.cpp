@@ -4,15 +4,30 @@
 #include <glm/gtc/type_ptr.hpp>
 #include <vector>
 #include "Shader.hpp"
+#include "GLStateCache.hpp"
+
+// middle of the volume randomSpawnAbove and update keep the drops in
+static const glm::vec3 rainVolumeCenter(200.0f, -90.0f, 250.0f);
 
 RainSystem::RainSystem(int maxDropsCount, gps::Shader rainShader)
     : maxDrops(maxDropsCount), rainShader(rainShader), isInitialized(false)
 {
     drops.resize(maxDrops);
+
+    material.bind = [](gps::Shader& shader) {
+        shader.set<gps::UniformId::rainColor>(glm::vec3(0.0f, 0.0f, 1.0f));
+    };
 }
 
 void RainSystem::init() {
-    for (int i = 0; i < maxDrops; i++) {
+    const gps::QualitySettings& quality = gps::GpuMemory::get().fit(gps::GPU_MEMORY_BUFFER,
+        [this](const gps::QualitySettings& settings) {
+            return (size_t)(maxDrops * settings.rainDensity) * 2 * sizeof(glm::vec3);
+        });
+    dropCount = static_cast<int>(maxDrops * quality.rainDensity);
+    drops.resize(dropCount);
+
+    for (int i = 0; i < dropCount; i++) {
         drops[i].position = randomSpawnAbove();
 
         float fallSpeed = 300.0f + static_cast<float>(rand() % 61);
@@ -22,21 +37,18 @@ void RainSystem::init() {
         drops[i].isFalling = false;
     }
 
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
+    gps::GpuHeap& heap = gps::GpuHeap::getDynamic<gps::PositionVertex>();
+    vertices = heap.allocate(2 * dropCount * sizeof(gps::PositionVertex));
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glGenVertexArrays(1, &VAO);
 
-    glBufferData(GL_ARRAY_BUFFER,
-        2 * maxDrops * sizeof(glm::vec3),
-        nullptr,
-        GL_DYNAMIC_DRAW);
+    // the attributes read the whole heap buffer, submit starts the draw at our range
+    gps::GLStateCache::get().bindVertexArray(VAO);
+    glBindBuffer(GL_ARRAY_BUFFER, heap.get(vertices).buffer);
 
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
-    glEnableVertexAttribArray(0);
+    gps::PositionVertex::setupAttributes();
 
-    glBindVertexArray(0);
+    gps::GLStateCache::get().bindVertexArray(0);
 
     isInitialized = true; 
 }
@@ -44,7 +56,7 @@ void RainSystem::init() {
 void RainSystem::update(float deltaTime) {
     if (!isInitialized) return;
 
-    for (int i = 0; i < maxDrops; i++) {
+    for (int i = 0; i < dropCount; i++) {
         auto& d = drops[i];
 
         if (!d.isFalling) {
@@ -72,56 +84,47 @@ void RainSystem::update(float deltaTime) {
 void RainSystem::uploadToGPU() {
     if (!isInitialized) return; 
 
-    std::vector<glm::vec3> linePoints(2 * maxDrops);
+    std::vector<gps::PositionVertex> linePoints(2 * dropCount);
 
-    for (int i = 0; i < maxDrops; i++) {
+    for (int i = 0; i < dropCount; i++) {
         glm::vec3 head = drops[i].position;
         glm::vec3 tail = head + glm::vec3(0.0f, 2.0f, 0.0f);
 
-        linePoints[2 * i] = head;
-        linePoints[2 * i + 1] = tail;
+        linePoints[2 * i].position = head;
+        linePoints[2 * i + 1].position = tail;
     }
 
-    glBindVertexArray(VAO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    if (linePoints.empty()) return;
 
-    glBufferSubData(GL_ARRAY_BUFFER,
-        0,
-        linePoints.size() * sizeof(glm::vec3),
-        linePoints.data());
-
-    glBindVertexArray(0);
+    gps::GpuHeap::getDynamic<gps::PositionVertex>().upload(vertices,
+        linePoints.data(),
+        linePoints.size() * sizeof(gps::PositionVertex));
 }
 
-void RainSystem::draw(const glm::mat4& projection, const glm::mat4& view) {
+void RainSystem::submit(gps::RenderQueue& queue) {
     if (!isInitialized) return;
 
-    rainShader.useShaderProgram();
-
-    GLint rainColorLoc = glGetUniformLocation(rainShader.shaderProgram, "rainColor");
-    glUniform3f(rainColorLoc, 0.0f, 0.0f, 1.0f);
+    gps::DrawPacket packet;
+    packet.shader = &rainShader;
+    packet.material = &material;
+    packet.vertexArray = VAO;
+    packet.mode = GL_LINES;
+    packet.count = 2 * dropCount;
+    packet.indexed = false;
+    packet.first = (GLint)(gps::GpuHeap::getDynamic<gps::PositionVertex>().get(vertices).offset / sizeof(gps::PositionVertex));
 
-    GLint projLoc = glGetUniformLocation(rainShader.shaderProgram, "projection");
-    GLint viewLoc = glGetUniformLocation(rainShader.shaderProgram, "view");
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-    glBindVertexArray(VAO);
-    glDrawArrays(GL_LINES, 0, 2 * maxDrops);
-    glBindVertexArray(0);
+    queue.submit(gps::RENDER_PASS_TRANSLUCENT, packet, rainVolumeCenter);
 }
 
 void RainSystem::destroy() {
     if (!isInitialized) return;
 
     if (VAO) {
-        glDeleteVertexArrays(1, &VAO);
+        gps::GLStateCache::get().deleteVertexArrays(1, &VAO);
         VAO = 0;
     }
-    if (VBO) {
-        glDeleteBuffers(1, &VBO);
-        VBO = 0;
-    }
+    gps::GpuHeap::getDynamic<gps::PositionVertex>().free(vertices);
+    vertices = -1;
 
     drops.clear();
     isInitialized = false; 
@@ -5,6 +5,10 @@
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include "Shader.hpp"
+#include "GpuMemory.hpp"
+#include "GpuHeap.hpp"
+#include "Layouts.hpp"
+#include "RenderQueue.hpp"
 
 struct RainDrop {
     glm::vec3 position;
@@ -21,7 +25,8 @@ public:
     void update(float deltaTime);
     void uploadToGPU();
 
-    void draw(const glm::mat4& projection, const glm::mat4& view);
+    // Queues the drops as one translucent packet, sorted by the center of the rain volume
+    void submit(gps::RenderQueue& queue);
 
     void destroy();
 
@@ -29,11 +34,16 @@ private:
     glm::vec3 randomSpawnAbove();
 
     gps::Shader rainShader;           
+    // RainSystem is copied on init, so the material must not point back at it
+    gps::RenderMaterial material;
     std::vector<RainDrop> drops;
 
     GLuint VAO = 0;
-    GLuint VBO = 0;
+    // line vertices in the dynamic heap of PositionVertex
+    gps::GpuHeap::Handle vertices = -1;
     int maxDrops;
+    // drops actually allocated, maxDrops scaled by the GPU memory quality tier
+    int dropCount = 0;
     bool isInitialized;
 };
 
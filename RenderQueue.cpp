@@ -0,0 +1,465 @@
+#include "RenderQueue.hpp"
+#include "GLStateCache.hpp"
+
+#include <glm/gtc/matrix_inverse.hpp>
+
+#include <algorithm>
+#include <iostream>
+
+namespace gps {
+
+    static const int KEY_PASS_BITS = 4;
+    static const int KEY_PROGRAM_BITS = 12;
+    static const int KEY_MATERIAL_BITS = 24;
+    static const int KEY_DEPTH_BITS = 24;
+
+    static const uint64_t KEY_PROGRAM_MASK = (1ull << KEY_PROGRAM_BITS) - 1;
+    static const uint64_t KEY_MATERIAL_MASK = (1ull << KEY_MATERIAL_BITS) - 1;
+    static const uint64_t KEY_DEPTH_MASK = (1ull << KEY_DEPTH_BITS) - 1;
+    static const int KEY_PASS_SHIFT = 64 - KEY_PASS_BITS;
+
+    static_assert(RENDER_PASS_COUNT <= (1 << KEY_PASS_BITS), "render passes do not fit the pass bits of the key");
+
+    void RenderQueue::clear() {
+
+        packets.clear();
+        entries.clear();
+        transforms.clear();
+        sorted = false;
+
+        programChanges = 0;
+        materialChanges = 0;
+        drawCalls = 0;
+        drawnPackets = 0;
+        for (int pass = 0; pass < RENDER_PASS_COUNT; pass++) {
+
+            culledDraws[pass] = 0;
+            submittedDraws[pass] = 0;
+        }
+    }
+
+    void RenderQueue::setPassCamera(RenderPass pass, const glm::mat4& view, const glm::mat4& viewProjection) {
+
+        passViews[pass] = view;
+        passViewProjections[pass] = viewProjection;
+        passFrustums[pass] = Frustum::fromMatrix(viewProjection);
+    }
+
+    const Frustum& RenderQueue::getFrustum(RenderPass pass) const {
+
+        return passFrustums[pass];
+    }
+
+    void RenderQueue::setPassMaterial(RenderPass pass, const RenderMaterial* material) {
+
+        passMaterials[pass] = material;
+    }
+
+    const RenderMaterial* RenderQueue::getPassMaterial(RenderPass pass) const {
+
+        return passMaterials[pass];
+    }
+
+    void RenderQueue::setPassDepthState(RenderPass pass, GLenum depthFunc, GLboolean depthMask) {
+
+        passDepthOverridden[pass] = true;
+        passDepthFuncs[pass] = depthFunc;
+        passDepthMasks[pass] = depthMask;
+    }
+
+    void RenderQueue::clearPassDepthState(RenderPass pass) {
+
+        passDepthOverridden[pass] = false;
+    }
+
+    void RenderQueue::addCulled(RenderPass pass, unsigned int count) {
+
+        culledDraws[pass] += count;
+    }
+
+    GLint RenderQueue::addTransform(const glm::mat4& model) {
+
+        transforms.push_back(model);
+        return (GLint)transforms.size() - 1;
+    }
+
+    void RenderQueue::submit(RenderPass pass, const DrawPacket& packet, const glm::vec3& center) {
+
+        SortEntry entry;
+        entry.key = makeKey(pass, packet, center);
+        entry.packet = (uint32_t)packets.size();
+
+        packets.push_back(packet);
+        entries.push_back(entry);
+        submittedDraws[pass]++;
+        sorted = false;
+    }
+
+    GLuint RenderQueue::programId(const gps::Shader* shader) {
+
+        // copies of a Shader share the program, so the GL name identifies it
+        std::map<GLuint, GLuint>::iterator it = programIds.find(shader->shaderProgram);
+        if (it != programIds.end()) {
+            return it->second;
+        }
+
+        GLuint id = (GLuint)(programIds.size() & KEY_PROGRAM_MASK);
+        programIds[shader->shaderProgram] = id;
+        return id;
+    }
+
+    GLuint RenderQueue::materialId(const RenderMaterial* material) {
+
+        if (material == NULL) {
+            return 0;
+        }
+
+        std::map<const RenderMaterial*, GLuint>::iterator it = materialIds.find(material);
+        if (it != materialIds.end()) {
+            return it->second;
+        }
+
+        // 0 is kept for packets without a material
+        GLuint id = (GLuint)((materialIds.size() + 1) & KEY_MATERIAL_MASK);
+        materialIds[material] = id;
+        return id;
+    }
+
+    uint64_t RenderQueue::makeKey(RenderPass pass, const DrawPacket& packet, const glm::vec3& center) {
+
+        // normalized device depth of the center, clamped so that anything behind the
+        // near plane sorts first and anything past the far plane last
+        glm::vec4 clip = passViewProjections[pass] * glm::vec4(center, 1.0f);
+        float depth = clip.w > 0.0f ? clip.z / clip.w * 0.5f + 0.5f : 0.0f;
+        depth = std::min(std::max(depth, 0.0f), 1.0f);
+        uint64_t depthBits = (uint64_t)(depth * (float)KEY_DEPTH_MASK);
+
+        uint64_t program = programId(packet.shader);
+        uint64_t material = materialId(packet.material);
+
+        uint64_t key = (uint64_t)pass << KEY_PASS_SHIFT;
+
+        if (pass == RENDER_PASS_TRANSLUCENT) {
+
+            // blending needs back to front, state changes come second
+            key |= (KEY_DEPTH_MASK - depthBits) << (KEY_PROGRAM_BITS + KEY_MATERIAL_BITS);
+            key |= program << KEY_MATERIAL_BITS;
+            key |= material & KEY_MATERIAL_MASK;
+        }
+        else {
+
+            // fewest state changes first, front to back inside a run for early depth rejection
+            key |= program << (KEY_MATERIAL_BITS + KEY_DEPTH_BITS);
+            key |= (material & KEY_MATERIAL_MASK) << KEY_DEPTH_BITS;
+            key |= depthBits;
+        }
+
+        return key;
+    }
+
+    void RenderQueue::sort() {
+
+        if (sorted) {
+            return;
+        }
+
+        // LSD radix sort on 8-bit digits, stable, so equal keys keep their submission order.
+        // A digit that is the same for every key needs no pass.
+        scratch.resize(entries.size());
+
+        for (int shift = 0; shift < 64; shift += 8) {
+
+            size_t counts[256] = { 0 };
+            for (size_t i = 0; i < entries.size(); i++) {
+                counts[(entries[i].key >> shift) & 0xFF]++;
+            }
+
+            if (entries.empty() || counts[(entries[0].key >> shift) & 0xFF] == entries.size()) {
+                continue;
+            }
+
+            size_t offset = 0;
+            for (int digit = 0; digit < 256; digit++) {
+
+                size_t count = counts[digit];
+                counts[digit] = offset;
+                offset += count;
+            }
+
+            for (size_t i = 0; i < entries.size(); i++) {
+                scratch[counts[(entries[i].key >> shift) & 0xFF]++] = entries[i];
+            }
+
+            entries.swap(scratch);
+        }
+
+        sorted = true;
+    }
+
+    bool RenderQueue::canMultiDrawIndirect() {
+
+#if defined (__APPLE__)
+        return false;
+#else
+        return GLEW_VERSION_4_3 == GL_TRUE || GLEW_ARB_multi_draw_indirect == GL_TRUE;
+#endif
+    }
+
+    void RenderQueue::buildBatches(RenderPass pass) {
+
+        batches.clear();
+        commands.clear();
+
+        // entries of the pass are contiguous, find the first one
+        SortEntry first;
+        first.key = (uint64_t)pass << KEY_PASS_SHIFT;
+        first.packet = 0;
+        size_t entry = std::lower_bound(entries.begin(), entries.end(), first,
+            [](const SortEntry& a, const SortEntry& b) { return a.key < b.key; }) - entries.begin();
+
+        for (; entry < entries.size() && (int)(entries[entry].key >> KEY_PASS_SHIFT) == pass; entry++) {
+
+            const DrawPacket& packet = packets[entries[entry].packet];
+
+            // indexed packets sharing every binding and uniform merge into the open batch
+            if (!batches.empty() && packet.indexed) {
+
+                Batch& batch = batches.back();
+                const DrawPacket& open = packets[entries[batch.firstEntry].packet];
+                if (open.indexed && open.shader->shaderProgram == packet.shader->shaderProgram &&
+                    open.material == packet.material && open.transform == packet.transform &&
+                    open.vertexArray == packet.vertexArray && open.mode == packet.mode) {
+
+                    batch.entryCount++;
+                    commands.push_back(DrawCommand());
+                    DrawCommand& command = commands.back();
+                    command.count = (GLuint)packet.count;
+                    command.instanceCount = 1;
+                    command.firstIndex = (GLuint)packet.first;
+                    command.baseVertex = packet.baseVertex;
+                    command.baseInstance = 0;
+                    continue;
+                }
+            }
+
+            Batch batch;
+            batch.firstEntry = (uint32_t)entry;
+            batch.entryCount = 1;
+            batch.firstCommand = (uint32_t)commands.size();
+            batches.push_back(batch);
+
+            if (packet.indexed) {
+
+                commands.push_back(DrawCommand());
+                DrawCommand& command = commands.back();
+                command.count = (GLuint)packet.count;
+                command.instanceCount = 1;
+                command.firstIndex = (GLuint)packet.first;
+                command.baseVertex = packet.baseVertex;
+                command.baseInstance = 0;
+            }
+        }
+    }
+
+    void RenderQueue::drawBatch(const Batch& batch, bool indirect) {
+
+        const DrawPacket& packet = packets[entries[batch.firstEntry].packet];
+
+        if (!packet.indexed) {
+
+            glDrawArrays(packet.mode, packet.first, packet.count);
+        }
+        else if (batch.entryCount == 1) {
+
+            glDrawElementsBaseVertex(packet.mode, packet.count, GL_UNSIGNED_INT,
+                (GLvoid*)(packet.first * sizeof(GLuint)), packet.baseVertex);
+        }
+        else if (indirect) {
+
+#if !defined (__APPLE__)
+            glMultiDrawElementsIndirect(packet.mode, GL_UNSIGNED_INT,
+                (GLvoid*)(batch.firstCommand * sizeof(DrawCommand)), (GLsizei)batch.entryCount, 0);
+#endif
+        }
+        else {
+
+            // 4.1 fallback: the same commands as client side arrays
+            multiCounts.resize(batch.entryCount);
+            multiOffsets.resize(batch.entryCount);
+            multiBaseVertices.resize(batch.entryCount);
+            for (uint32_t i = 0; i < batch.entryCount; i++) {
+
+                const DrawCommand& command = commands[batch.firstCommand + i];
+                multiCounts[i] = (GLsizei)command.count;
+                multiOffsets[i] = (GLvoid*)(command.firstIndex * sizeof(GLuint));
+                multiBaseVertices[i] = command.baseVertex;
+            }
+            glMultiDrawElementsBaseVertex(packet.mode, &multiCounts[0], GL_UNSIGNED_INT,
+                &multiOffsets[0], (GLsizei)batch.entryCount, &multiBaseVertices[0]);
+        }
+
+        drawCalls++;
+        drawnPackets += batch.entryCount;
+    }
+
+    void RenderQueue::execute(RenderPass pass) {
+
+        sort();
+        buildBatches(pass);
+
+        // the commands of the whole pass go up in one upload, the batches draw slices of it
+        bool indirect = canMultiDrawIndirect() && batches.size() < commands.size();
+        if (indirect) {
+
+            if (indirectBuffer == 0) {
+                glGenBuffers(1, &indirectBuffer);
+            }
+
+            // orphaned every upload, the draws of the previous pass may still read it
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commands.size() * sizeof(DrawCommand), NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_DRAW_INDIRECT_BUFFER, 0, commands.size() * sizeof(DrawCommand), &commands[0]);
+        }
+
+        GLStateCache& state = GLStateCache::get();
+
+        GLuint currentProgram = 0;
+        const RenderMaterial* currentMaterial = NULL;
+        GLint currentTransform = -1;
+
+        for (size_t i = 0; i < batches.size(); i++) {
+
+            const DrawPacket& packet = packets[entries[batches[i].firstEntry].packet];
+            gps::Shader& shader = *packet.shader;
+
+            bool programChanged = shader.shaderProgram != currentProgram;
+            if (programChanged) {
+
+                shader.useShaderProgram();
+                currentProgram = shader.shaderProgram;
+                currentTransform = -1;
+                programChanges++;
+            }
+
+            // sampler units and material uniforms belong to the program, a new program rebinds them;
+            // the first batch sets the state even without a material, the pass may override it
+            if (i == 0 || packet.material != currentMaterial || (programChanged && packet.material != NULL)) {
+
+                if (packet.material != NULL) {
+
+                    applyRasterState(pass, *packet.material);
+                    if (packet.material->bind) {
+                        packet.material->bind(shader);
+                    }
+                }
+                else {
+                    applyRasterState(pass, RenderMaterial());
+                }
+                currentMaterial = packet.material;
+                materialChanges++;
+            }
+
+            if (packet.transform >= 0 && packet.transform != currentTransform) {
+
+                const glm::mat4& model = transforms[packet.transform];
+                shader.set<gps::UniformId::model>(model);
+                shader.set<gps::UniformId::normalMatrix>(glm::mat3(glm::inverseTranspose(passViews[pass] * model)));
+                currentTransform = packet.transform;
+            }
+
+            state.bindVertexArray(packet.vertexArray);
+            drawBatch(batches[i], indirect);
+        }
+
+        if (indirect) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+
+        // leave the defaults the rest of the frame expects, glClear needs the depth mask
+        state.depthFunc(GL_LESS);
+        state.depthMask(GL_TRUE);
+        state.colorMask(GL_TRUE);
+        state.disable(GL_CULL_FACE);
+        state.cullFace(GL_BACK);
+        state.disable(GL_POLYGON_OFFSET_FILL);
+    }
+
+    void RenderQueue::applyRasterState(RenderPass pass, const RenderMaterial& material) {
+
+        GLStateCache& state = GLStateCache::get();
+
+        if (passDepthOverridden[pass]) {
+
+            state.depthFunc(passDepthFuncs[pass]);
+            state.depthMask(passDepthMasks[pass]);
+        }
+        else {
+
+            state.depthFunc(material.depthFunc);
+            state.depthMask(material.depthMask);
+        }
+        state.colorMask(material.colorMask);
+
+        if (material.cullFace != GL_NONE) {
+
+            state.enable(GL_CULL_FACE);
+            state.cullFace(material.cullFace);
+        }
+        else {
+
+            state.disable(GL_CULL_FACE);
+            state.cullFace(GL_BACK);
+        }
+
+        if (material.polygonOffsetFactor != 0.0f || material.polygonOffsetUnits != 0.0f) {
+
+            state.enable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(material.polygonOffsetFactor, material.polygonOffsetUnits);
+        }
+        else {
+            state.disable(GL_POLYGON_OFFSET_FILL);
+        }
+    }
+
+    void RenderQueue::destroy() {
+
+        if (indirectBuffer != 0) {
+
+            glDeleteBuffers(1, &indirectBuffer);
+            indirectBuffer = 0;
+        }
+    }
+
+    size_t RenderQueue::getPacketCount() const {
+
+        return packets.size();
+    }
+
+    void RenderQueue::report() const {
+
+        std::cout << "[INFO] Render queue last frame: " << drawCalls << " draws for " << drawnPackets << " packets, "
+            << programChanges << " program changes, " << materialChanges << " material changes" << std::endl;
+
+        static const char* passNames[RENDER_PASS_COUNT - RENDER_PASS_DEPTH_PREPASS] = {
+            "depth prepass", "opaque", "sky", "translucent"
+        };
+        for (int pass = 0; pass < RENDER_PASS_COUNT; pass++) {
+
+            if (culledDraws[pass] > 0) {
+
+                std::cout << "[INFO]   ";
+                if (isDynamicShadowPass((RenderPass)pass)) {
+                    std::cout << "dynamic shadow cascade " << pass - RENDER_PASS_SHADOW_DYNAMIC;
+                }
+                else if (isShadowPass((RenderPass)pass)) {
+                    std::cout << "shadow cascade " << pass - RENDER_PASS_SHADOW;
+                }
+                else {
+                    std::cout << passNames[pass - RENDER_PASS_DEPTH_PREPASS];
+                }
+                std::cout << " pass: " << submittedDraws[pass] << " submitted, "
+                    << culledDraws[pass] << " culled" << std::endl;
+            }
+        }
+    }
+}
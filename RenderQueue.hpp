@@ -0,0 +1,204 @@
+#ifndef RenderQueue_hpp
+#define RenderQueue_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Shader.hpp"
+#include "Frustum.hpp"
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+
+namespace gps {
+
+    // Passes execute in this order, the pass is the top of the sort key
+    enum RenderPass {
+        // static shadow casters, one pass per cascade, see shadowPass()
+        RENDER_PASS_SHADOW = 0,
+        // moving shadow casters drawn over the cached static depth, see dynamicShadowPass()
+        RENDER_PASS_SHADOW_DYNAMIC = RENDER_PASS_SHADOW + MAX_SHADOW_CASCADES,
+        // depth of the opaque geometry laid down before it is lit, when enabled
+        RENDER_PASS_DEPTH_PREPASS = RENDER_PASS_SHADOW_DYNAMIC + MAX_SHADOW_CASCADES,
+        RENDER_PASS_OPAQUE,
+        // drawn after the opaque geometry, only where the depth buffer is still clear
+        RENDER_PASS_SKY,
+        // sorted back to front
+        RENDER_PASS_TRANSLUCENT,
+        RENDER_PASS_COUNT
+    };
+
+    inline RenderPass shadowPass(int cascade) {
+        return (RenderPass)(RENDER_PASS_SHADOW + cascade);
+    }
+
+    inline RenderPass dynamicShadowPass(int cascade) {
+        return (RenderPass)(RENDER_PASS_SHADOW_DYNAMIC + cascade);
+    }
+
+    inline bool isShadowPass(RenderPass pass) {
+        return pass < RENDER_PASS_DEPTH_PREPASS;
+    }
+
+    inline bool isDynamicShadowPass(RenderPass pass) {
+        return pass >= RENDER_PASS_SHADOW_DYNAMIC && pass < RENDER_PASS_DEPTH_PREPASS;
+    }
+
+    // State shared by a run of packets, applied when the material of the sorted packets changes
+    struct RenderMaterial {
+        GLenum depthFunc = GL_LESS;
+        GLboolean depthMask = GL_TRUE;
+        GLboolean colorMask = GL_TRUE;
+        // face culled by the rasterizer, GL_NONE leaves culling off
+        GLenum cullFace = GL_NONE;
+        // slope-scaled depth offset, both 0 leave it off
+        GLfloat polygonOffsetFactor = 0.0f;
+        GLfloat polygonOffsetUnits = 0.0f;
+        // the packets draw from the position-only stream of their geometry
+        bool positionOnly = false;
+        // binds the textures, buffers and material uniforms for the given program
+        std::function<void(gps::Shader&)> bind;
+    };
+
+    // One draw and the state it needs, consecutive indexed packets that share all of it
+    // are issued as a single multi-draw
+    struct DrawPacket {
+        gps::Shader* shader = NULL;
+        // NULL when the draw needs no material state
+        const RenderMaterial* material = NULL;
+        GLuint vertexArray = 0;
+        GLenum mode = GL_TRIANGLES;
+        GLsizei count = 0;
+        // GL_UNSIGNED_INT indices starting at index first, offset by baseVertex, when true;
+        // glDrawArrays from vertex first otherwise
+        bool indexed = false;
+        GLint first = 0;
+        GLint baseVertex = 0;
+        // entry returned by RenderQueue::addTransform, -1 when the program takes no model matrix
+        GLint transform = -1;
+    };
+
+    // Draws collected over a frame, sorted by a 64-bit key so that every pass runs
+    // with as few program, material and uniform changes as possible.
+    //   opaque passes:   pass (4) | program (12) | material (24) | depth, front to back (24)
+    //   translucent:     pass (4) | depth, back to front (24) | program (12) | material (24)
+    class RenderQueue {
+
+    public:
+        // Drops the packets and transforms of the previous frame
+        void clear();
+
+        // Matrices of the pass: view gives the normal matrices, viewProjection the sort depth
+        // and the frustum the pass is culled against
+        void setPassCamera(RenderPass pass, const glm::mat4& view, const glm::mat4& viewProjection);
+        const Frustum& getFrustum(RenderPass pass) const;
+
+        // Material submitters use in place of their own for every packet of the pass, NULL
+        // lets them choose; kept until it is set again
+        void setPassMaterial(RenderPass pass, const RenderMaterial* material);
+        const RenderMaterial* getPassMaterial(RenderPass pass) const;
+
+        // Depth test of every packet of the pass whatever its material says, e.g. GL_EQUAL
+        // without writes over a depth prepass; kept until cleared
+        void setPassDepthState(RenderPass pass, GLenum depthFunc, GLboolean depthMask);
+        void clearPassDepthState(RenderPass pass);
+
+        // Draws left out of the pass by the submitter, for the statistics
+        void addCulled(RenderPass pass, unsigned int count);
+
+        // Model matrix shared by the packets of one object, returns its index for DrawPacket::transform
+        GLint addTransform(const glm::mat4& model);
+
+        // center is the world space point the packet is depth sorted by
+        void submit(RenderPass pass, const DrawPacket& packet, const glm::vec3& center);
+
+        // Radix sorts the submitted packets, needed once before the passes execute
+        void sort();
+
+        // Issues the sorted packets of one pass, restores the default depth state afterwards
+        void execute(RenderPass pass);
+
+        // Releases the indirect command buffer
+        void destroy();
+
+        size_t getPacketCount() const;
+        void report() const;
+
+    private:
+        struct SortEntry {
+            uint64_t key;
+            uint32_t packet;
+        };
+
+        // Layout of glMultiDrawElementsIndirect commands
+        struct DrawCommand {
+            GLuint count;
+            GLuint instanceCount;
+            GLuint firstIndex;
+            GLint baseVertex;
+            GLuint baseInstance;
+        };
+
+        // Sorted entries issued by one draw call, with their commands when indexed
+        struct Batch {
+            uint32_t firstEntry;
+            uint32_t entryCount;
+            uint32_t firstCommand;
+        };
+
+        uint64_t makeKey(RenderPass pass, const DrawPacket& packet, const glm::vec3& center);
+        static bool canMultiDrawIndirect();
+        void buildBatches(RenderPass pass);
+        void drawBatch(const Batch& batch, bool indirect);
+        // depth, color, face culling and polygon offset state of the material in the pass,
+        // GLStateCache does not track the offset
+        void applyRasterState(RenderPass pass, const RenderMaterial& material);
+        GLuint programId(const gps::Shader* shader);
+        GLuint materialId(const RenderMaterial* material);
+
+        std::vector<DrawPacket> packets;
+        std::vector<SortEntry> entries;
+        std::vector<SortEntry> scratch;
+        std::vector<glm::mat4> transforms;
+        bool sorted = false;
+
+        glm::mat4 passViews[RENDER_PASS_COUNT];
+        glm::mat4 passViewProjections[RENDER_PASS_COUNT];
+        Frustum passFrustums[RENDER_PASS_COUNT];
+        const RenderMaterial* passMaterials[RENDER_PASS_COUNT] = {};
+        bool passDepthOverridden[RENDER_PASS_COUNT] = {};
+        GLenum passDepthFuncs[RENDER_PASS_COUNT] = {};
+        GLboolean passDepthMasks[RENDER_PASS_COUNT] = {};
+
+        // small ids for the key fields, stable for the lifetime of the queue
+        std::map<GLuint, GLuint> programIds;
+        std::map<const RenderMaterial*, GLuint> materialIds;
+
+        // reused by every execute
+        std::vector<Batch> batches;
+        std::vector<DrawCommand> commands;
+        std::vector<GLsizei> multiCounts;
+        std::vector<GLvoid*> multiOffsets;
+        std::vector<GLint> multiBaseVertices;
+        GLuint indirectBuffer = 0;
+
+        // statistics of the last executed frame
+        unsigned int programChanges = 0;
+        unsigned int materialChanges = 0;
+        unsigned int drawCalls = 0;
+        unsigned int drawnPackets = 0;
+        unsigned int culledDraws[RENDER_PASS_COUNT] = { 0 };
+        unsigned int submittedDraws[RENDER_PASS_COUNT] = { 0 };
+    };
+}
+
+#endif /* RenderQueue_hpp */
@@ -0,0 +1,190 @@
+#include "SceneHierarchy.hpp"
+
+#include <cfloat>
+#include <iostream>
+
+namespace gps {
+
+    int SceneHierarchy::addInstance(gps::Model3D* model, const glm::mat4& transform, ShadowCasting shadowCasting) {
+
+        Instance instance;
+        instance.model = model;
+        instance.transform = transform;
+        instance.shadowCasting = shadowCasting;
+        instance.moved = false;
+        instances.push_back(instance);
+
+        return (int)instances.size() - 1;
+    }
+
+    void SceneHierarchy::setTransform(int instance, const glm::mat4& transform) {
+
+        // a parked instance keeps its cached shadows
+        if (instances[instance].transform == transform) {
+            return;
+        }
+
+        instances[instance].transform = transform;
+        instances[instance].moved = true;
+    }
+
+    const glm::mat4& SceneHierarchy::getTransform(int instance) const {
+
+        return instances[instance].transform;
+    }
+
+    void SceneHierarchy::computeItemBounds(uint32_t item) {
+
+        const Instance& instance = instances[items[item].instance];
+        const gps::Mesh& mesh = instance.model->GetMesh(items[item].mesh);
+        gps::transformBox(instance.transform, mesh.getBoundsMin(), mesh.getBoundsMax(),
+            itemBounds[item].min, itemBounds[item].max);
+    }
+
+    void SceneHierarchy::computeInstanceBounds(uint32_t instance) {
+
+        uint32_t end = instance + 1 < firstItems.size() ? firstItems[instance + 1] : (uint32_t)items.size();
+        Aabb& bounds = instanceBounds[instance];
+        bounds.min = glm::vec3(FLT_MAX);
+        bounds.max = glm::vec3(-FLT_MAX);
+
+        for (uint32_t item = firstItems[instance]; item < end; item++) {
+
+            bounds.min = glm::min(bounds.min, itemBounds[item].min);
+            bounds.max = glm::max(bounds.max, itemBounds[item].max);
+        }
+    }
+
+    void SceneHierarchy::build() {
+
+        items.clear();
+        firstItems.clear();
+
+        for (size_t i = 0; i < instances.size(); i++) {
+
+            firstItems.push_back((uint32_t)items.size());
+            for (size_t m = 0; m < instances[i].model->GetMeshCount(); m++) {
+
+                Item item;
+                item.instance = (uint32_t)i;
+                item.mesh = (uint32_t)m;
+                items.push_back(item);
+            }
+            instances[i].moved = false;
+        }
+
+        itemBounds.resize(items.size());
+        for (size_t i = 0; i < items.size(); i++) {
+            computeItemBounds((uint32_t)i);
+        }
+
+        instanceBounds.resize(instances.size());
+        for (size_t i = 0; i < instances.size(); i++) {
+            computeInstanceBounds((uint32_t)i);
+        }
+
+        bvh.build(itemBounds);
+
+        std::cout << "[INFO] Scene hierarchy: " << items.size() << " meshes in "
+            << bvh.getNodeCount() << " nodes" << std::endl;
+    }
+
+    void SceneHierarchy::update() {
+
+        bool moved = false;
+        dynamicCastersMoved = false;
+
+        for (size_t i = 0; i < instances.size(); i++) {
+
+            if (!instances[i].moved) {
+                continue;
+            }
+
+            uint32_t end = i + 1 < firstItems.size() ? firstItems[i + 1] : (uint32_t)items.size();
+            for (uint32_t item = firstItems[i]; item < end; item++) {
+                computeItemBounds(item);
+            }
+            computeInstanceBounds((uint32_t)i);
+
+            if (instances[i].shadowCasting == SHADOW_CASTING_DYNAMIC) {
+                dynamicCastersMoved = true;
+            }
+            instances[i].moved = false;
+            moved = true;
+        }
+
+        if (moved) {
+            bvh.refit(itemBounds);
+        }
+    }
+
+    bool SceneHierarchy::haveDynamicCastersMoved() const {
+
+        return dynamicCastersMoved;
+    }
+
+    bool SceneHierarchy::takesPart(const Instance& instance, gps::RenderPass pass) {
+
+        if (gps::isDynamicShadowPass(pass)) {
+            return instance.shadowCasting == SHADOW_CASTING_DYNAMIC;
+        }
+        if (gps::isShadowPass(pass)) {
+            return instance.shadowCasting == SHADOW_CASTING_STATIC;
+        }
+        return true;
+    }
+
+    unsigned int SceneHierarchy::submit(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shader,
+        gps::OcclusionCuller* occlusion) {
+
+        visibleItems.clear();
+        bvh.queryFrustum(queue.getFrustum(pass), visibleItems);
+
+        // one transform per instance and pass, added by its first visible mesh
+        instanceTransforms.assign(instances.size(), -1);
+        instanceVisibility.assign(instances.size(), -1);
+
+        unsigned int candidates = 0;
+        unsigned int submitted = 0;
+
+        for (size_t i = 0; i < instances.size(); i++) {
+
+            if (takesPart(instances[i], pass)) {
+                candidates += (unsigned int)instances[i].model->GetMeshCount();
+            }
+        }
+
+        for (size_t i = 0; i < visibleItems.size(); i++) {
+
+            const Item& item = items[visibleItems[i]];
+            Instance& instance = instances[item.instance];
+
+            if (!takesPart(instance, pass)) {
+                continue;
+            }
+
+            if (occlusion != NULL) {
+
+                // the instance box is tested once, a hidden instance hides all its meshes
+                int& instanceVisible = instanceVisibility[item.instance];
+                if (instanceVisible < 0) {
+                    instanceVisible = occlusion->isVisible(instanceBounds[item.instance].min, instanceBounds[item.instance].max) ? 1 : 0;
+                }
+
+                if (instanceVisible == 0 || !occlusion->isVisible(itemBounds[visibleItems[i]].min, itemBounds[visibleItems[i]].max)) {
+                    continue;
+                }
+            }
+
+            if (instanceTransforms[item.instance] < 0) {
+                instanceTransforms[item.instance] = queue.addTransform(instance.transform);
+            }
+
+            instance.model->SubmitMesh(queue, pass, shader, item.mesh, instanceTransforms[item.instance], instance.transform);
+            submitted++;
+        }
+
+        queue.addCulled(pass, candidates - submitted);
+        return submitted;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef SceneHierarchy_hpp
+#define SceneHierarchy_hpp
+
+#include <glm/glm.hpp>
+
+#include "Model3D.hpp"
+#include "RenderQueue.hpp"
+#include "Bvh.hpp"
+#include "OcclusionCuller.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // How an instance takes part in the shadow passes
+    enum ShadowCasting {
+        SHADOW_CASTING_NONE,
+        // drawn into the cached shadow maps of the static scene
+        SHADOW_CASTING_STATIC,
+        // moves, drawn over a copy of the cached maps
+        SHADOW_CASTING_DYNAMIC
+    };
+
+    // Placed model instances, indexed by one bounding volume hierarchy over the world
+    // space bounds of all their meshes. Static and moving instances share the tree,
+    // moved instances only refit it.
+    class SceneHierarchy {
+
+    public:
+        // The model must outlive the hierarchy, returns the handle for setTransform
+        int addInstance(gps::Model3D* model, const glm::mat4& transform, ShadowCasting shadowCasting);
+        void setTransform(int instance, const glm::mat4& transform);
+        const glm::mat4& getTransform(int instance) const;
+
+        // Builds the tree over every mesh of every instance, call again after adding instances
+        // or when instances moved far enough for the refitted tree to get loose
+        void build();
+
+        // Refits the tree to the instances moved since the last update
+        void update();
+
+        // Whether the last update moved a dynamic shadow caster
+        bool haveDynamicCastersMoved() const;
+
+        // Queues the meshes inside the pass frustum and returns how many. Static shadow passes
+        // take the static casters, dynamic shadow passes the dynamic ones. With an occlusion
+        // culler, instance and then mesh bounds hidden behind its occluders are left out too;
+        // it must match the pass camera and be finished.
+        unsigned int submit(gps::RenderQueue& queue, gps::RenderPass pass, gps::Shader& shader,
+            gps::OcclusionCuller* occlusion = NULL);
+
+    private:
+        struct Instance {
+            gps::Model3D* model;
+            glm::mat4 transform;
+            ShadowCasting shadowCasting;
+            bool moved;
+        };
+
+        struct Item {
+            uint32_t instance;
+            uint32_t mesh;
+        };
+
+        void computeItemBounds(uint32_t item);
+        void computeInstanceBounds(uint32_t instance);
+        static bool takesPart(const Instance& instance, gps::RenderPass pass);
+
+        std::vector<Instance> instances;
+        std::vector<Item> items;
+        std::vector<Aabb> itemBounds;
+        // first item of every instance, its meshes are contiguous
+        std::vector<uint32_t> firstItems;
+        // world space bounds of every instance, the union of its meshes
+        std::vector<Aabb> instanceBounds;
+        Bvh bvh;
+        bool dynamicCastersMoved = false;
+
+        // reused by every submit
+        std::vector<uint32_t> visibleItems;
+        std::vector<GLint> instanceTransforms;
+        // per instance: 0 occluded, 1 visible, -1 not tested yet
+        std::vector<int> instanceVisibility;
+    };
+}
+
+#endif /* SceneHierarchy_hpp */
@@ -7,6 +7,12 @@
 //
 
 #include "Shader.hpp"
+#include "UniformBuffers.hpp"
+#include "GLStateCache.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <thread>
 
 namespace gps {
     std::string Shader::readShaderFile(std::string fileName) {
@@ -58,42 +64,494 @@ namespace gps {
         }
     }
     
+    std::string Shader::injectDefines(const std::string& source, const std::vector<std::string>& defines) {
+
+        if (defines.empty()) {
+            return source;
+        }
+
+        std::string defineLines;
+        for (size_t i = 0; i < defines.size(); i++) {
+            defineLines += "#define " + defines[i] + "\n";
+        }
+
+        //the defines have to follow the #version directive
+        size_t insertAt = 0;
+        size_t version = source.find("#version");
+        if (version != std::string::npos) {
+            size_t lineEnd = source.find('\n', version);
+            insertAt = lineEnd == std::string::npos ? source.size() : lineEnd + 1;
+        }
+
+        std::string injected = source;
+        if (insertAt == injected.size() && (injected.empty() || injected.back() != '\n')) {
+            injected += "\n";
+            insertAt = injected.size();
+        }
+        return injected.insert(insertAt, defineLines);
+    }
+
+    std::string Shader::resolveIncludes(const std::string& source, const std::string& fileName) {
+
+        //snippets live in include/ beside the shaders, whichever file includes them
+        size_t slash = fileName.find_last_of("/\\");
+        std::string includeDirectory = (slash == std::string::npos ? std::string() : fileName.substr(0, slash + 1)) + "include/";
+
+        std::set<std::string> included;
+        return resolveIncludes(source, fileName, includeDirectory, included);
+    }
+
+    std::string Shader::resolveIncludes(const std::string& source, const std::string& fileName,
+        const std::string& includeDirectory, std::set<std::string>& included) {
+
+        std::stringstream input(source);
+        std::stringstream output;
+        std::string line;
+
+        while (std::getline(input, line)) {
+
+            size_t directive = line.find_first_not_of(" \t");
+            if (directive == std::string::npos || line.compare(directive, 8, "#include") != 0) {
+                output << line << "\n";
+                continue;
+            }
+
+            size_t open = line.find('<', directive);
+            size_t close = line.find('>', open == std::string::npos ? directive : open);
+            std::string name = open == std::string::npos || close == std::string::npos
+                ? std::string() : line.substr(open + 1, close - open - 1);
+
+            std::string layout = glslLayoutSource(name);
+            if (!layout.empty()) {
+                output << layout;
+                continue;
+            }
+
+            if (name.empty()) {
+                fprintf(stderr, "ERROR: unknown include in %s: %s\n", fileName.c_str(), line.c_str());
+                continue;
+            }
+
+            //a shared snippet, which may include others; a second include of it is dropped
+            if (!included.insert(name).second) {
+                continue;
+            }
+
+            std::string snippetFileName = includeDirectory + name + ".glsl";
+            std::string snippet = readShaderFile(snippetFileName);
+            if (snippet.empty()) {
+                fprintf(stderr, "ERROR: unknown include in %s: %s\n", fileName.c_str(), line.c_str());
+                continue;
+            }
+            output << resolveIncludes(snippet, snippetFileName, includeDirectory, included);
+        }
+
+        return output.str();
+    }
+
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
 
-        //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
+        loadShader(vertexShaderFileName, fragmentShaderFileName, std::vector<std::string>());
+    }
+
+    void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::vector<std::string>& defines) {
+
+        beginLoad(vertexShaderFileName, fragmentShaderFileName, defines);
+        finishLoad();
+    }
+
+    void Shader::beginLoad(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, const std::vector<std::string>& defines) {
+
+        std::string v = injectDefines(resolveIncludes(readShaderFile(vertexShaderFileName), vertexShaderFileName), defines);
+        std::string f = injectDefines(resolveIncludes(readShaderFile(fragmentShaderFileName), fragmentShaderFileName), defines);
+
+        this->pendingKey = programCacheKey(v, f);
+        this->pendingCachePath = programCachePath(vertexShaderFileName, fragmentShaderFileName, defines);
+        this->pendingVertexShader = 0;
+        this->pendingFragmentShader = 0;
+
+        //a cached binary skips the compile and link entirely
+        this->shaderProgram = glCreateProgram();
+        if (loadProgramBinary(this->pendingCachePath, this->pendingKey)) {
+            return;
+        }
+
+        //the driver may reject a binary, start again from a fresh program
+        GLStateCache::get().deleteProgram(this->shaderProgram);
+
+        //parse and compile the vertex shader, the status is only checked by finishLoad
         const GLchar* vertexShaderString = v.c_str();
-        GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
-        
-        //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
+        this->pendingVertexShader = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(this->pendingVertexShader, 1, &vertexShaderString, NULL);
+        glCompileShader(this->pendingVertexShader);
+
+        //parse and compile the fragment shader
         const GLchar* fragmentShaderString = f.c_str();
-        GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
-        
+        this->pendingFragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(this->pendingFragmentShader, 1, &fragmentShaderString, NULL);
+        glCompileShader(this->pendingFragmentShader);
+
         //attach and link the shader programs
         this->shaderProgram = glCreateProgram();
-        glAttachShader(this->shaderProgram, vertexShader);
-        glAttachShader(this->shaderProgram, fragmentShader);
+        glProgramParameteri(this->shaderProgram, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glAttachShader(this->shaderProgram, this->pendingVertexShader);
+        glAttachShader(this->shaderProgram, this->pendingFragmentShader);
         glLinkProgram(this->shaderProgram);
-        glDeleteShader(vertexShader);
-        glDeleteShader(fragmentShader);
-        //check linking info
-        shaderLinkLog(this->shaderProgram);
+    }
+
+    bool Shader::isReady() {
+
+        if (this->pendingVertexShader == 0 || !ShaderBatch::isParallelCompileSupported()) {
+            return true;
+        }
+
+        //does not block, unlike GL_LINK_STATUS
+        GLint completed = GL_FALSE;
+        glGetProgramiv(this->shaderProgram, GL_COMPLETION_STATUS_KHR, &completed);
+        return completed == GL_TRUE;
+    }
+
+    void Shader::finishLoad() {
+
+        if (this->pendingVertexShader != 0) {
+
+            //check compilation status
+            shaderCompileLog(this->pendingVertexShader);
+            shaderCompileLog(this->pendingFragmentShader);
+            glDeleteShader(this->pendingVertexShader);
+            glDeleteShader(this->pendingFragmentShader);
+            this->pendingVertexShader = 0;
+            this->pendingFragmentShader = 0;
+            //check linking info
+            shaderLinkLog(this->shaderProgram);
+            //keep the binary for the next launch
+            saveProgramBinary(this->pendingCachePath, this->pendingKey);
+        }
+
+        //cache the locations of the active uniforms
+        reflectUniforms();
+        //attach the shared uniform blocks to their binding points
+        bindUniformBlocks();
     }
     
     void Shader::useShaderProgram() {
 
-        glUseProgram(this->shaderProgram);
+        GLStateCache::get().useProgram(this->shaderProgram);
+    }
+
+    void Shader::reflectUniforms() {
+
+        this->uniforms = std::make_shared<UniformTable>();
+
+        GLint uniformCount = 0;
+        GLint maxNameLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORMS, &uniformCount);
+        glGetProgramiv(this->shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+        std::vector<GLchar> nameBuffer(maxNameLength > 0 ? maxNameLength : 1);
+
+        for (GLint i = 0; i < uniformCount; i++) {
+
+            Uniform uniform;
+            GLsizei nameLength = 0;
+            glGetActiveUniform(this->shaderProgram, (GLuint)i, (GLsizei)nameBuffer.size(), &nameLength,
+                &uniform.size, &uniform.type, nameBuffer.data());
+
+            std::string name(nameBuffer.data(), nameLength);
+            uniform.location = glGetUniformLocation(this->shaderProgram, name.c_str());
+
+            //uniforms inside blocks have no location
+            if (uniform.location < 0) {
+                continue;
+            }
+
+            //arrays are reported as "name[0]", the plain name leads to the same entry and value cache
+            size_t entry = this->uniforms->entries.size();
+            this->uniforms->entries.push_back(uniform);
+            if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+                this->uniforms->names[name.substr(0, name.size() - 3)] = entry;
+            }
+            this->uniforms->names[name] = entry;
+        }
+
+        //resolve the typed uniforms once, set<Id>() then only indexes this array
+        this->uniformsById = std::make_shared<std::vector<Uniform*>>((size_t)UniformId::Count, (Uniform*)NULL);
+        for (size_t id = 0; id < (size_t)UniformId::Count; id++) {
+            std::unordered_map<std::string, size_t>::iterator it = this->uniforms->names.find(uniformName((UniformId)id));
+            if (it != this->uniforms->names.end()) {
+                (*this->uniformsById)[id] = &this->uniforms->entries[it->second];
+            }
+        }
     }
 
+    //header of a cached program binary, followed by the key and the binary itself
+    struct ProgramCacheHeader {
+        char magic[4];
+        GLuint version;
+        GLenum binaryFormat;
+        GLint binaryLength;
+        GLuint keyLength;
+    };
+
+    static const GLuint PROGRAM_CACHE_VERSION = 1;
+
+    static unsigned int fnv1a(const std::string& text, unsigned int hash = 2166136261u) {
+
+        for (size_t i = 0; i < text.size(); i++) {
+            hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+        }
+        return hash;
+    }
+
+    //a binary is only valid for the exact sources and the driver that produced it
+    std::string Shader::programCacheKey(const std::string& vertexSource, const std::string& fragmentSource) {
+
+        const GLubyte* renderer = glGetString(GL_RENDERER);
+        const GLubyte* version = glGetString(GL_VERSION);
+
+        char sourceHashes[32];
+        snprintf(sourceHashes, sizeof(sourceHashes), "%08x|%08x", fnv1a(vertexSource), fnv1a(fragmentSource));
+
+        std::stringstream key;
+        key << (renderer ? (const char*)renderer : "") << "|"
+            << (version ? (const char*)version : "") << "|"
+            << vertexSource.size() << "|" << fragmentSource.size() << "|" << sourceHashes;
+        return key.str();
+    }
+
+    std::string Shader::programCachePath(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, const std::vector<std::string>& defines) {
+
+        //FNV-1a hash of the file names and defines, next to the vertex shader
+        unsigned int hash = fnv1a(fragmentShaderFileName, fnv1a(vertexShaderFileName));
+        for (size_t i = 0; i < defines.size(); i++) {
+            hash = fnv1a("#" + defines[i], hash);
+        }
+
+        size_t slash = vertexShaderFileName.find_last_of("/\\");
+        std::string directory = slash == std::string::npos ? std::string() : vertexShaderFileName.substr(0, slash + 1);
+
+        char name[32];
+        snprintf(name, sizeof(name), "program_%08x.cache", hash);
+        return directory + name;
+    }
+
+    bool Shader::loadProgramBinary(const std::string& cachePath, const std::string& key) {
+
+        GLint formatCount = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatCount);
+        if (formatCount <= 0) {
+            return false;
+        }
+
+        std::ifstream cacheFile(cachePath, std::ios::binary);
+        if (!cacheFile) {
+            return false;
+        }
+
+        ProgramCacheHeader header;
+        if (!cacheFile.read((char*)&header, sizeof(header))) {
+            return false;
+        }
+        if (memcmp(header.magic, "GPSP", 4) != 0 || header.version != PROGRAM_CACHE_VERSION || header.binaryLength <= 0) {
+            return false;
+        }
+
+        std::string cachedKey(header.keyLength, '\0');
+        if (!cacheFile.read(&cachedKey[0], header.keyLength) || cachedKey != key) {
+            return false;
+        }
+
+        std::vector<char> binary(header.binaryLength);
+        if (!cacheFile.read(binary.data(), header.binaryLength)) {
+            return false;
+        }
+
+        glProgramBinary(this->shaderProgram, header.binaryFormat, binary.data(), header.binaryLength);
+
+        //a driver update or a different GPU makes the binary unusable
+        GLint success = GL_FALSE;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        if (!success) {
+            std::cout << "[INFO] Cached program " << cachePath << " rejected, compiling from source" << std::endl;
+            return false;
+        }
+
+        return true;
+    }
+
+    void Shader::saveProgramBinary(const std::string& cachePath, const std::string& key) {
+
+        GLint success = GL_FALSE;
+        GLint binaryLength = 0;
+        glGetProgramiv(this->shaderProgram, GL_LINK_STATUS, &success);
+        glGetProgramiv(this->shaderProgram, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+        if (!success || binaryLength <= 0) {
+            return;
+        }
+
+        ProgramCacheHeader header;
+        memcpy(header.magic, "GPSP", 4);
+        header.version = PROGRAM_CACHE_VERSION;
+        header.keyLength = (GLuint)key.size();
+
+        std::vector<char> binary(binaryLength);
+        glGetProgramBinary(this->shaderProgram, binaryLength, &header.binaryLength, &header.binaryFormat, binary.data());
+        if (header.binaryLength <= 0) {
+            return;
+        }
+
+        std::ofstream cacheFile(cachePath, std::ios::binary);
+        if (!cacheFile) {
+            fprintf(stderr, "WARNING: could not write program cache %s\n", cachePath.c_str());
+            return;
+        }
+
+        cacheFile.write((const char*)&header, sizeof(header));
+        cacheFile.write(key.data(), key.size());
+        cacheFile.write(binary.data(), header.binaryLength);
+    }
+
+    void Shader::bindUniformBlocks() {
+
+        for (GLuint binding = 0; binding < sizeof(uniformBlockNames) / sizeof(uniformBlockNames[0]); binding++) {
+
+            GLuint blockIndex = glGetUniformBlockIndex(this->shaderProgram, uniformBlockNames[binding]);
+            if (blockIndex != GL_INVALID_INDEX) {
+                glUniformBlockBinding(this->shaderProgram, blockIndex, binding);
+            }
+        }
+    }
+
+    bool Shader::changedUniform(Uniform* uniform, const void* value, size_t bytes) {
+
+        if (uniform == NULL) {
+            return false;
+        }
+
+        if (uniform->value.size() == bytes && memcmp(uniform->value.data(), value, bytes) == 0) {
+            return false;
+        }
+
+        uniform->value.assign((const unsigned char*)value, (const unsigned char*)value + bytes);
+        return true;
+    }
+
+    void Shader::upload(Uniform* uniform, GLint value) {
+
+        if (changedUniform(uniform, &value, sizeof(value))) {
+            glProgramUniform1i(this->shaderProgram, uniform->location, value);
+        }
+    }
+
+    void Shader::upload(Uniform* uniform, GLfloat value) {
+
+        if (changedUniform(uniform, &value, sizeof(value))) {
+            glProgramUniform1f(this->shaderProgram, uniform->location, value);
+        }
+    }
+
+    void Shader::upload(Uniform* uniform, const glm::vec3& value) {
+
+        if (changedUniform(uniform, &value, sizeof(value))) {
+            glProgramUniform3fv(this->shaderProgram, uniform->location, 1, &value[0]);
+        }
+    }
+
+    void Shader::upload(Uniform* uniform, const glm::vec4& value) {
+
+        if (changedUniform(uniform, &value, sizeof(value))) {
+            glProgramUniform4fv(this->shaderProgram, uniform->location, 1, &value[0]);
+        }
+    }
+
+    void Shader::upload(Uniform* uniform, const glm::mat3& value) {
+
+        if (changedUniform(uniform, &value, sizeof(value))) {
+            glProgramUniformMatrix3fv(this->shaderProgram, uniform->location, 1, GL_FALSE, &value[0][0]);
+        }
+    }
+
+    void Shader::upload(Uniform* uniform, const glm::mat4& value) {
+
+        if (changedUniform(uniform, &value, sizeof(value))) {
+            glProgramUniformMatrix4fv(this->shaderProgram, uniform->location, 1, GL_FALSE, &value[0][0]);
+        }
+    }
+
+    bool ShaderBatch::isParallelCompileSupported() {
+
+#if defined (__APPLE__)
+        return false;
+#else
+        return GLEW_KHR_parallel_shader_compile == GL_TRUE;
+#endif
+    }
+
+    void ShaderBatch::add(Shader& shader, const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, const std::vector<std::string>& defines) {
+
+        if (this->total == 0) {
+
+            this->start = std::chrono::steady_clock::now();
+
+#if !defined (__APPLE__)
+            //let the driver pick how many compiler threads to use
+            if (isParallelCompileSupported()) {
+                glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+            }
+#endif
+        }
+
+        shader.beginLoad(vertexShaderFileName, fragmentShaderFileName, defines);
+        this->pending.push_back(&shader);
+        this->total++;
+    }
+
+    bool ShaderBatch::poll() {
+
+        for (size_t i = 0; i < this->pending.size(); ) {
+
+            if (this->pending[i]->isReady()) {
+
+                this->pending[i]->finishLoad();
+                this->pending.erase(this->pending.begin() + i);
+
+                //without the extension every check blocks, finish one program per poll so the caller keeps drawing
+                if (!isParallelCompileSupported()) {
+                    break;
+                }
+            }
+            else {
+                i++;
+            }
+        }
+
+        if (this->pending.empty()) {
+            this->end = std::chrono::steady_clock::now();
+            return true;
+        }
+        return false;
+    }
+
+    void ShaderBatch::finish() {
+
+        while (!poll()) {
+            std::this_thread::yield();
+        }
+    }
+
+    size_t ShaderBatch::getPendingCount() const {
+
+        return this->pending.size();
+    }
+
+    size_t ShaderBatch::getTotalCount() const {
+
+        return this->total;
+    }
+
+    double ShaderBatch::getElapsedSeconds() const {
+
+        std::chrono::steady_clock::time_point now = this->pending.empty() ? this->end : std::chrono::steady_clock::now();
+        return std::chrono::duration<double>(now - this->start).count();
+    }
 }
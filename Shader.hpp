@@ -17,9 +17,19 @@
     #include <GL/glew.h>
 #endif
 
+#include <glm/glm.hpp>
+
+#include "UniformBuffers.hpp"
+
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 namespace gps {
@@ -29,12 +39,104 @@ namespace gps {
     public:
         GLuint shaderProgram;
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
+        // Same as above, with a "#define <name>" injected into both stages for every entry
+        void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName, const std::vector<std::string>& defines);
         void useShaderProgram();
+
+        // Two-phase load used by ShaderBatch: beginLoad only submits the compiles and the link,
+        // finishLoad checks the results and should follow isReady() to avoid stalling
+        void beginLoad(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, const std::vector<std::string>& defines);
+        bool isReady();
+        void finishLoad();
+
+        // Setter for the uniforms declared in GPS_PROGRAM_UNIFORMS: the value type is checked
+        // at compile time and the location is an array lookup. The upload is skipped when the
+        // value did not change since the last set, and the program does not need to be bound.
+        template<UniformId Id>
+        void set(const typename UniformTraits<Id>::ValueType& value) {
+            upload(findUniform(Id), value);
+        }
     
     private:
+        struct Uniform {
+            GLint location;
+            GLenum type;
+            GLint size;
+            // last uploaded value, empty until the first set
+            std::vector<unsigned char> value;
+        };
+        struct UniformTable {
+            // one entry per active uniform
+            std::vector<Uniform> entries;
+            // index into entries by name, arrays are found as "name" and "name[0]"
+            std::unordered_map<std::string, size_t> names;
+        };
+
+        // shared so that copies of the shader see the same cached values
+        std::shared_ptr<UniformTable> uniforms;
+        // entries of the table indexed by UniformId, NULL for inactive uniforms
+        std::shared_ptr<std::vector<Uniform*>> uniformsById;
+
+        // state of a load between beginLoad and finishLoad, the shaders are 0 for a cached binary
+        GLuint pendingVertexShader = 0;
+        GLuint pendingFragmentShader = 0;
+        std::string pendingCachePath;
+        std::string pendingKey;
+
         std::string readShaderFile(std::string fileName);
+        std::string injectDefines(const std::string& source, const std::vector<std::string>& defines);
+        // Replaces "#include <Name>" lines with the generated layout declarations, or with the
+        // shared snippet include/Name.glsl next to the shader, each snippet once per shader
+        std::string resolveIncludes(const std::string& source, const std::string& fileName);
+        std::string resolveIncludes(const std::string& source, const std::string& fileName,
+            const std::string& includeDirectory, std::set<std::string>& included);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
+        void reflectUniforms();
+        void bindUniformBlocks();
+
+        // Program binary cache, keyed by the sources and the driver that produced the binary
+        std::string programCacheKey(const std::string& vertexSource, const std::string& fragmentSource);
+        std::string programCachePath(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, const std::vector<std::string>& defines);
+        bool loadProgramBinary(const std::string& cachePath, const std::string& key);
+        void saveProgramBinary(const std::string& cachePath, const std::string& key);
+        Uniform* findUniform(UniformId id) {
+            return this->uniformsById ? (*this->uniformsById)[(size_t)id] : NULL;
+        }
+        // true when the uniform is active and does not hold the value yet, which it then records
+        bool changedUniform(Uniform* uniform, const void* value, size_t bytes);
+        void upload(Uniform* uniform, GLint value);
+        void upload(Uniform* uniform, GLfloat value);
+        void upload(Uniform* uniform, const glm::vec3& value);
+        void upload(Uniform* uniform, const glm::vec4& value);
+        void upload(Uniform* uniform, const glm::mat3& value);
+        void upload(Uniform* uniform, const glm::mat4& value);
+    };
+
+    // Loads several programs together: every compile and link is submitted before any
+    // status is checked, so the driver can work on them in parallel
+    // (GL_KHR_parallel_shader_compile) and the caller can keep drawing while it does
+    class ShaderBatch {
+
+    public:
+        void add(Shader& shader, const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName,
+            const std::vector<std::string>& defines = std::vector<std::string>());
+        // Finishes the programs the driver is done with, true once all of them are
+        bool poll();
+        // Blocks until every program is finished
+        void finish();
+        size_t getPendingCount() const;
+        size_t getTotalCount() const;
+        // Wall time from the first add to the last finished program
+        double getElapsedSeconds() const;
+
+        static bool isParallelCompileSupported();
+
+    private:
+        std::vector<Shader*> pending;
+        size_t total = 0;
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point end;
     };
     
 }
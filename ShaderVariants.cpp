@@ -0,0 +1,70 @@
+#include "ShaderVariants.hpp"
+#include "GLStateCache.hpp"
+
+namespace gps {
+
+    static const char* shaderFeatureNames[SHADER_FEATURE_COUNT] = { "WIND", "FOG", "RAIN", "POINT_LIGHTS" };
+
+    std::vector<std::string> shaderFeatureDefines(unsigned int features) {
+
+        std::vector<std::string> defines;
+        for (int i = 0; i < SHADER_FEATURE_COUNT; i++) {
+            if (features & (1u << i)) {
+                defines.push_back(shaderFeatureNames[i]);
+            }
+        }
+        return defines;
+    }
+
+    void ShaderVariants::load(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, unsigned int featureMask) {
+
+        ShaderBatch batch;
+        load(vertexShaderFileName, fragmentShaderFileName, featureMask, batch);
+        batch.finish();
+    }
+
+    void ShaderVariants::load(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, unsigned int featureMask, ShaderBatch& batch) {
+
+        destroy();
+        this->featureMask = featureMask;
+
+        //walk every subset of the mask, down to the variant without any feature
+        unsigned int features = featureMask;
+        while (true) {
+
+            //std::map never moves its elements, the batch can keep pointers to them
+            batch.add(variants[features], vertexShaderFileName, fragmentShaderFileName, shaderFeatureDefines(features));
+
+            if (features == 0) {
+                break;
+            }
+            features = (features - 1) & featureMask;
+        }
+
+        std::cout << "[INFO] " << variants.size() << " variants of " << vertexShaderFileName << std::endl;
+    }
+
+    Shader& ShaderVariants::get(unsigned int features) {
+
+        return variants.at(features & featureMask);
+    }
+
+    unsigned int ShaderVariants::getFeatureMask() const {
+
+        return featureMask;
+    }
+
+    size_t ShaderVariants::getVariantCount() const {
+
+        return variants.size();
+    }
+
+    void ShaderVariants::destroy() {
+
+        for (std::map<unsigned int, Shader>::iterator it = variants.begin(); it != variants.end(); ++it) {
+            GLStateCache::get().deleteProgram(it->second.shaderProgram);
+        }
+        variants.clear();
+        featureMask = 0;
+    }
+}
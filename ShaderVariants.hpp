@@ -0,0 +1,45 @@
+#ifndef ShaderVariants_hpp
+#define ShaderVariants_hpp
+
+#include "Shader.hpp"
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Optional features compiled into a program with a #define of the same name
+    enum ShaderFeature {
+        SHADER_FEATURE_WIND = 1 << 0,
+        SHADER_FEATURE_FOG = 1 << 1,
+        SHADER_FEATURE_RAIN = 1 << 2,
+        SHADER_FEATURE_POINT_LIGHTS = 1 << 3
+    };
+
+    const int SHADER_FEATURE_COUNT = 4;
+
+    // Defines enabling the features set in the mask
+    std::vector<std::string> shaderFeatureDefines(unsigned int features);
+
+    // One specialized program per combination of the features a shader pair supports
+    class ShaderVariants {
+
+    public:
+        // Compiles every combination of the features in featureMask
+        void load(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, unsigned int featureMask);
+        // Same, the variants are only submitted to the batch and usable once it is finished
+        void load(const std::string& vertexShaderFileName, const std::string& fragmentShaderFileName, unsigned int featureMask, ShaderBatch& batch);
+        // Program for the enabled features, features the shaders do not support are ignored
+        Shader& get(unsigned int features);
+        unsigned int getFeatureMask() const;
+        size_t getVariantCount() const;
+        void destroy();
+
+    private:
+        unsigned int featureMask = 0;
+        std::map<unsigned int, Shader> variants;
+    };
+}
+
+#endif /* ShaderVariants_hpp */
@@ -0,0 +1,361 @@
+#include "ShadowCascades.hpp"
+#include "GpuMemory.hpp"
+#include "GLStateCache.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+
+namespace gps {
+
+    // share of a cascade cross-faded into the next one
+    static const float CASCADE_BLEND = 0.1f;
+
+    // depth bias of the lighting shader in SHADOW_BIAS_SHADER mode
+    static const float SHADER_BIAS = 0.005f;
+    // glPolygonOffset of SHADOW_BIAS_POLYGON_OFFSET mode
+    static const float OFFSET_FACTOR = 2.0f;
+    static const float OFFSET_UNITS = 4.0f;
+
+    static const char* biasModeNames[SHADOW_BIAS_MODE_COUNT] = {
+        "shader bias", "polygon offset", "front face culling"
+    };
+
+    static const char* filterNames[SHADOW_FILTER_COUNT] = {
+        "hardware", "rotated grid", "Poisson"
+    };
+
+    // taps of the Poisson disk in shaderStart.frag
+    static const int MAX_FILTER_TAPS = 16;
+
+    void ShadowCascades::createDepthArray(GLuint& depthTexture, GLuint& depthFramebuffer, bool compare) {
+
+        glGenTextures(1, &depthTexture);
+        GLStateCache::get().bindTexture(GL_TEXTURE_2D_ARRAY, depthTexture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24,
+            resolution, resolution, cascadeCount,
+            0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        GpuMemory::get().track(GPU_MEMORY_RENDER_TARGET, depthTexture,
+            GpuMemory::imageBytes(resolution, resolution, cascadeCount, 4, false));
+
+        // compared lookups come back bilinearly weighted, a 2x2 PCF for free
+        GLint filtering = compare ? GL_LINEAR : GL_NEAREST;
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, filtering);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, filtering);
+        if (compare) {
+
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+
+        glGenFramebuffers(1, &depthFramebuffer);
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, depthFramebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, depthTexture, 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+            fprintf(stderr, "ERROR: shadow cascade framebuffer is not complete\n");
+        }
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void ShadowCascades::init(int cascadeCount, int resolution) {
+
+        this->cascadeCount = cascadeCount < 1 ? 1 : (cascadeCount > MAX_SHADOW_CASCADES ? MAX_SHADOW_CASCADES : cascadeCount);
+
+        int layers = this->cascadeCount;
+        const QualitySettings& quality = GpuMemory::get().fit(GPU_MEMORY_RENDER_TARGET,
+            [resolution, layers](const QualitySettings& settings) {
+                int size = resolution > 0 ? resolution : settings.shadowMapSize;
+                // the sampled array and the static cache
+                return 2 * GpuMemory::imageBytes(size, size, layers, 4, false);
+            });
+        this->resolution = resolution > 0 ? resolution : quality.shadowMapSize;
+
+        // the cache is only ever blitted from
+        createDepthArray(texture, framebuffer, true);
+        createDepthArray(staticTexture, staticFramebuffer, false);
+
+        glGenSamplers(1, &depthSampler);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(depthSampler, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+        for (int i = 0; i < MAX_SHADOW_CASCADES; i++) {
+
+            matrices[i] = glm::mat4(1.0f);
+            splits[i] = 0.0f;
+            cacheValid[i] = false;
+            cacheAnimated[i] = false;
+            drawnDynamicCasters[i] = 0;
+        }
+
+        setupCasterMaterials();
+
+        std::cout << "[INFO] Shadows: " << this->cascadeCount << " cascades of " << this->resolution
+            << "x" << this->resolution << ", " << biasModeNames[biasMode] << std::endl;
+    }
+
+    void ShadowCascades::setupCasterMaterials() {
+
+        for (int i = 0; i < 2; i++) {
+
+            RenderMaterial& material = casterMaterials[i];
+            material.positionOnly = i == 0;
+            material.cullFace = biasMode == SHADOW_BIAS_FRONT_FACE_CULLING ? GL_FRONT : GL_NONE;
+            material.polygonOffsetFactor = biasMode == SHADOW_BIAS_POLYGON_OFFSET ? OFFSET_FACTOR : 0.0f;
+            material.polygonOffsetUnits = biasMode == SHADOW_BIAS_POLYGON_OFFSET ? OFFSET_UNITS : 0.0f;
+        }
+    }
+
+    void ShadowCascades::setShadowDistance(float distance) {
+
+        shadowDistance = distance;
+    }
+
+    void ShadowCascades::setSplitLambda(float lambda) {
+
+        splitLambda = lambda;
+    }
+
+    void ShadowCascades::setCasterDistance(float distance) {
+
+        casterDistance = distance;
+    }
+
+    void ShadowCascades::setBiasMode(ShadowBiasMode mode) {
+
+        biasMode = mode;
+        setupCasterMaterials();
+
+        for (int i = 0; i < MAX_SHADOW_CASCADES; i++) {
+            cacheValid[i] = false;
+        }
+        std::cout << "[INFO] Shadows: " << biasModeNames[biasMode] << std::endl;
+    }
+
+    ShadowBiasMode ShadowCascades::getBiasMode() const {
+
+        return biasMode;
+    }
+
+    void ShadowCascades::setFilter(ShadowFilter filter, int taps, float radius) {
+
+        this->filter = filter;
+        filterTaps = std::max(1, std::min(taps, MAX_FILTER_TAPS));
+        filterRadius = radius;
+
+        std::cout << "[INFO] Shadows: " << filterNames[filter] << " filter";
+        if (filter != SHADOW_FILTER_HARDWARE) {
+            std::cout << ", " << filterTaps << " taps over " << filterRadius << " texels";
+        }
+        std::cout << std::endl;
+    }
+
+    ShadowFilter ShadowCascades::getFilter() const {
+
+        return filter;
+    }
+
+    void ShadowCascades::update(const glm::mat4& view, float fovY, float aspect, float nearPlane, const glm::vec3& lightDirection) {
+
+        frames++;
+
+        glm::mat4 cameraToWorld = glm::inverse(view);
+        float tanHalfFov = std::tan(fovY * 0.5f);
+
+        glm::vec3 direction = glm::normalize(lightDirection);
+        glm::vec3 up = std::fabs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+
+        float sliceNear = nearPlane;
+        for (int i = 0; i < cascadeCount; i++) {
+
+            // practical split scheme: a blend of the uniform and the logarithmic split
+            float fraction = (float)(i + 1) / (float)cascadeCount;
+            float logarithmic = nearPlane * std::pow(shadowDistance / nearPlane, fraction);
+            float uniform = nearPlane + (shadowDistance - nearPlane) * fraction;
+            float sliceFar = splitLambda * logarithmic + (1.0f - splitLambda) * uniform;
+            splits[i] = sliceFar;
+
+            // corners of the slice, in world space
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (int c = 0; c < 8; c++) {
+
+                float depth = c < 4 ? sliceNear : sliceFar;
+                float x = (c & 1 ? 1.0f : -1.0f) * depth * tanHalfFov * aspect;
+                float y = (c & 2 ? 1.0f : -1.0f) * depth * tanHalfFov;
+                corners[c] = glm::vec3(cameraToWorld * glm::vec4(x, y, -depth, 1.0f));
+                center += corners[c] / 8.0f;
+            }
+
+            // the bounding sphere of a rigid slice does not change as the camera turns,
+            // rounding keeps float noise out of the projection size
+            float radius = 0.0f;
+            for (int c = 0; c < 8; c++) {
+                radius = std::max(radius, glm::length(corners[c] - center));
+            }
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            glm::mat4 lightView = glm::lookAt(center, center + direction, up);
+            glm::mat4 lightProjection = glm::ortho(-radius, radius, -radius, radius,
+                -radius - casterDistance, radius);
+
+            // move the projection so that the world origin lands on a texel corner,
+            // every other point then keeps its texel from frame to frame
+            glm::mat4 matrix = lightProjection * lightView;
+            glm::vec4 origin = matrix * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+            float texelScale = resolution * 0.5f;
+            float texelX = origin.x * texelScale;
+            float texelY = origin.y * texelScale;
+            lightProjection[3][0] += (std::floor(texelX + 0.5f) - texelX) / texelScale;
+            lightProjection[3][1] += (std::floor(texelY + 0.5f) - texelY) / texelScale;
+
+            matrices[i] = lightProjection * lightView;
+            sliceNear = sliceFar;
+        }
+    }
+
+    void ShadowCascades::fillUniforms(FrameUniforms& frame) const {
+
+        for (int i = 0; i < MAX_SHADOW_CASCADES; i++) {
+
+            frame.cascadeMatrices[i] = matrices[i];
+            frame.cascadeSplits[i] = i < cascadeCount ? splits[i] : 0.0f;
+        }
+        frame.cascadeCount = cascadeCount;
+        frame.cascadeBlend = CASCADE_BLEND;
+        frame.shadowBias = biasMode == SHADOW_BIAS_SHADER ? SHADER_BIAS : 0.0f;
+        frame.shadowFilter = filter;
+        frame.shadowFilterTaps = filterTaps;
+        frame.shadowFilterRadius = filterRadius;
+    }
+
+    const RenderMaterial* ShadowCascades::getCasterMaterial(bool animatedCasters) const {
+
+        return &casterMaterials[animatedCasters ? 1 : 0];
+    }
+
+    bool ShadowCascades::needsStaticPass(int cascade, bool animatedCasters) const {
+
+        return !cacheValid[cascade] || animatedCasters || cacheAnimated[cascade] ||
+            cachedMatrices[cascade] != matrices[cascade];
+    }
+
+    bool ShadowCascades::needsDynamicPass(int cascade, unsigned int dynamicCasters, bool dynamicCastersMoved) const {
+
+        return (dynamicCastersMoved && dynamicCasters > 0) || dynamicCasters != drawnDynamicCasters[cascade];
+    }
+
+    void ShadowCascades::beginStaticPass(int cascade, bool animatedCasters) {
+
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, staticFramebuffer);
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, cascade);
+        GLStateCache::get().viewport(0, 0, resolution, resolution);
+        GLStateCache::get().depthMask(GL_TRUE);
+        glClear(GL_DEPTH_BUFFER_BIT);
+
+        cacheValid[cascade] = true;
+        cacheAnimated[cascade] = animatedCasters;
+        cachedMatrices[cascade] = matrices[cascade];
+        staticPasses++;
+    }
+
+    void ShadowCascades::beginDynamicPass(int cascade, unsigned int dynamicCasters) {
+
+        GLStateCache& state = GLStateCache::get();
+
+        state.bindFramebuffer(GL_READ_FRAMEBUFFER, staticFramebuffer);
+        glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, cascade);
+        state.bindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffer);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0, cascade);
+        glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+
+        state.bindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        state.viewport(0, 0, resolution, resolution);
+
+        drawnDynamicCasters[cascade] = dynamicCasters;
+        dynamicPasses++;
+    }
+
+    int ShadowCascades::getCascadeCount() const {
+
+        return cascadeCount;
+    }
+
+    int ShadowCascades::getResolution() const {
+
+        return resolution;
+    }
+
+    const glm::mat4& ShadowCascades::getMatrix(int cascade) const {
+
+        return matrices[cascade];
+    }
+
+    GLuint ShadowCascades::getTexture() const {
+
+        return texture;
+    }
+
+    GLuint ShadowCascades::getDepthSampler() const {
+
+        return depthSampler;
+    }
+
+    void ShadowCascades::destroy() {
+
+        if (texture != 0) {
+
+            GpuMemory::get().release(GPU_MEMORY_RENDER_TARGET, texture);
+            GLStateCache::get().deleteTextures(1, &texture);
+            texture = 0;
+        }
+
+        if (staticTexture != 0) {
+
+            GpuMemory::get().release(GPU_MEMORY_RENDER_TARGET, staticTexture);
+            GLStateCache::get().deleteTextures(1, &staticTexture);
+            staticTexture = 0;
+        }
+
+        if (depthSampler != 0) {
+
+            glDeleteSamplers(1, &depthSampler);
+            depthSampler = 0;
+        }
+
+        GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (framebuffer != 0) {
+
+            GLStateCache::get().deleteFramebuffers(1, &framebuffer);
+            framebuffer = 0;
+        }
+        if (staticFramebuffer != 0) {
+
+            GLStateCache::get().deleteFramebuffers(1, &staticFramebuffer);
+            staticFramebuffer = 0;
+        }
+    }
+
+    void ShadowCascades::report() {
+
+        std::cout << "[INFO] Shadows: " << staticPasses << " static and " << dynamicPasses << " dynamic cascade updates in "
+            << frames << " frames (" << frames * cascadeCount << " without caching)" << std::endl;
+
+        frames = 0;
+        staticPasses = 0;
+        dynamicPasses = 0;
+    }
+}
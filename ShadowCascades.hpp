@@ -0,0 +1,149 @@
+#ifndef ShadowCascades_hpp
+#define ShadowCascades_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "RenderQueue.hpp"
+#include "UniformBuffers.hpp"
+
+namespace gps {
+
+    // How shadow acne is kept off lit surfaces
+    enum ShadowBiasMode {
+        // constant depth bias in the lighting shader
+        SHADOW_BIAS_SHADER,
+        // slope-scaled polygon offset while the casters are drawn
+        SHADOW_BIAS_POLYGON_OFFSET,
+        // only the back faces of the casters are drawn, needs closed meshes
+        SHADOW_BIAS_FRONT_FACE_CULLING,
+        SHADOW_BIAS_MODE_COUNT
+    };
+
+    // Percentage-closer filter of the shadow lookups, every tap is a hardware depth compare
+    // with bilinear weighting (values shared with shaderStart.frag)
+    enum ShadowFilter {
+        // a single compare tap
+        SHADOW_FILTER_HARDWARE,
+        // square grid rotated so that no two taps share a row or column
+        SHADOW_FILTER_ROTATED_GRID,
+        // Poisson disk turned per pixel, trading banding for noise
+        SHADOW_FILTER_POISSON,
+        SHADOW_FILTER_COUNT
+    };
+
+    // Cascaded shadow maps of the sun: the camera frustum up to the shadow distance is cut
+    // into slices, each covered by an orthographic light projection rendered into one
+    // layer of a depth texture array. Every cascade bounds its slice with a sphere, so its
+    // size does not change as the camera turns, and snaps to whole shadow map texels, so
+    // its edges do not shimmer as the camera moves.
+    //
+    // The static casters of every cascade are cached in a second array. A cascade is only
+    // drawn again when its matrix or the animated casters invalidate that cache, or when
+    // dynamic casters move in it; those are drawn over a copy of the cache.
+    //
+    // Casters are drawn with a material of their own: no textures, the depth bias as
+    // rasterizer state and, unless they are animated, the position-only geometry stream.
+    // The sampled array compares in hardware, lookups filter it with a PCF kernel.
+    class ShadowCascades {
+
+    public:
+        // Allocates the sampled and the cached depth arrays and their framebuffers, resolution
+        // 0 takes the shadow map size of the GPU memory quality tier
+        void init(int cascadeCount, int resolution);
+
+        // Distance from the camera where shadows end
+        void setShadowDistance(float distance);
+        // 0 splits the distance uniformly, 1 logarithmically
+        void setSplitLambda(float lambda);
+        // How far behind a slice, towards the sun, casters are still rendered
+        void setCasterDistance(float distance);
+        // Drops the cached casters, they were drawn with the previous bias
+        void setBiasMode(ShadowBiasMode mode);
+        ShadowBiasMode getBiasMode() const;
+        // Kernel of the lookups, taps up to 16 (the grid rounds them to a square) spread over
+        // radius texels
+        void setFilter(ShadowFilter filter, int taps, float radius);
+        ShadowFilter getFilter() const;
+
+        // Fits the cascades to the camera (perspective fovY and aspect, near plane) for light
+        // travelling along lightDirection
+        void update(const glm::mat4& view, float fovY, float aspect, float nearPlane, const glm::vec3& lightDirection);
+
+        // Writes the cascade matrices, splits, count and shader bias of the frame block
+        void fillUniforms(FrameUniforms& frame) const;
+
+        // Whether the static casters must be drawn again: the cascade moved since they were
+        // cached, or animated casters (wind) keep any cache stale
+        bool needsStaticPass(int cascade, bool animatedCasters) const;
+        // Whether the dynamic casters queued for the cascade change its map, they moved or
+        // some entered or left it
+        bool needsDynamicPass(int cascade, unsigned int dynamicCasters, bool dynamicCastersMoved) const;
+
+        // Material of the shadow passes, animated casters need the full vertex stream
+        const RenderMaterial* getCasterMaterial(bool animatedCasters) const;
+
+        // Binds the cleared cache layer of the cascade for the static casters
+        void beginStaticPass(int cascade, bool animatedCasters);
+        // Copies the cache layer into the sampled layer and binds that for the dynamic casters
+        void beginDynamicPass(int cascade, unsigned int dynamicCasters);
+
+        int getCascadeCount() const;
+        int getResolution() const;
+        const glm::mat4& getMatrix(int cascade) const;
+        // Sampled array, depth compare enabled
+        GLuint getTexture() const;
+        // Sampler object that reads the depths themselves from the array, for display
+        GLuint getDepthSampler() const;
+
+        void destroy();
+        // Cascade updates since the last report
+        void report();
+
+    private:
+        void createDepthArray(GLuint& depthTexture, GLuint& depthFramebuffer, bool compare);
+        void setupCasterMaterials();
+
+        int cascadeCount = 0;
+        int resolution = 0;
+        float shadowDistance = 300.0f;
+        float splitLambda = 0.75f;
+        float casterDistance = 400.0f;
+        ShadowBiasMode biasMode = SHADOW_BIAS_POLYGON_OFFSET;
+        ShadowFilter filter = SHADOW_FILTER_POISSON;
+        int filterTaps = 16;
+        float filterRadius = 1.5f;
+
+        // position-only and full vertex stream
+        RenderMaterial casterMaterials[2];
+
+        GLuint texture = 0;
+        GLuint framebuffer = 0;
+        GLuint staticTexture = 0;
+        GLuint staticFramebuffer = 0;
+        GLuint depthSampler = 0;
+
+        glm::mat4 matrices[MAX_SHADOW_CASCADES];
+        // view space distance where every cascade ends
+        float splits[MAX_SHADOW_CASCADES];
+
+        // what the cache layers and the sampled layers were drawn with
+        bool cacheValid[MAX_SHADOW_CASCADES];
+        bool cacheAnimated[MAX_SHADOW_CASCADES];
+        glm::mat4 cachedMatrices[MAX_SHADOW_CASCADES];
+        unsigned int drawnDynamicCasters[MAX_SHADOW_CASCADES];
+
+        unsigned int frames = 0;
+        unsigned int staticPasses = 0;
+        unsigned int dynamicPasses = 0;
+    };
+}
+
+#endif /* ShadowCascades_hpp */
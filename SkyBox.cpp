@@ -12,69 +12,338 @@ namespace gps {
     
     SkyBox::SkyBox()
     {
+        skyboxVAO = 0;
+        skyboxVBO = 0;
+        activeIndex = 0;
+        nextIndex = 0;
+        fadeDuration = 0.0f;
+        fadeProgress = 1.0f;
         
+        material.depthFunc = GL_LEQUAL;
+        material.bind = [this](gps::Shader& shader) { BindMaterial(shader); };
     }
     
-    void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
+    int SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
     {
-        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces);
-        InitSkyBox();
+        cubemapTextures.push_back(LoadSkyBoxTextures(cubeMapFaces));
+        
+        //the cube geometry is shared by every cubemap
+        if (skyboxVAO == 0)
+            InitSkyBox();
+        
+        return (int)cubemapTextures.size() - 1;
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::SetActive(int index, float fadeSeconds)
     {
-        shader.useShaderProgram();
+        if (index < 0 || index >= (int)cubemapTextures.size())
+            return;
+        
+        //toggling back mid-fade reverses the fade from where it is
+        if (fadeProgress < 1.0f && index == activeIndex && fadeSeconds > 0.0f)
+        {
+            activeIndex = nextIndex;
+            nextIndex = index;
+            fadeDuration = fadeSeconds;
+            fadeProgress = 1.0f - fadeProgress;
+            return;
+        }
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
+        nextIndex = index;
+        fadeDuration = fadeSeconds;
+        fadeProgress = 0.0f;
         
-        glDepthFunc(GL_LEQUAL);
+        if (fadeSeconds <= 0.0f || index == activeIndex)
+        {
+            activeIndex = index;
+            fadeProgress = 1.0f;
+        }
+    }
+    
+    void SkyBox::Update(float deltaTime)
+    {
+        if (fadeProgress >= 1.0f)
+            return;
         
-        glBindVertexArray(skyboxVAO);
-        glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
-        glBindVertexArray(0);
+        fadeProgress += deltaTime / fadeDuration;
         
-        glDepthFunc(GL_LESS);
+        if (fadeProgress >= 1.0f)
+        {
+            activeIndex = nextIndex;
+            fadeProgress = 1.0f;
+        }
+    }
+    
+    void SkyBox::Submit(gps::RenderQueue& queue, gps::Shader& shader)
+    {
+        if (cubemapTextures.empty())
+            return;
+        
+        gps::DrawPacket packet;
+        packet.shader = &shader;
+        packet.material = &material;
+        packet.vertexArray = skyboxVAO;
+        packet.mode = GL_TRIANGLES;
+        packet.count = 36;
+        packet.indexed = false;
+        
+        //the cube follows the camera, its depth does not matter
+        queue.submit(gps::RENDER_PASS_SKY, packet, glm::vec3(0.0f));
+    }
+    
+    void SkyBox::BindMaterial(gps::Shader& shader)
+    {
+        shader.set<gps::UniformId::skybox>(0);
+        GLStateCache::get().bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemapTextures[activeIndex]);
+        shader.set<gps::UniformId::skyboxNext>(1);
+        GLStateCache::get().bindTexture(1, GL_TEXTURE_CUBE_MAP, cubemapTextures[nextIndex]);
+        shader.set<gps::UniformId::blendFactor>(fadeProgress < 1.0f ? fadeProgress : 0.0f);
     }
     
+    //header of the compressed cubemap cache, followed by the key and the six face images
+    struct CubeMapCacheHeader
+    {
+        char magic[4];
+        GLuint version;
+        GLenum internalFormat;
+        GLint width;
+        GLint height;
+        GLint faceSizes[6];
+        GLuint keyLength;
+    };
+    
+    static const GLuint CUBEMAP_CACHE_VERSION = 1;
+    
     GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
     {
         GLuint textureID;
         glGenTextures(1, &textureID);
-        glActiveTexture(GL_TEXTURE0);
+        GLStateCache::get().activeTexture(GL_TEXTURE0);
+        GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
         
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
+        std::string key = CacheKey(skyBoxFaces);
+        std::string cachePath = CachePath(skyBoxFaces);
+        size_t bytes = 0;
         
-        glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
+        if (!LoadCachedCubeMap(textureID, cachePath, key, bytes))
         {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
+            //only the headers are read here, the faces are decoded concurrently by the upload workers
+            int widths[6], heights[6], n;
+            for (GLuint i = 0; i < skyBoxFaces.size(); i++)
+            {
+                if (!stbi_info(skyBoxFaces[i], &widths[i], &heights[i], &n)) {
+                    fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
+                    GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+                    GLStateCache::get().deleteTextures(1, &textureID);
+                    return 0;
+                }
+            }
+            
+            //let the driver block-compress the faces once, the result is cached on disk
+#if defined (__APPLE__)
+            bool compress = false;
+#else
+            bool compress = GLEW_EXT_texture_compression_s3tc == GL_TRUE;
+#endif
+            GLenum internalFormat = compress ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8;
+            
+            for (GLuint i = 0; i < skyBoxFaces.size(); i++)
+            {
+                glTexImage2D(
+                             GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
+                             internalFormat, widths[i], heights[i], 0, GL_RGB, GL_UNSIGNED_BYTE, NULL
+                             );
+                
+                GLint faceSize = 0;
+                if (compress)
+                    glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &faceSize);
+                bytes += compress ? (size_t)faceSize : GpuMemory::imageBytes(widths[i], heights[i], 1, 4, false);
+            }
+            
+            std::shared_ptr<int> remainingFaces = std::make_shared<int>((int)skyBoxFaces.size());
+            std::shared_ptr<bool> allFilled = std::make_shared<bool>(true);
+            
+            for (GLuint i = 0; i < skyBoxFaces.size(); i++)
+            {
+                std::string fileName = skyBoxFaces[i];
+                size_t faceBytes = (size_t)widths[i] * heights[i] * 3;
+                int width = widths[i];
+                int height = heights[i];
+                
+                TextureUploader::FillFunction fill = [fileName, faceBytes](unsigned char* staging)
+                {
+                    int x, y, channels;
+                    int force_channels = 3;
+                    unsigned char* image = stbi_load(fileName.c_str(), &x, &y, &channels, force_channels);
+                    if (!image) {
+                        fprintf(stderr, "ERROR: could not load %s\n", fileName.c_str());
+                        return false;
+                    }
+                    memcpy(staging, image, std::min(faceBytes, (size_t)x * y * 3));
+                    stbi_image_free(image);
+                    return true;
+                };
+                
+                TextureUploader::SubmitFunction submit = [this, textureID, i, width, height, compress, cachePath, key, remainingFaces, allFilled](const void* pixels, bool filled)
+                {
+                    GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+                    if (filled)
+                    {
+                        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+                        glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, 0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels);
+                        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+                    }
+                    *allFilled = *allFilled && filled;
+                    
+                    if (--*remainingFaces == 0 && compress && *allFilled)
+                        SaveCachedCubeMap(cachePath, key);
+                    GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+                };
+                
+                TextureUploader::get().enqueue(faceBytes, fill, submit);
             }
-            glTexImage2D(
-                         GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-                         );
         }
+        
+        GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-        glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        
+        GpuMemory::get().track(GPU_MEMORY_TEXTURE, textureID, bytes);
         
         return textureID;
     }
     
+    //the key changes whenever a face file is replaced, so a stale cache is never used
+    std::string SkyBox::CacheKey(std::vector<const GLchar*> skyBoxFaces)
+    {
+        std::stringstream key;
+        for (GLuint i = 0; i < skyBoxFaces.size(); i++)
+        {
+            struct stat info;
+            key << skyBoxFaces[i];
+            if (stat(skyBoxFaces[i], &info) == 0)
+                key << "|" << (long long)info.st_size << "|" << (long long)info.st_mtime;
+            key << ";";
+        }
+        return key.str();
+    }
+    
+    std::string SkyBox::CachePath(std::vector<const GLchar*> skyBoxFaces)
+    {
+        //FNV-1a hash of the face names, next to the first face
+        unsigned int hash = 2166136261u;
+        for (GLuint i = 0; i < skyBoxFaces.size(); i++)
+        {
+            for (const GLchar* c = skyBoxFaces[i]; *c; c++)
+                hash = (hash ^ (unsigned char)*c) * 16777619u;
+        }
+        
+        std::string directory = skyBoxFaces.empty() ? std::string() : std::string(skyBoxFaces[0]);
+        size_t slash = directory.find_last_of("/\\");
+        directory = slash == std::string::npos ? std::string() : directory.substr(0, slash + 1);
+        
+        char name[32];
+        snprintf(name, sizeof(name), "cubemap_%08x.cache", hash);
+        return directory + name;
+    }
+    
+    bool SkyBox::LoadCachedCubeMap(GLuint textureID, const std::string& cachePath, const std::string& key, size_t& bytes)
+    {
+        std::ifstream cacheFile(cachePath, std::ios::binary);
+        if (!cacheFile)
+            return false;
+        
+        CubeMapCacheHeader header;
+        if (!cacheFile.read((char*)&header, sizeof(header)))
+            return false;
+        if (memcmp(header.magic, "GPSC", 4) != 0 || header.version != CUBEMAP_CACHE_VERSION)
+            return false;
+        
+        std::string cachedKey(header.keyLength, '\0');
+        if (!cacheFile.read(&cachedKey[0], header.keyLength) || cachedKey != key)
+            return false;
+        
+        size_t offset = sizeof(header) + header.keyLength;
+        size_t faceBytes = 0;
+        for (int i = 0; i < 6; i++)
+            faceBytes += header.faceSizes[i];
+        
+        cacheFile.seekg(0, std::ios::end);
+        if ((size_t)cacheFile.tellg() != offset + faceBytes)
+            return false;
+        
+        //the six faces are streamed with one read straight into the staging buffer
+        TextureUploader::FillFunction fill = [cachePath, offset, faceBytes](unsigned char* staging)
+        {
+            std::ifstream cacheFile(cachePath, std::ios::binary);
+            cacheFile.seekg(offset);
+            return (bool)cacheFile.read((char*)staging, faceBytes);
+        };
+        
+        TextureUploader::SubmitFunction submit = [textureID, header](const void* pixels, bool filled)
+        {
+            if (!filled)
+                return;
+            
+            GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+            uintptr_t faceOffset = (uintptr_t)pixels;
+            for (GLuint i = 0; i < 6; i++)
+            {
+                glCompressedTexImage2D(
+                                       GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
+                                       header.internalFormat, header.width, header.height, 0,
+                                       header.faceSizes[i], (const void*)faceOffset
+                                       );
+                faceOffset += header.faceSizes[i];
+            }
+            GLStateCache::get().bindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        };
+        
+        TextureUploader::get().enqueue(faceBytes, fill, submit);
+        
+        bytes = faceBytes;
+        return true;
+    }
+    
+    void SkyBox::SaveCachedCubeMap(const std::string& cachePath, const std::string& key)
+    {
+        GLint compressed = GL_FALSE;
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_COMPRESSED, &compressed);
+        if (compressed != GL_TRUE)
+            return;
+        
+        CubeMapCacheHeader header;
+        memcpy(header.magic, "GPSC", 4);
+        header.version = CUBEMAP_CACHE_VERSION;
+        header.keyLength = (GLuint)key.size();
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_INTERNAL_FORMAT, (GLint*)&header.internalFormat);
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &header.width);
+        glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_HEIGHT, &header.height);
+        
+        std::vector<std::vector<char>> faces(6);
+        for (GLuint i = 0; i < 6; i++)
+        {
+            glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &header.faceSizes[i]);
+            faces[i].resize(header.faceSizes[i]);
+            glGetCompressedTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, faces[i].data());
+        }
+        
+        std::ofstream cacheFile(cachePath, std::ios::binary);
+        if (!cacheFile) {
+            fprintf(stderr, "WARNING: could not write cubemap cache %s\n", cachePath.c_str());
+            return;
+        }
+        
+        cacheFile.write((const char*)&header, sizeof(header));
+        cacheFile.write(key.data(), key.size());
+        for (GLuint i = 0; i < 6; i++)
+            cacheFile.write(faces[i].data(), faces[i].size());
+    }
+    
     void SkyBox::InitSkyBox()
     {
         GLfloat skyboxVertices[] = {
@@ -124,18 +393,36 @@ namespace gps {
         glGenVertexArrays(1, &(this->skyboxVAO));
         glGenBuffers(1, &skyboxVBO);
         
-        glBindVertexArray(skyboxVAO);
+        GLStateCache::get().bindVertexArray(skyboxVAO);
         glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
+        GpuMemory::get().track(GPU_MEMORY_BUFFER, skyboxVBO, sizeof(skyboxVertices));
         
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat), (GLvoid*)0);
+        //the cube is a plain list of positions
+        static_assert(sizeof(PositionVertex) == 3 * sizeof(GLfloat), "skybox vertices are packed positions");
+        PositionVertex::setupAttributes();
+        
+        GLStateCache::get().bindVertexArray(0);
+    }
+    
+    void SkyBox::Destroy()
+    {
+        for (size_t i = 0; i < cubemapTextures.size(); i++)
+        {
+            GpuMemory::get().release(GPU_MEMORY_TEXTURE, cubemapTextures[i]);
+            GLStateCache::get().deleteTextures(1, &cubemapTextures[i]);
+        }
+        cubemapTextures.clear();
         
-        glBindVertexArray(0);
+        GpuMemory::get().release(GPU_MEMORY_BUFFER, skyboxVBO);
+        glDeleteBuffers(1, &skyboxVBO);
+        GLStateCache::get().deleteVertexArrays(1, &skyboxVAO);
+        skyboxVBO = 0;
+        skyboxVAO = 0;
     }
     
     GLuint SkyBox::GetTextureId()
     {
-        return cubemapTexture;
+        return cubemapTextures.empty() ? 0 : cubemapTextures[activeIndex];
     }
 }
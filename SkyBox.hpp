@@ -11,27 +11,58 @@
 
 
 #include "Shader.hpp"
+#include "GpuMemory.hpp"
+#include "TextureUploader.hpp"
+#include "GLStateCache.hpp"
+#include "Layouts.hpp"
+#include "RenderQueue.hpp"
 #include "stb_image.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 #include <vector>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <stdio.h>
+#include <sys/stat.h>
 
 namespace gps {
     class SkyBox
     {
     public:
         SkyBox();
-        void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        //loads a cubemap and keeps it resident, returns its index for SetActive
+        int Load(std::vector<const GLchar*> cubeMapFaces);
+        //switches to a resident cubemap, crossfading over fadeSeconds (0 switches at once)
+        void SetActive(int index, float fadeSeconds);
+        void Update(float deltaTime);
+        //queues the cube in the sky pass, after the opaque geometry,
+        //view and projection come from the shared FrameBlock
+        void Submit(gps::RenderQueue& queue, gps::Shader& shader);
+        void Destroy();
         GLuint GetTextureId();
     private:
         GLuint skyboxVAO;
         GLuint skyboxVBO;
-        GLuint cubemapTexture;
+        std::vector<GLuint> cubemapTextures;
+        //cubemap shown, and the one faded towards while fadeProgress < 1
+        int activeIndex;
+        int nextIndex;
+        float fadeDuration;
+        float fadeProgress;
+        //cubemaps and blend factor, drawn with GL_LEQUAL to pass at the far plane
+        gps::RenderMaterial material;
+        void BindMaterial(gps::Shader& shader);
         GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        //compressed cubemap cache on disk, read back into the bound cubemap
+        std::string CacheKey(std::vector<const GLchar*> cubeMapFaces);
+        std::string CachePath(std::vector<const GLchar*> cubeMapFaces);
+        bool LoadCachedCubeMap(GLuint textureID, const std::string& cachePath, const std::string& key, size_t& bytes);
+        void SaveCachedCubeMap(const std::string& cachePath, const std::string& key);
         void InitSkyBox();
     };
 }
@@ -0,0 +1,269 @@
+#include "TextureUploader.hpp"
+#include "GpuMemory.hpp"
+
+#include <chrono>
+#include <iostream>
+
+namespace gps {
+
+    // Blocks until the GPU has passed the fence, false if the wait failed
+    static bool waitFence(GLsync fence) {
+
+        const GLuint64 oneSecond = 1000000000;
+        GLenum status;
+
+        do {
+
+            status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, oneSecond);
+        } while (status == GL_TIMEOUT_EXPIRED);
+
+        return status != GL_WAIT_FAILED;
+    }
+
+    TextureUploader& TextureUploader::get() {
+
+        static TextureUploader instance;
+        return instance;
+    }
+
+    TextureUploader::TextureUploader() {
+
+        setRingSize(6);
+    }
+
+    void TextureUploader::setRingSize(int slotCount) {
+
+        flush();
+        releaseBuffers();
+
+        slots.clear();
+        slots.resize(slotCount > 0 ? slotCount : 1);
+
+        for (size_t i = 0; i < slots.size(); i++) {
+
+            slots[i].pbo = 0;
+            slots[i].capacity = 0;
+            slots[i].state = SLOT_FREE;
+            slots[i].fence = 0;
+        }
+    }
+
+    void TextureUploader::enqueue(size_t bytes, FillFunction fill, SubmitFunction submit) {
+
+        Request request;
+        request.bytes = bytes;
+        request.fill = fill;
+        request.submit = submit;
+        pending.push_back(request);
+
+        startPending();
+    }
+
+    void TextureUploader::pump() {
+
+        retireFences(false);
+        submitFilled(false);
+        startPending();
+
+        // staging memory is only needed while loading
+        bool inFlight = false;
+        for (size_t i = 0; i < slots.size(); i++) {
+
+            inFlight = inFlight || slots[i].state != SLOT_FREE;
+        }
+
+        if (pending.empty() && !inFlight) {
+
+            releaseBuffers();
+        }
+    }
+
+    void TextureUploader::flush() {
+
+        while (!isIdle()) {
+
+            submitFilled(true);
+            retireFences(false);
+
+            // every slot busy with the GPU, wait for one upload to retire
+            bool freeSlot = false;
+            for (size_t i = 0; i < slots.size(); i++) {
+
+                freeSlot = freeSlot || slots[i].state == SLOT_FREE;
+            }
+
+            if (!pending.empty() && !freeSlot) {
+
+                retireFences(true);
+            }
+
+            startPending();
+        }
+    }
+
+    bool TextureUploader::isIdle() const {
+
+        if (!pending.empty()) {
+
+            return false;
+        }
+
+        for (size_t i = 0; i < slots.size(); i++) {
+
+            if (slots[i].state == SLOT_FILLING) {
+
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Frees the slots whose uploads the GPU has finished reading
+    void TextureUploader::retireFences(bool wait) {
+
+        for (size_t i = 0; i < slots.size(); i++) {
+
+            Slot& slot = slots[i];
+
+            if (slot.state != SLOT_IN_FLIGHT) {
+
+                continue;
+            }
+
+            if (wait ? waitFence(slot.fence) : (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0) != GL_TIMEOUT_EXPIRED)) {
+
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+                slot.state = SLOT_FREE;
+
+                if (wait) {
+
+                    return;
+                }
+            }
+        }
+    }
+
+    // Unmaps the PBOs the workers are done with and issues their texture updates
+    void TextureUploader::submitFilled(bool wait) {
+
+        for (size_t i = 0; i < slots.size(); i++) {
+
+            Slot& slot = slots[i];
+
+            if (slot.state != SLOT_FILLING) {
+
+                continue;
+            }
+
+            if (!wait && slot.job.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+
+                continue;
+            }
+
+            bool filled = slot.job.get();
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) != GL_TRUE) {
+
+                std::cerr << "[ERROR] Texture upload staging buffer was corrupted" << std::endl;
+                filled = false;
+            }
+
+            slot.request.submit((const void*)0, filled);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.state = SLOT_IN_FLIGHT;
+            slot.request = Request();
+        }
+    }
+
+    // Maps a free PBO for each waiting request and hands it to a worker
+    void TextureUploader::startPending() {
+
+        for (size_t i = 0; i < slots.size() && !pending.empty(); i++) {
+
+            Slot& slot = slots[i];
+
+            if (slot.state != SLOT_FREE) {
+
+                continue;
+            }
+
+            slot.request = pending.front();
+            pending.pop_front();
+
+            if (slot.pbo == 0) {
+
+                glGenBuffers(1, &slot.pbo);
+            }
+
+            // orphan the previous storage, growing it when the request is larger
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.pbo);
+            if (slot.request.bytes > slot.capacity) {
+
+                slot.capacity = slot.request.bytes;
+            }
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.capacity, NULL, GL_STREAM_DRAW);
+            GpuMemory::get().track(GPU_MEMORY_BUFFER, slot.pbo, slot.capacity);
+
+            unsigned char* staging = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot.request.bytes,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+            FillFunction fill = slot.request.fill;
+            if (staging) {
+
+                slot.job = std::async(std::launch::async, [fill, staging]() { return fill(staging); });
+            }
+            else {
+
+                std::cerr << "[ERROR] Could not map a texture upload staging buffer" << std::endl;
+                std::promise<bool> failed;
+                failed.set_value(false);
+                slot.job = failed.get_future();
+            }
+
+            slot.state = SLOT_FILLING;
+        }
+    }
+
+    void TextureUploader::releaseBuffers() {
+
+        for (size_t i = 0; i < slots.size(); i++) {
+
+            Slot& slot = slots[i];
+
+            if (slot.state == SLOT_FILLING) {
+
+                continue;
+            }
+
+            if (slot.fence) {
+
+                waitFence(slot.fence);
+                glDeleteSync(slot.fence);
+                slot.fence = 0;
+            }
+
+            if (slot.pbo) {
+
+                GpuMemory::get().release(GPU_MEMORY_BUFFER, slot.pbo);
+                glDeleteBuffers(1, &slot.pbo);
+                slot.pbo = 0;
+            }
+
+            slot.capacity = 0;
+            slot.state = SLOT_FREE;
+        }
+    }
+
+    void TextureUploader::destroy() {
+
+        flush();
+        releaseBuffers();
+        pending.clear();
+    }
+}
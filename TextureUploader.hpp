@@ -0,0 +1,76 @@
+#ifndef TextureUploader_hpp
+#define TextureUploader_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <vector>
+
+namespace gps {
+
+    // Streams texture data to the GPU through a ring of pixel buffer objects.
+    // Pixels are written into the mapped PBOs by worker threads, the texture updates
+    // are then issued from the PBOs on the render thread and fenced so a PBO is only
+    // reused once the GPU has consumed it.
+    class TextureUploader {
+
+    public:
+        // Runs on a worker thread, writes the pixels into `staging`; returns false on failure
+        typedef std::function<bool(unsigned char* staging)> FillFunction;
+        // Runs on the render thread with the PBO bound to GL_PIXEL_UNPACK_BUFFER,
+        // `pixels` is the offset to hand to glTex(Sub)Image; `filled` is the fill result
+        typedef std::function<void(const void* pixels, bool filled)> SubmitFunction;
+
+        static TextureUploader& get();
+
+        void setRingSize(int slots);
+        void enqueue(size_t bytes, FillFunction fill, SubmitFunction submit);
+
+        // Advances the queue without blocking, called on the render thread once per frame
+        void pump();
+        // Blocks until every queued upload has been submitted
+        void flush();
+        bool isIdle() const;
+
+        void destroy();
+
+    private:
+        enum SlotState { SLOT_FREE, SLOT_FILLING, SLOT_IN_FLIGHT };
+
+        struct Request {
+            size_t bytes;
+            FillFunction fill;
+            SubmitFunction submit;
+        };
+
+        struct Slot {
+            GLuint pbo;
+            size_t capacity;
+            SlotState state;
+            GLsync fence;
+            Request request;
+            std::future<bool> job;
+        };
+
+        TextureUploader();
+
+        void retireFences(bool wait);
+        void submitFilled(bool wait);
+        void startPending();
+        void releaseBuffers();
+
+        std::vector<Slot> slots;
+        std::deque<Request> pending;
+    };
+}
+
+#endif /* TextureUploader_hpp */
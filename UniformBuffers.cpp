@@ -0,0 +1,50 @@
+#include "UniformBuffers.hpp"
+#include "GpuMemory.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+    const char* uniformBlockNames[3] = { FrameUniforms::blockName(), LightUniforms::blockName(), MaterialUniforms::blockName() };
+
+    void UniformBuffers::init() {
+
+        GLint alignment = 256;
+        glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+        // the light block starts at the first aligned offset after the frame block
+        lightOffset = ((sizeof(FrameUniforms) + alignment - 1) / alignment) * alignment;
+        bufferSize = lightOffset + sizeof(LightUniforms);
+        staging.assign(bufferSize, 0);
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, bufferSize, NULL, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        GpuMemory::get().track(GPU_MEMORY_BUFFER, buffer, bufferSize);
+
+        glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_BLOCK_BINDING, buffer, 0, sizeof(FrameUniforms));
+        glBindBufferRange(GL_UNIFORM_BUFFER, LIGHT_BLOCK_BINDING, buffer, lightOffset, sizeof(LightUniforms));
+    }
+
+    void UniformBuffers::update(const FrameUniforms& frame, const LightUniforms& lights) {
+
+        memcpy(staging.data(), &frame, sizeof(frame));
+        memcpy(staging.data() + lightOffset, &lights, sizeof(lights));
+
+        // respecifying the storage orphans last frame's copy instead of waiting on it
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferData(GL_UNIFORM_BUFFER, bufferSize, staging.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    }
+
+    void UniformBuffers::destroy() {
+
+        if (buffer) {
+
+            GpuMemory::get().release(GPU_MEMORY_BUFFER, buffer);
+            glDeleteBuffers(1, &buffer);
+            buffer = 0;
+        }
+    }
+}
@@ -0,0 +1,125 @@
+#ifndef UniformBuffers_hpp
+#define UniformBuffers_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+#include <glm/glm.hpp>
+
+#include "Layouts.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Binding points of the uniform blocks shared by every program
+    enum UniformBlockBinding { FRAME_BLOCK_BINDING = 0, LIGHT_BLOCK_BINDING = 1, MATERIAL_BLOCK_BINDING = 2 };
+
+    // point lights live in buffer textures, binned per froxel (see LightClusters)
+    const int MAX_POINT_LIGHTS = 4096;
+    const int MAX_MATERIALS = 1024;
+    const int MAX_SHADOW_CASCADES = 4;
+
+    // Per-frame state, shared by every program (shaders: #include <FrameBlock>)
+#define GPS_FRAME_BLOCK(MEMBER, ARRAY) \
+    MEMBER(glm::mat4, view) \
+    MEMBER(glm::mat4, projection) \
+    /* deferred lighting rebuilds positions from the G-buffer depth */ \
+    MEMBER(glm::mat4, inverseView) \
+    MEMBER(glm::mat4, inverseProjection) \
+    /* world to shadow map clip space of every cascade */ \
+    ARRAY(glm::mat4, cascadeMatrices, MAX_SHADOW_CASCADES) \
+    /* view space distance where each cascade ends */ \
+    MEMBER(glm::vec4, cascadeSplits) \
+    MEMBER(glm::vec4, lightDir) \
+    /* rgb = sun color, a = brightness */ \
+    MEMBER(glm::vec4, lightColor) \
+    MEMBER(glm::vec4, fogColor) \
+    MEMBER(GLfloat, fogDensity) \
+    MEMBER(GLfloat, time) \
+    MEMBER(GLfloat, thunderBrightness) \
+    MEMBER(GLint, cascadeCount) \
+    /* fraction of a cascade blended into the next one */ \
+    MEMBER(GLfloat, cascadeBlend) \
+    /* depth bias of the shadow lookups, 0 when the casters carry it */ \
+    MEMBER(GLfloat, shadowBias) \
+    /* PCF kernel (ShadowFilter), its taps and radius in shadow map texels */ \
+    MEMBER(GLint, shadowFilter) \
+    MEMBER(GLint, shadowFilterTaps) \
+    MEMBER(GLfloat, shadowFilterRadius)
+
+    // Point light terms and the froxel grid they are binned into (shaders: #include <LightBlock>)
+#define GPS_LIGHT_BLOCK(MEMBER, ARRAY) \
+    /* x = ambient, y = diffuse, z = specular */ \
+    MEMBER(glm::vec4, pointLightTerms) \
+    /* x = constant, y = linear, z = quadratic */ \
+    MEMBER(glm::vec4, attenuation) \
+    /* froxel columns, rows and depth slices */ \
+    MEMBER(glm::ivec4, clusterCounts) \
+    /* x, y = pixels per froxel column and row, slice = log(depth) * z + w */ \
+    MEMBER(glm::vec4, clusterScales) \
+    MEMBER(GLint, numPointLights)
+
+    // Texture array layers of a model's materials (shaders: #include <MaterialBlock>)
+#define GPS_MATERIAL_BLOCK(MEMBER, ARRAY) \
+    /* x = diffuse layer, y = specular layer */ \
+    ARRAY(glm::ivec4, materialLayers, MAX_MATERIALS)
+
+    GPS_DECLARE_UNIFORM_BLOCK(FrameUniforms, FrameBlock, GPS_FRAME_BLOCK)
+    GPS_DECLARE_UNIFORM_BLOCK(LightUniforms, LightBlock, GPS_LIGHT_BLOCK)
+    GPS_DECLARE_UNIFORM_BLOCK(MaterialUniforms, MaterialBlock, GPS_MATERIAL_BLOCK)
+
+    // Uniforms set per draw, outside of any block (shaders: #include <ProgramUniforms>).
+    // Programs declare all of them, the ones a program does not use are simply inactive.
+#define GPS_PROGRAM_UNIFORMS(UNIFORM, SAMPLER) \
+    UNIFORM(glm::mat4, model) \
+    UNIFORM(glm::mat3, normalMatrix) \
+    UNIFORM(GLfloat, blendFactor) \
+    UNIFORM(glm::vec3, rainColor) \
+    /* cascade a shadow pass renders */ \
+    UNIFORM(GLint, shadowCascade) \
+    SAMPLER(sampler2DArray, materialTextures) \
+    SAMPLER(sampler2DArrayShadow, shadowMap) \
+    SAMPLER(sampler2DArray, depthMap) \
+    SAMPLER(samplerCube, skybox) \
+    SAMPLER(samplerCube, skyboxNext) \
+    /* two texels per light: view space position and radius, color */ \
+    SAMPLER(samplerBuffer, pointLightData) \
+    /* first light index and light count of every froxel */ \
+    SAMPLER(usamplerBuffer, clusterLightRanges) \
+    SAMPLER(usamplerBuffer, clusterLightIndices) \
+    /* G-buffer of the deferred renderer: albedo, view space normal, specular, depth */ \
+    SAMPLER(sampler2D, gbufferAlbedo) \
+    SAMPLER(sampler2D, gbufferNormal) \
+    SAMPLER(sampler2D, gbufferSpecular) \
+    SAMPLER(sampler2D, gbufferDepth) \
+    /* the deferred renderer's lighting, summed before it reaches the screen */ \
+    SAMPLER(sampler2D, lightAccumulation)
+
+    GPS_DECLARE_PROGRAM_UNIFORMS(GPS_PROGRAM_UNIFORMS)
+
+    // Names of the blocks, indexed by their binding point
+    extern const char* uniformBlockNames[3];
+
+    // Per-frame and per-light blocks, written once per frame into a single UBO
+    class UniformBuffers {
+
+    public:
+        void init();
+        void update(const FrameUniforms& frame, const LightUniforms& lights);
+        void destroy();
+
+    private:
+        GLuint buffer = 0;
+        GLintptr lightOffset = 0;
+        GLsizeiptr bufferSize = 0;
+        std::vector<unsigned char> staging;
+    };
+}
+
+#endif /* UniformBuffers_hpp */
@@ -19,8 +19,24 @@
 #include "Camera.hpp"
 #include "SkyBox.hpp"
 #include "Rain.hpp" 
+#include "GpuMemory.hpp"
+#include "TextureUploader.hpp"
+#include "UniformBuffers.hpp"
+#include "ShaderVariants.hpp"
+#include "GpuTimer.hpp"
+#include "GLStateCache.hpp"
+#include "RenderQueue.hpp"
+#include "SceneHierarchy.hpp"
+#include "OcclusionCuller.hpp"
+#include "GeometryPool.hpp"
+#include "ShadowCascades.hpp"
+#include "LightClusters.hpp"
+#include "DeferredRenderer.hpp"
 
 #include <iostream>
+#include <cstdlib>
+#include <random>
+#include <string>
 #include <windows.h>
 
 int glWindowWidth = 1280.0f;
@@ -29,18 +45,23 @@ int retina_width, retina_height;
 GLFWwindow* glWindow = NULL;
 float lastTimeStamp = 0.0;
 
-const unsigned int SHADOW_WIDTH = 9048;
-const unsigned int SHADOW_HEIGHT = 9048;
+// Shadow cascades and their resolution, overridden with --shadow-cascades <count> and
+// --shadow-size <texels>; size 0 picks the GPU memory quality tier's in initFBO
+int shadowCascadeCount = 4;
+int shadowMapSize = 0;
+// PCF kernel of the shadow lookups (K cycles it), overridden with --shadow-filter-taps <count>
+// and --shadow-filter-radius <texels>
+int shadowFilterTaps = 16;
+float shadowFilterRadius = 1.5f;
+
+// GPU memory budget in MB, overridden with --vram-budget <MB>
+size_t gpuMemoryBudgetMB = 1024;
 
 // Matrices
 glm::mat4 model;
-GLuint modelLoc;
 glm::mat4 view;
-GLuint viewLoc;
 glm::mat4 projection;
-GLuint projectionLoc;
 glm::mat3 normalMatrix;
-GLuint normalMatrixLoc;
 
 // ----------------------------------------------------------------------
 // The "sun" (directional light)
@@ -52,10 +73,8 @@ glm::vec3 baseSunPos(-140.0f, 60.0f, 70.0f);
 glm::vec3 sceneCenter(0.0f, 0.0f, 0.0f);
 
 glm::vec3  lightDir;
-GLuint     lightDirLoc;
 
 glm::vec3 lightColor;
-GLuint     lightColorLoc;
 
 // ----------------------------------------------------------------------
 // Camera
@@ -81,22 +100,70 @@ gps::Model3D lightCube;
 gps::Model3D screenQuad;
 gps::Model3D heli;
 
+// Scene and helicopter instances, culled through one bounding volume hierarchy
+gps::SceneHierarchy sceneHierarchy;
+int sceneInstance;
+int heliInstance;
+
+// Largest scene meshes rasterized on the CPU each frame to skip what they hide
+gps::OcclusionCuller occlusionCuller;
+size_t occluderTriangleBudget = 20000;
+
 // ----------------------------------------------------------------------
 // Shaders
 // ----------------------------------------------------------------------
-gps::Shader myCustomShader;   
+// scene and shadow programs are compiled once per combination of the toggles below
+gps::ShaderVariants sceneShaders;
 gps::Shader lightShader;
 gps::Shader screenQuadShader;
-gps::Shader depthMapShader;
+gps::ShaderVariants depthMapShaders;
+gps::ShaderVariants depthPrepassShaders;
+
+// Every program is compiled in one batch while the models load
+gps::ShaderBatch shaderBatch;
 gps::Shader skyboxShader;
 gps::Shader rainShader;
 
+// Per-frame and light uniform blocks shared by every program
+gps::UniformBuffers frameUniformBuffers;
+
+// Draws of every pass, collected and sorted once per frame
+gps::RenderQueue renderQueue;
+
+// Opaque depth laid down first so that shaderStart.frag runs once per pixel (Z toggles it,
+// --depth-prepass starts with it); the opaque passes are timed in either mode to compare
+bool depthPrepassEnabled = false;
+// depth writes only, from the position-only stream unless the wind needs normals
+gps::RenderMaterial depthPrepassMaterials[2];
+gps::GpuTimer opaqueTimers[2] = { gps::GpuTimer("the opaque pass"), gps::GpuTimer("the depth prepass and opaque pass") };
+
+// ----------------------------------------------------------------------
+// Deferred shading
+// ----------------------------------------------------------------------
+// Lights the opaque pass from a G-buffer instead of per fragment, chosen at startup with
+// --renderer deferred (forward is the default); the sky, the sun cube and the rain stay forward
+bool deferredShading = false;
+gps::DeferredRenderer deferredRenderer;
+gps::ShaderVariants gbufferShaders;
+gps::ShaderVariants deferredLightingShaders;
+gps::ShaderVariants lightVolumeShaders;
+gps::Shader deferredCompositeShader;
+gps::GpuTimer deferredTimers[2] = { gps::GpuTimer("the G-buffer pass"), gps::GpuTimer("the deferred lighting passes") };
+
+// --benchmark <frames>: the camera path at night with every point light, flown for that
+// many frames by each run below, all reported on exit. The animations step by a fixed
+// time per frame, so every run renders the same frames however long each takes.
+enum BenchmarkRun { BENCHMARK_FORWARD, BENCHMARK_FORWARD_PREPASS, BENCHMARK_DEFERRED, BENCHMARK_RUN_COUNT };
+int benchmarkFrames = 0;
+float benchmarkFrameTime = 1.0f / 60.0f;
+int benchmarkFrame = 0;
+double benchmarkStart = 0.0;
+double benchmarkSeconds[BENCHMARK_RUN_COUNT] = { 0.0, 0.0, 0.0 };
+
 // ----------------------------------------------------------------------
 // Shadows
 // ----------------------------------------------------------------------
-GLuint shadowMapFBO;
-GLuint depthMapTexture;
-glm::mat4 lightSpaceTrMatrix;
+gps::ShadowCascades shadowCascades;
 bool showDepthMap = false;
 
 // ----------------------------------------------------------------------
@@ -119,12 +186,36 @@ float gLinearAtt = 0.02f;
 float gQuadraticAtt = 0.001f;
 bool  pointLightEnabled = false; 
 
+// The lamps above plus scattered small lights up to this count, overridden with
+// --point-lights <count>; all of them are binned into froxels every frame
+int pointLightCount = NUM_OF_POINT_LIGHTS;
+std::vector<gps::PointLight> pointLights;
+gps::LightClusters lightClusters;
+
 
 // ----------------------------------------------------------------------
 // Skybox
 // ----------------------------------------------------------------------
-std::vector<const GLchar*> faces;
+std::vector<const GLchar*> dayFaces = {
+    "skybox/desertsky_rt.tga",
+    "skybox/desertsky_lf.tga",
+    "skybox/desertsky_up.tga",
+    "skybox/desertsky_dn.tga",
+    "skybox/desertsky_bk.tga",
+    "skybox/desertsky_ft.tga"
+};
+std::vector<const GLchar*> nightFaces = {
+    "skybox/marslike01rt.tga",
+    "skybox/marslike01lf.tga",
+    "skybox/marslike01up.tga",
+    "skybox/marslike01dn.tga",
+    "skybox/marslike01bk.tga",
+    "skybox/marslike01ft.tga"
+};
 gps::SkyBox mySkyBox;
+int daySkyBox = 0;
+int nightSkyBox = 0;
+float skyBoxFadeTime = 1.5f;
 
 // ----------------------------------------------------------------------
 // Helicopter
@@ -173,6 +264,7 @@ float thunderTimer = 0.0f;
 float nextThunderInterval = 10.0f;
 float thunderDuration = 1.0; 
 float thunderStartTime = 0.0f;
+float thunderBrightness = 1.0f;
 
 RainSystem gRain(0, rainShader);
 
@@ -201,29 +293,10 @@ GLenum glCheckError_(const char* file, int line) {
 // Day / Night handler
 // ----------------------------------------------------------------------
 void handleDayAndNightMode() {
-    faces.clear();
-    if (nightMode) {
-        faces.push_back("skybox/marslike01rt.tga");
-        faces.push_back("skybox/marslike01lf.tga");
-        faces.push_back("skybox/marslike01up.tga");
-        faces.push_back("skybox/marslike01dn.tga");
-        faces.push_back("skybox/marslike01bk.tga");
-        faces.push_back("skybox/marslike01ft.tga");
-    }
-    else {
-        faces.push_back("skybox/desertsky_rt.tga");
-        faces.push_back("skybox/desertsky_lf.tga");
-        faces.push_back("skybox/desertsky_up.tga");
-        faces.push_back("skybox/desertsky_dn.tga");
-        faces.push_back("skybox/desertsky_bk.tga");
-        faces.push_back("skybox/desertsky_ft.tga");
-    }
-
-    mySkyBox.Load(faces);
+    // both cubemaps are resident since initSkybox, only crossfade here
+    mySkyBox.SetActive(nightMode ? nightSkyBox : daySkyBox, skyBoxFadeTime);
 
     lightColor = nightMode ? nightSunColor : daySunColor;
-    myCustomShader.useShaderProgram();
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
 }
 
 
@@ -261,15 +334,25 @@ void windowResizeCallback(GLFWwindow* window, int width, int height)
     glWindowHeight = height;
 
     glfwGetFramebufferSize(window, &retina_width, &retina_height);
-    glViewport(0, 0, retina_width, retina_height);
+    gps::GLStateCache::get().viewport(0, 0, retina_width, retina_height);
 
     float aspectRatio = (float)retina_width / (float)retina_height;
     projection = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 1000.0f);
 
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    deferredRenderer.resize(retina_width, retina_height);
 }
 
 
+void startCameraAnimation()
+{
+    cameraAnimationActive = true;
+    currentPathIndex = 0;
+    segmentTimer = 0.0f;
+    isTraveling = true;
+    myCamera.setCameraPosition(cameraPathPoints[0]);
+    std::cout << "[INFO] Starting camera animation.\n";
+}
+
 void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
     if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
@@ -327,13 +410,42 @@ void keyboardCallback(GLFWwindow* window, int key, int scancode, int action, int
         handleDayAndNightMode();
     }
 
+    if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+        shadowCascades.setBiasMode((gps::ShadowBiasMode)((shadowCascades.getBiasMode() + 1) % gps::SHADOW_BIAS_MODE_COUNT));
+    }
+
+    if (key == GLFW_KEY_K && action == GLFW_PRESS) {
+        gps::ShadowFilter filter = (gps::ShadowFilter)((shadowCascades.getFilter() + 1) % gps::SHADOW_FILTER_COUNT);
+        shadowCascades.setFilter(filter, shadowFilterTaps, shadowFilterRadius);
+    }
+
+    if (key == GLFW_KEY_Z && action == GLFW_PRESS) {
+        depthPrepassEnabled = !depthPrepassEnabled;
+        std::cout << "[INFO] Depth prepass " << (depthPrepassEnabled ? "on" : "off") << std::endl;
+        // the mode just left is not timed again, its last frames are still in flight
+        opaqueTimers[0].collectPending();
+        opaqueTimers[1].collectPending();
+        opaqueTimers[0].report();
+        opaqueTimers[1].report();
+    }
+
+    if (key == GLFW_KEY_V && action == GLFW_PRESS) {
+        gps::GpuMemory::get().report();
+        gps::GLStateCache::get().report();
+        renderQueue.report();
+        occlusionCuller.report();
+        shadowCascades.report();
+        opaqueTimers[0].report();
+        opaqueTimers[1].report();
+        deferredTimers[0].report();
+        deferredTimers[1].report();
+        lightClusters.report();
+        gps::GeometryPool::get<gps::Vertex>().report();
+        gps::GpuHeap::getDynamic<gps::PositionVertex>().report();
+    }
+
     if (key == GLFW_KEY_C && action == GLFW_PRESS) {
-        cameraAnimationActive = true;
-        currentPathIndex = 0;
-        segmentTimer = 0.0f;
-        isTraveling = true;
-        myCamera.setCameraPosition(cameraPathPoints[0]);
-        std::cout << "[INFO] Starting camera animation.\n";
+        startCameraAnimation();
     }
 
     if (key >= 0 && key < 1024) {
@@ -438,34 +550,29 @@ bool initOpenGLWindow()
 
     glfwGetWindowSize(glWindow, &glWindowWidth, &glWindowHeight);
     glfwGetFramebufferSize(glWindow, &retina_width, &retina_height);
-    glViewport(0, 0, retina_width, retina_height);
+    gps::GLStateCache::get().viewport(0, 0, retina_width, retina_height);
 
     return true;
 }
 
 void initOpenGLState() {
     glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
-    glViewport(0, 0, retina_width, retina_height);
+    gps::GLStateCache::get().viewport(0, 0, retina_width, retina_height);
 
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_LESS);
+    gps::GLStateCache::get().enable(GL_DEPTH_TEST);
+    gps::GLStateCache::get().depthFunc(GL_LESS);
 
-    glCullFace(GL_BACK);
-    glFrontFace(GL_CCW);
-    glDisable(GL_CULL_FACE);
+    gps::GLStateCache::get().cullFace(GL_BACK);
+    gps::GLStateCache::get().frontFace(GL_CCW);
+    gps::GLStateCache::get().disable(GL_CULL_FACE);
 
-    glEnable(GL_FRAMEBUFFER_SRGB);
+    gps::GLStateCache::get().enable(GL_FRAMEBUFFER_SRGB);
 }
 
 void initSkybox() {
-    faces.push_back("skybox/desertsky_rt.tga");
-    faces.push_back("skybox/desertsky_lf.tga");
-    faces.push_back("skybox/desertsky_up.tga");
-    faces.push_back("skybox/desertsky_dn.tga");
-    faces.push_back("skybox/desertsky_bk.tga");
-    faces.push_back("skybox/desertsky_ft.tga");
-
-    mySkyBox.Load(faces);
+    daySkyBox = mySkyBox.Load(dayFaces);
+    nightSkyBox = mySkyBox.Load(nightFaces);
+    mySkyBox.SetActive(daySkyBox, 0.0f);
 }
 
 void initObjects() {
@@ -473,123 +580,129 @@ void initObjects() {
     lightCube.LoadModel("objects/cube/cube.obj");
     screenQuad.LoadModel("objects/quad/quad.obj");
     heli.LoadModel("objects/heli/helicopter.obj");
+
+    // the scene shadows are cached, the helicopter moves and is drawn over them
+    sceneInstance = sceneHierarchy.addInstance(&scene, glm::mat4(1.0f), gps::SHADOW_CASTING_STATIC);
+    heliInstance = sceneHierarchy.addInstance(&heli, glm::mat4(1.0f), gps::SHADOW_CASTING_DYNAMIC);
+    sceneHierarchy.build();
+
+    occlusionCuller.addOccluders(scene, glm::mat4(1.0f), occluderTriangleBudget);
 }
 
 void initShaders() {
-    myCustomShader.loadShader("shaders/shaderStart.vert", "shaders/shaderStart.frag");
-    myCustomShader.useShaderProgram();
+    // only submits the compiles, waitForShaders finishes them
+    sceneShaders.load("shaders/shaderStart.vert", "shaders/shaderStart.frag",
+        gps::SHADER_FEATURE_WIND | gps::SHADER_FEATURE_FOG | gps::SHADER_FEATURE_RAIN | gps::SHADER_FEATURE_POINT_LIGHTS,
+        shaderBatch);
+
+    shaderBatch.add(lightShader, "shaders/lightCube.vert", "shaders/lightCube.frag");
+
+    shaderBatch.add(screenQuadShader, "shaders/screenQuad.vert", "shaders/screenQuad.frag");
+
+    depthMapShaders.load("shaders/shadow.vert", "shaders/shadow.frag", gps::SHADER_FEATURE_WIND, shaderBatch);
+
+    depthPrepassShaders.load("shaders/depthPrepass.vert", "shaders/shadow.frag", gps::SHADER_FEATURE_WIND, shaderBatch);
+    for (int i = 0; i < 2; i++) {
+        depthPrepassMaterials[i].colorMask = GL_FALSE;
+        depthPrepassMaterials[i].positionOnly = i == 0;
+    }
+
+    // the G-buffer pass shares the vertex shader of the forward scene pass
+    gbufferShaders.load("shaders/shaderStart.vert", "shaders/gbuffer.frag", gps::SHADER_FEATURE_WIND, shaderBatch);
+    deferredLightingShaders.load("shaders/deferredLighting.vert", "shaders/deferredLighting.frag",
+        gps::SHADER_FEATURE_FOG | gps::SHADER_FEATURE_RAIN, shaderBatch);
+    lightVolumeShaders.load("shaders/lightVolume.vert", "shaders/lightVolume.frag",
+        gps::SHADER_FEATURE_FOG | gps::SHADER_FEATURE_RAIN, shaderBatch);
+    shaderBatch.add(deferredCompositeShader, "shaders/deferredLighting.vert", "shaders/deferredComposite.frag");
 
-    lightShader.loadShader("shaders/lightCube.vert", "shaders/lightCube.frag");
-    lightShader.useShaderProgram();
+    shaderBatch.add(skyboxShader, "shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
 
-    screenQuadShader.loadShader("shaders/screenQuad.vert", "shaders/screenQuad.frag");
-    screenQuadShader.useShaderProgram();
+    shaderBatch.add(rainShader, "shaders/rainShader.vert", "shaders/rainShader.frag");
 
-    depthMapShader.loadShader("shaders/shadow.vert", "shaders/shadow.frag");
-    depthMapShader.useShaderProgram();
+    frameUniformBuffers.init();
+}
+
+// Shows a progress bar until every submitted program is linked
+void waitForShaders() {
+    gps::GLStateCache::get().enable(GL_SCISSOR_TEST);
+
+    while (!shaderBatch.poll()) {
+        float progress = 1.0f - (float)shaderBatch.getPendingCount() / (float)shaderBatch.getTotalCount();
+
+        // the loading frame is only cleared, no program is usable yet
+        glScissor(0, 0, retina_width, retina_height);
+        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        glScissor(retina_width / 4, retina_height / 2 - 4, (GLsizei)(retina_width / 2 * progress), 8);
+        glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        glfwSwapBuffers(glWindow);
+        glfwPollEvents();
+    }
 
-    skyboxShader.loadShader("shaders/skyboxShader.vert", "shaders/skyboxShader.frag");
-    skyboxShader.useShaderProgram();
+    gps::GLStateCache::get().disable(GL_SCISSOR_TEST);
+    glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
 
-    rainShader.loadShader("shaders/rainShader.vert", "shaders/rainShader.frag");
-    rainShader.useShaderProgram();
+    std::cout << "[INFO] " << shaderBatch.getTotalCount() << " programs ready in "
+        << (int)(shaderBatch.getElapsedSeconds() * 1000.0) << " ms"
+        << (gps::ShaderBatch::isParallelCompileSupported() ? " (parallel compile)" : "") << std::endl;
 
+    // the rain keeps its own copy of the program, made once the program is finished
     gRain = RainSystem(50000, rainShader);
 }
 
 void initUniforms() {
-    myCustomShader.useShaderProgram();
-
     model = glm::mat4(1.0f);
-    modelLoc = glGetUniformLocation(myCustomShader.shaderProgram, "model");
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
     view = myCamera.getViewMatrix();
-    viewLoc = glGetUniformLocation(myCustomShader.shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
     normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myCustomShader.shaderProgram, "normalMatrix");
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
 
     float aspectRatio = (float)glWindowWidth / (float)glWindowHeight;
     projection = glm::perspective(glm::radians(45.0f),
         aspectRatio,
         0.1f, 1000.0f);
-    projectionLoc = glGetUniformLocation(myCustomShader.shaderProgram, "projection");
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    lightDirLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightDir");
 
     lightColor = glm::vec3(1.0f, 1.0f, 1.0f);
-    lightColorLoc = glGetUniformLocation(myCustomShader.shaderProgram, "lightColor");
-    glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"),
-        1, GL_FALSE, glm::value_ptr(projection));
-
-    depthMapShader.useShaderProgram();
-    glUniform1i(glGetUniformLocation(depthMapShader.shaderProgram, "shadowMap"), 0);
 }
 
-void initFBO() {
-    glGenFramebuffers(1, &shadowMapFBO);
-
-    glGenTextures(1, &depthMapTexture);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-        SHADOW_WIDTH, SHADOW_HEIGHT,
-        0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0f,1.0f,1.0f,1.0f };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
-        GL_TEXTURE_2D, depthMapTexture, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        std::cerr << "ERROR::FRAMEBUFFER:: Shadow map framebuffer is not complete!\n";
+void initPointLights() {
+    // the lamps reach as far as their attenuation stays above 1/256
+    float lampRadius = gps::pointLightRange(gConstantAtt, gLinearAtt, gQuadraticAtt, 1.0f / 256.0f);
+    for (int i = 0; i < NUM_OF_POINT_LIGHTS; i++) {
+        gps::PointLight lamp;
+        lamp.position = gPointLightPositions[i];
+        lamp.radius = lampRadius;
+        lamp.color = gPointLightColor;
+        pointLights.push_back(lamp);
     }
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-}
-
-// ----------------------------------------------------------------------
-// Light Space Matrix
-// ----------------------------------------------------------------------
-glm::mat4 computeLightSpaceTrMatrix() {
-    glm::mat4 rotateSun = glm::rotate(glm::mat4(1.0f),
-        glm::radians(lightAngle),
-        glm::vec3(0.0f, 1.0f, 0.0f));
-
-    glm::vec3 currentSunPos = glm::vec3(rotateSun * glm::vec4(baseSunPos, 1.0f));
 
-    glm::mat4 lightView = glm::lookAt(
-        currentSunPos,
-        sceneCenter,
-        glm::vec3(0.0f, 1.0f, 0.0f)
-    );
+    // the rest are small colored lights over the scene, the same ones every run
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    int count = std::min(pointLightCount, gps::MAX_POINT_LIGHTS);
+    while ((int)pointLights.size() < count) {
+        gps::PointLight light;
+        light.position = glm::vec3(-150.0f + 250.0f * unit(random), 2.0f + 18.0f * unit(random), -100.0f + 150.0f * unit(random));
+        light.radius = 8.0f + 17.0f * unit(random);
+        light.color = glm::vec3(0.2f + 0.8f * unit(random), 0.2f + 0.8f * unit(random), 0.2f + 0.8f * unit(random));
+        pointLights.push_back(light);
+    }
 
-    float orthoSize = 50.0f;
-    float nearPlane = -100.0f;
-    float farPlane = 300.0f;
+    lightClusters.init();
+    std::cout << "[INFO] " << pointLights.size() << " point lights" << std::endl;
+}
 
-    glm::mat4 lightProjection = glm::ortho(
-        -orthoSize, orthoSize,
-        -orthoSize, orthoSize,
-        nearPlane, farPlane
-    );
+void initFBO() {
+    shadowCascades.setFilter(gps::SHADOW_FILTER_POISSON, shadowFilterTaps, shadowFilterRadius);
+    shadowCascades.init(shadowCascadeCount, shadowMapSize);
 
-    lightSpaceTrMatrix = lightProjection * lightView;
-    return lightSpaceTrMatrix;
+    // the last run of the benchmark uses the deferred renderer
+    if (deferredShading || benchmarkFrames > 0) {
+        deferredRenderer.init(retina_width, retina_height);
+    }
 }
 
 // ----------------------------------------------------------------------
@@ -639,9 +752,7 @@ void updateCameraAnimation(float deltaTime) {
 // ----------------------------------------------------------------------
 // Helicopter rotation logic
 // ----------------------------------------------------------------------
-void drawHelicopter(gps::Shader& shader) {
-    shader.useShaderProgram();
-
+void updateHelicopter() {
     glm::mat4 modelHeli = glm::mat4(1.0f);
 
     modelHeli = glm::translate(modelHeli, glm::vec3(-102.0f, 65.6f, 7.8f));
@@ -653,12 +764,7 @@ void drawHelicopter(gps::Shader& shader) {
 
     modelHeli = glm::scale(modelHeli, glm::vec3(5.0f, 5.0f, 5.0f));
 
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(modelHeli));
-
-    glm::mat3 heliNormalMatrix = glm::mat3(glm::inverseTranspose(view * modelHeli));
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(heliNormalMatrix));
-
-    heli.Draw(shader);
+    sceneHierarchy.setTransform(heliInstance, modelHeli);
 }
 
 void updateDeltaTimeHeli(double elapsedSeconds) {
@@ -686,8 +792,6 @@ void playThunderSound() {
 }
 
 void thunderPollingAction(float deltaTime) {
-    static float thunderBrightness = 1.0f;
-
     thunderTimer += deltaTime;
 
     if (!isThunderActive && thunderTimer >= nextThunderInterval && rainEnabled) {
@@ -707,210 +811,394 @@ void thunderPollingAction(float deltaTime) {
             thunderBrightness = 1.0f;
         }
     }
-
-    myCustomShader.useShaderProgram();
-
-    GLint thunderLoc = glGetUniformLocation(myCustomShader.shaderProgram, "thunderBrightness");
-    glUniform1f(thunderLoc, thunderBrightness);
 }
 
 // ----------------------------------------------------------------------
-// Scene drawing logic here
+// Shader permutation matching the current toggles
 // ----------------------------------------------------------------------
-void drawScene(gps::Shader shader, bool depthPass)
-{
-    shader.useShaderProgram();
-
-    glm::mat4 rotScene = glm::mat4(1.0f);
-
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"),
-        1, GL_FALSE, glm::value_ptr(rotScene));
-
-    if (!depthPass) {
-        glm::mat3 normMat = glm::mat3(glm::inverseTranspose(view * rotScene));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normMat));
-    }
-
-    scene.Draw(shader);
+unsigned int enabledShaderFeatures() {
+    unsigned int features = 0;
+    if (windEnabled) features |= gps::SHADER_FEATURE_WIND;
+    if (fogEnabled) features |= gps::SHADER_FEATURE_FOG;
+    if (rainEnabled) features |= gps::SHADER_FEATURE_RAIN;
+    if (pointLightEnabled) features |= gps::SHADER_FEATURE_POINT_LIGHTS;
+    return features;
 }
 
 // ----------------------------------------------------------------------
 // Main render function run at each frame
 // ----------------------------------------------------------------------
 void renderScene(float deltaTime) {
-    // 1) Day / Night mode set light brightness
-    myCustomShader.useShaderProgram();
-    float brightness = nightMode ? 0.5f : 1.0f;
-    myCustomShader.useShaderProgram();
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "lightBrightness"), brightness);
+    // 1) Per-frame state, written once into the shared uniform blocks
+    float currentTime = (float)glfwGetTime();
+    view = myCamera.getViewMatrix();
 
-    // 2) SHADOW PASS: Render scene from the sun's POV
-    depthMapShader.useShaderProgram();
+    // occluders rasterize on worker threads while the frame is set up
+    occlusionCuller.begin(projection * view);
 
-    GLint timeShadowLoc = glGetUniformLocation(depthMapShader.shaderProgram, "time");
-    float currentTime = (float)glfwGetTime(); 
-    glUniform1f(timeShadowLoc, currentTime);
+    glm::mat4 rotateSun = glm::rotate(glm::mat4(1.0f),
+        glm::radians(lightAngle),
+        glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::vec3 currentSunPos = glm::vec3(rotateSun * glm::vec4(baseSunPos, 1.0f));
+    glm::vec3 newLightDir = glm::normalize(sceneCenter - currentSunPos);
 
-    GLint windShadowLoc = glGetUniformLocation(depthMapShader.shaderProgram, "enableWind");
-    glUniform1i(windShadowLoc, (windEnabled ? 1 : 0));
+    // the cascades follow the camera, fitted to slices of its frustum
+    shadowCascades.update(view, glm::radians(45.0f), (float)glWindowWidth / (float)glWindowHeight, 0.1f, newLightDir);
 
-    glm::mat4 lightSpace = computeLightSpaceTrMatrix();
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram,
-        "lightSpaceTrMatrix"),
-        1, GL_FALSE, glm::value_ptr(lightSpace));
+    if (rainEnabled) {
+        thunderPollingAction(deltaTime);
+    }
 
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
+    gps::FrameUniforms frame = {};
+    frame.view = view;
+    frame.projection = projection;
+    frame.inverseView = glm::inverse(view);
+    frame.inverseProjection = glm::inverse(projection);
+    shadowCascades.fillUniforms(frame);
+    frame.lightDir = glm::vec4(newLightDir, 0.0f);
+    // day / night mode sets the light brightness
+    frame.lightColor = glm::vec4(lightColor, nightMode ? 0.5f : 1.0f);
+    frame.fogColor = gFogColor;
+    frame.fogDensity = gFogDensity;
+    frame.time = currentTime;
+    frame.thunderBrightness = thunderBrightness;
+
+    // point lights binned into the froxels of the camera, only while they are shown; the
+    // deferred light volumes only read the lights themselves
+    if (pointLightEnabled && deferredShading) {
+        lightClusters.uploadLights(pointLights, view);
+    }
+    else if (pointLightEnabled) {
+        lightClusters.setProjection(glm::radians(45.0f), (float)glWindowWidth / (float)glWindowHeight, 0.1f, 1000.0f,
+            retina_width, retina_height);
+        lightClusters.update(pointLights, view);
+    }
+    gps::LightUniforms lights = {};
+    lights.pointLightTerms = glm::vec4(gPointLightAmbient, gPointLightDiffuse, gPointLightSpecular, 0.0f);
+    lights.attenuation = glm::vec4(gConstantAtt, gLinearAtt, gQuadraticAtt, 0.0f);
+    lights.numPointLights = (GLint)pointLights.size();
+    lightClusters.fillUniforms(lights);
+
+    frameUniformBuffers.update(frame, lights);
+
+    // the toggles select a specialized program instead of branching per fragment
+    unsigned int features = enabledShaderFeatures();
+    gps::Shader& depthMapShader = depthMapShaders.get(features);
+    gps::Shader& sceneShader = sceneShaders.get(features);
+    gps::Shader& depthPrepassShader = depthPrepassShaders.get(features);
+    gps::Shader& gbufferShader = gbufferShaders.get(features);
+    gps::Shader& deferredLightingShader = deferredLightingShaders.get(features);
+    gps::Shader& lightVolumeShader = lightVolumeShaders.get(features);
+
+    // 2) Queue the draws of every pass, sorted once for the whole frame
+    renderQueue.clear();
+    for (int cascade = 0; cascade < shadowCascades.getCascadeCount(); cascade++) {
+        const glm::mat4& cascadeMatrix = shadowCascades.getMatrix(cascade);
+        renderQueue.setPassCamera(gps::shadowPass(cascade), cascadeMatrix, cascadeMatrix);
+        renderQueue.setPassCamera(gps::dynamicShadowPass(cascade), cascadeMatrix, cascadeMatrix);
+    }
+    renderQueue.setPassCamera(gps::RENDER_PASS_DEPTH_PREPASS, view, projection * view);
+    renderQueue.setPassCamera(gps::RENDER_PASS_OPAQUE, view, projection * view);
+    renderQueue.setPassCamera(gps::RENDER_PASS_SKY, view, projection * view);
+    renderQueue.setPassCamera(gps::RENDER_PASS_TRANSLUCENT, view, projection * view);
+
+    // the queue derives the normal matrices from the pass view
+    updateHelicopter();
+    sceneHierarchy.update();
+
+    // cached cascades skip the static casters, wind sways them every frame though
+    bool animatedCasters = (features & gps::SHADER_FEATURE_WIND) != 0;
+    bool staticShadowPasses[gps::MAX_SHADOW_CASCADES];
+    bool dynamicShadowPasses[gps::MAX_SHADOW_CASCADES];
+    unsigned int dynamicCasters[gps::MAX_SHADOW_CASCADES];
+    for (int cascade = 0; cascade < shadowCascades.getCascadeCount(); cascade++) {
+        // depth only: no textures, the bias as raster state, positions only unless the wind needs normals
+        renderQueue.setPassMaterial(gps::shadowPass(cascade), shadowCascades.getCasterMaterial(animatedCasters));
+        renderQueue.setPassMaterial(gps::dynamicShadowPass(cascade), shadowCascades.getCasterMaterial(animatedCasters));
+
+        staticShadowPasses[cascade] = shadowCascades.needsStaticPass(cascade, animatedCasters);
+        if (staticShadowPasses[cascade]) {
+            sceneHierarchy.submit(renderQueue, gps::shadowPass(cascade), depthMapShader);
+        }
 
-    drawScene(depthMapShader, true);
+        dynamicCasters[cascade] = sceneHierarchy.submit(renderQueue, gps::dynamicShadowPass(cascade), depthMapShader);
+        dynamicShadowPasses[cascade] = staticShadowPasses[cascade] ||
+            shadowCascades.needsDynamicPass(cascade, dynamicCasters[cascade], sceneHierarchy.haveDynamicCastersMoved());
+    }
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    occlusionCuller.finish();
+    // the deferred renderer's opaque pass only fills the G-buffer, with the same meshes and materials
+    sceneHierarchy.submit(renderQueue, gps::RENDER_PASS_OPAQUE, deferredShading ? gbufferShader : sceneShader, &occlusionCuller);
 
-    // 3) Set up point lights 
-    myCustomShader.useShaderProgram();
+    // the "sun" cube, it is unlit and drawn forward with the sky behind the deferred lighting
+    model = glm::mat4(1.0f);
+    model = glm::translate(model, currentSunPos);
+    model = glm::scale(model, glm::vec3(0.25f, 0.25f, 0.25f));
+    lightCube.Submit(renderQueue, deferredShading ? gps::RENDER_PASS_SKY : gps::RENDER_PASS_OPAQUE, lightShader, model);
+
+    // the prepass holds everything the opaque pass does, which then only shades the
+    // fragments that match its depth; the G-buffer pass shades nothing, it goes without
+    if (depthPrepassEnabled && !deferredShading) {
+        renderQueue.setPassMaterial(gps::RENDER_PASS_DEPTH_PREPASS, &depthPrepassMaterials[animatedCasters ? 1 : 0]);
+        sceneHierarchy.submit(renderQueue, gps::RENDER_PASS_DEPTH_PREPASS, depthPrepassShader, &occlusionCuller);
+        lightCube.Submit(renderQueue, gps::RENDER_PASS_DEPTH_PREPASS, depthPrepassShader, model);
+        renderQueue.setPassDepthState(gps::RENDER_PASS_OPAQUE, GL_EQUAL, GL_FALSE);
+    }
+    else {
+        renderQueue.clearPassDepthState(gps::RENDER_PASS_OPAQUE);
+    }
 
-    GLint numPLoc = glGetUniformLocation(myCustomShader.shaderProgram, "numPointLights");
-    glUniform1i(numPLoc, NUM_OF_POINT_LIGHTS);
+    mySkyBox.Update(deltaTime);
+    mySkyBox.Submit(renderQueue, skyboxShader);
 
-    glm::vec3 plPosEye[NUM_OF_POINT_LIGHTS];
-    for (int i = 0; i < NUM_OF_POINT_LIGHTS; i++) {
-        glm::vec4 eyeSpacePos = view * glm::vec4(gPointLightPositions[i], 1.0f);
-        plPosEye[i] = glm::vec3(eyeSpacePos);
+    if (rainEnabled) {
+        gRain.update(deltaTime);
+        gRain.uploadToGPU();
+        gRain.submit(renderQueue);
     }
 
-    GLint plArrayLoc = glGetUniformLocation(myCustomShader.shaderProgram, "pointLightPositions");
-    glUniform3fv(plArrayLoc, NUM_OF_POINT_LIGHTS, glm::value_ptr(plPosEye[0]));
+    renderQueue.sort();
+
+    // 3) SHADOW PASSES: Render the cascades that changed from the sun's POV, the static
+    //    casters into the cache and the dynamic ones over a copy of it
+    for (int cascade = 0; cascade < shadowCascades.getCascadeCount(); cascade++) {
+        if (!dynamicShadowPasses[cascade]) {
+            continue;
+        }
 
-    glUniform3fv(glGetUniformLocation(myCustomShader.shaderProgram, "pointLightColor"),
-        1, glm::value_ptr(gPointLightColor));
+        depthMapShader.set<gps::UniformId::shadowCascade>(cascade);
+        if (staticShadowPasses[cascade]) {
+            shadowCascades.beginStaticPass(cascade, animatedCasters);
+            renderQueue.execute(gps::shadowPass(cascade));
+        }
 
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "pointLightAmbient"),
-        gPointLightAmbient);
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "pointLightDiffuse"),
-        gPointLightDiffuse);
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "pointLightSpecular"),
-        gPointLightSpecular);
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "constantAtt"),
-        gConstantAtt);
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "linearAtt"),
-        gLinearAtt);
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "quadraticAtt"),
-        gQuadraticAtt);
+        shadowCascades.beginDynamicPass(cascade, dynamicCasters[cascade]);
+        renderQueue.execute(gps::dynamicShadowPass(cascade));
+    }
 
-    glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "enablePointLight"),
-        (pointLightEnabled ? 1 : 0));
+    gps::GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
     // 4) If user wants to see the Depth Map, show it and return
     if (showDepthMap) {
-        glViewport(0, 0, retina_width, retina_height);
+        gps::GLStateCache::get().viewport(0, 0, retina_width, retina_height);
         glClear(GL_COLOR_BUFFER_BIT);
         screenQuadShader.useShaderProgram();
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-        glUniform1i(glGetUniformLocation(screenQuadShader.shaderProgram, "depthMap"), 0);
+        // the sampled array compares, the sampler object reads the depths themselves
+        gps::GLStateCache::get().bindTexture(0, GL_TEXTURE_2D_ARRAY, shadowCascades.getTexture());
+        glBindSampler(0, shadowCascades.getDepthSampler());
+        screenQuadShader.set<gps::UniformId::depthMap>(0);
 
-        glDisable(GL_DEPTH_TEST);
+        gps::GLStateCache::get().disable(GL_DEPTH_TEST);
         screenQuad.Draw(screenQuadShader);
-        glEnable(GL_DEPTH_TEST);
+        gps::GLStateCache::get().enable(GL_DEPTH_TEST);
+        glBindSampler(0, 0);
         return;
     }
 
-    // 5) NORMAL PASS: Render the scene from the camera
-    glViewport(0, 0, retina_width, retina_height);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    myCustomShader.useShaderProgram();
-
-    GLint timeMainLoc = glGetUniformLocation(myCustomShader.shaderProgram, "time");
-    glUniform1f(timeMainLoc, currentTime);
-
-    GLint windMainLoc = glGetUniformLocation(myCustomShader.shaderProgram, "enableWind");
-    glUniform1i(windMainLoc, (windEnabled ? 1 : 0));
-
-    GLint rainEnabled = glGetUniformLocation(myCustomShader.shaderProgram, "rainEnabled");
-    glUniform1i(rainEnabled, (rainEnabled ? 1 : 0));
-
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-    glUniformMatrix4fv(glGetUniformLocation(myCustomShader.shaderProgram,
-        "lightSpaceTrMatrix"),
-        1, GL_FALSE, glm::value_ptr(lightSpace));
-
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "shadowMap"), 3);
+    if (deferredShading) {
+        // 5) G-BUFFER PASS: the opaque geometry's surfaces, unlit
+        deferredTimers[0].begin();
+        deferredRenderer.beginGeometryPass();
+        renderQueue.execute(gps::RENDER_PASS_OPAQUE);
+        deferredTimers[0].end();
+
+        // 6) Lighting: the sun, its shadows, fog and thunder over every covered pixel, then
+        //    each point light over the pixels in its reach, summed off screen
+        gps::GLStateCache::get().bindTexture(3, GL_TEXTURE_2D_ARRAY, shadowCascades.getTexture());
+        lightClusters.bind(4);
+        deferredRenderer.bind(7);
+
+        gps::Shader* lightingShaders[2] = { &deferredLightingShader, &lightVolumeShader };
+        for (int i = 0; i < 2; i++) {
+            lightingShaders[i]->set<gps::UniformId::shadowMap>(3);
+            lightingShaders[i]->set<gps::UniformId::pointLightData>(4);
+            lightingShaders[i]->set<gps::UniformId::gbufferAlbedo>(7);
+            lightingShaders[i]->set<gps::UniformId::gbufferNormal>(8);
+            lightingShaders[i]->set<gps::UniformId::gbufferSpecular>(9);
+            lightingShaders[i]->set<gps::UniformId::gbufferDepth>(10);
+        }
 
-    glm::mat4 rotateSun = glm::rotate(glm::mat4(1.0f),
-        glm::radians(lightAngle),
-        glm::vec3(0.0f, 1.0f, 0.0f));
-    glm::vec3 currentSunPos = glm::vec3(rotateSun * glm::vec4(baseSunPos, 1.0f));
+        deferredTimers[1].begin();
+        deferredRenderer.drawLighting(deferredLightingShader);
+        if (pointLightEnabled) {
+            deferredRenderer.drawLightVolumes(lightVolumeShader, (int)pointLights.size());
+        }
 
-    glm::vec3 newLightDir = glm::normalize(sceneCenter - currentSunPos);
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(newLightDir));
+        // 7) The summed lighting and the scene depth onto the screen
+        gps::GLStateCache::get().bindFramebuffer(GL_FRAMEBUFFER, 0);
+        gps::GLStateCache::get().viewport(0, 0, retina_width, retina_height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-    // 5) Pass the fog uniforms
-    glUniform1i(glGetUniformLocation(myCustomShader.shaderProgram, "enableFog"),
-        (fogEnabled ? 1 : 0));
-    glUniform1f(glGetUniformLocation(myCustomShader.shaderProgram, "fogDensity"),
-        gFogDensity);
-    glUniform4fv(glGetUniformLocation(myCustomShader.shaderProgram, "fogColor"),
-        1, glm::value_ptr(gFogColor));
+        deferredCompositeShader.set<gps::UniformId::gbufferDepth>(10);
+        deferredCompositeShader.set<gps::UniformId::lightAccumulation>(11);
+        deferredRenderer.drawComposite(deferredCompositeShader, 11);
+        deferredTimers[1].end();
+    }
+    else {
+        // 5) NORMAL PASS: Render the scene from the camera
+        gps::GLStateCache::get().viewport(0, 0, retina_width, retina_height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        gps::GLStateCache::get().bindTexture(3, GL_TEXTURE_2D_ARRAY, shadowCascades.getTexture());
+        sceneShader.set<gps::UniformId::shadowMap>(3);
+
+        lightClusters.bind(4);
+        sceneShader.set<gps::UniformId::pointLightData>(4);
+        sceneShader.set<gps::UniformId::clusterLightRanges>(5);
+        sceneShader.set<gps::UniformId::clusterLightIndices>(6);
+
+        // 6) Opaque geometry, lit per fragment
+        gps::GpuTimer& opaqueTimer = opaqueTimers[depthPrepassEnabled ? 1 : 0];
+        opaqueTimer.begin();
+        if (depthPrepassEnabled) {
+            renderQueue.execute(gps::RENDER_PASS_DEPTH_PREPASS);
+        }
+        renderQueue.execute(gps::RENDER_PASS_OPAQUE);
+        opaqueTimer.end();
+    }
 
-    // 6) Draw the scene & helicopter obj
-    drawScene(myCustomShader, false);
-    drawHelicopter(myCustomShader);
+    // 8) The skybox behind the opaque geometry, then the rain on top
+    renderQueue.execute(gps::RENDER_PASS_SKY);
+    renderQueue.execute(gps::RENDER_PASS_TRANSLUCENT);
+}
 
-    // 7) Draw the rain
-    if (rainEnabled) {
-        thunderPollingAction(deltaTime);
+void cleanup() {
+    gps::TextureUploader::get().destroy();
+    frameUniformBuffers.destroy();
+    sceneShaders.destroy();
+    depthMapShaders.destroy();
+    depthPrepassShaders.destroy();
+    opaqueTimers[0].destroy();
+    opaqueTimers[1].destroy();
+    gbufferShaders.destroy();
+    deferredLightingShaders.destroy();
+    lightVolumeShaders.destroy();
+    deferredTimers[0].destroy();
+    deferredTimers[1].destroy();
+    mySkyBox.Destroy();
+    gRain.destroy();
+    renderQueue.destroy();
+    scene.Destroy();
+    lightCube.Destroy();
+    screenQuad.Destroy();
+    heli.Destroy();
+    gps::GeometryPool::get<gps::Vertex>().destroy();
+    gps::GpuHeap::getDynamic<gps::PositionVertex>().destroy();
+
+    shadowCascades.destroy();
+    lightClusters.destroy();
+    deferredRenderer.destroy();
 
-        gRain.update(deltaTime);
+    glfwDestroyWindow(glWindow);
+    glfwTerminate();
+}
 
-        gRain.uploadToGPU();
+// ----------------------------------------------------------------------
+// Forward / deferred benchmark
+// ----------------------------------------------------------------------
+const char* benchmarkRunName(int run) {
+    switch (run) {
+    case BENCHMARK_FORWARD:
+        return "forward, no depth prepass";
+    case BENCHMARK_FORWARD_PREPASS:
+        return "forward, depth prepass";
+    default:
+        return "deferred";
+    }
+}
 
-        lightShader.useShaderProgram();
+void startBenchmarkRun(int run) {
+    // the prepass is set by the run, not by whatever the Z key left it at
+    deferredShading = run == BENCHMARK_DEFERRED;
+    depthPrepassEnabled = run == BENCHMARK_FORWARD_PREPASS;
+    if (deferredShading) {
+        deferredTimers[0].reset();
+        deferredTimers[1].reset();
+    }
+    else {
+        opaqueTimers[depthPrepassEnabled ? 1 : 0].reset();
+    }
 
-        glm::mat4 view = myCamera.getViewMatrix();
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"),
-            1, GL_FALSE, glm::value_ptr(view));
-        glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "projection"),
-            1, GL_FALSE, glm::value_ptr(projection));
+    // every run flies the same path past the same helicopter. The animation only moves the
+    // camera, which otherwise still faces up and away from the scene as it starts, so
+    // every run looks along the path and down at the scene
+    startCameraAnimation();
+    yaw = -13.0f;
+    pitch = -20.0f;
+    myCamera.rotate(pitch, yaw);
+    heliAngle = 0.0f;
+    deltaTimeHeli = 0.0f;
+    benchmarkStart = glfwGetTime();
+    std::cout << "[INFO] Benchmarking " << benchmarkRunName(run) << " over "
+        << benchmarkFrames << " frames" << std::endl;
+}
 
-        GLint colorLoc = glGetUniformLocation(lightShader.shaderProgram, "objectColor");
-        if (colorLoc >= 0) {
-            glUniform3f(colorLoc, 0.65f, 0.65f, 1.0f);  
-        }
+void startBenchmark() {
+    // a light-heavy night, every texture resident and no waiting for vsync. The G-buffer
+    // has one sample per pixel, so the forward renderer drops the window's 4x MSAA too
+    // and both renderers shade and write the same number of samples.
+    nightMode = true;
+    lightColor = nightSunColor;
+    mySkyBox.SetActive(nightSkyBox, 0.0f);
+    pointLightEnabled = true;
+    gps::TextureUploader::get().flush();
+    glfwSwapInterval(0);
+    gps::GLStateCache::get().disable(GL_MULTISAMPLE);
+
+    startBenchmarkRun(BENCHMARK_FORWARD);
+}
 
-        gRain.draw(projection, view);
+void reportBenchmark() {
+    gps::GpuTimer* timers[] = { &opaqueTimers[0], &opaqueTimers[1], &deferredTimers[0], &deferredTimers[1] };
+    for (int i = 0; i < 4; i++) {
+        timers[i]->collectPending();
     }
 
-    // 8) Draw the "sun" cube
-    lightShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "view"),
-        1, GL_FALSE, glm::value_ptr(view));
-
-    model = glm::mat4(1.0f);
-    model = glm::translate(model, currentSunPos);
-    model = glm::scale(model, glm::vec3(0.25f, 0.25f, 0.25f));
-    glUniformMatrix4fv(glGetUniformLocation(lightShader.shaderProgram, "model"),
-        1, GL_FALSE, glm::value_ptr(model));
+    double gpuMs[BENCHMARK_RUN_COUNT] = {
+        opaqueTimers[0].getAverageMilliseconds(),
+        opaqueTimers[1].getAverageMilliseconds(),
+        deferredTimers[0].getAverageMilliseconds() + deferredTimers[1].getAverageMilliseconds()
+    };
+    const char* gpuWork[BENCHMARK_RUN_COUNT] = {
+        "opaque pass, lit per fragment",
+        "depth prepass + opaque pass, lit per fragment",
+        "G-buffer pass + full-screen sun pass + light volumes + composite"
+    };
+
+    std::cout << "[INFO] Benchmark at " << retina_width << "x" << retina_height << " with "
+        << pointLights.size() << " point lights, single sampled (no MSAA), " << benchmarkFrames << " frames per run" << std::endl;
+    std::cout << "[INFO]   GPU times leave out the shadow cascades, sky and rain; the forward opaque pass also"
+        << " draws the sun cube, which the deferred renderer draws with the sky" << std::endl;
+    for (int run = 0; run < BENCHMARK_RUN_COUNT; run++) {
+        std::cout << "[INFO]   " << benchmarkRunName(run) << ": " << gpuMs[run] << " ms GPU ("
+            << gpuWork[run] << "), " << 1000.0 * benchmarkSeconds[run] / benchmarkFrames << " ms per frame" << std::endl;
+    }
+    for (int i = 0; i < 4; i++) {
+        timers[i]->report();
+    }
+}
 
-    lightCube.Draw(lightShader);
+// Counts the frames of the benchmark, starts the next run after each one and quits at the end
+void updateBenchmark() {
+    if (benchmarkFrames <= 0) {
+        return;
+    }
 
-    // 9) Draw skybox
-    mySkyBox.Draw(skyboxShader, view, projection);
-}
+    benchmarkFrame++;
+    if (benchmarkFrame % benchmarkFrames != 0) {
+        return;
+    }
 
-void cleanup() {
-    glDeleteTextures(1, &depthMapTexture);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glDeleteFramebuffers(1, &shadowMapFBO);
+    int run = benchmarkFrame / benchmarkFrames - 1;
+    benchmarkSeconds[run] = glfwGetTime() - benchmarkStart;
+    if (run + 1 < BENCHMARK_RUN_COUNT) {
+        startBenchmarkRun(run + 1);
+        return;
+    }
 
-    glfwDestroyWindow(glWindow);
-    glfwTerminate();
+    reportBenchmark();
+    glfwSetWindowShouldClose(glWindow, GL_TRUE);
 }
 
 void debugCameraPosition() {
@@ -923,31 +1211,82 @@ void debugCameraPosition() {
 
 int main(int argc, const char* argv[])
 {
+    for (int i = 1; i < argc; i++) {
+        if (std::string(argv[i]) == "--vram-budget" && i + 1 < argc) {
+            gpuMemoryBudgetMB = std::strtoul(argv[++i], NULL, 10);
+        }
+        else if (std::string(argv[i]) == "--shadow-cascades" && i + 1 < argc) {
+            shadowCascadeCount = std::atoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--shadow-size" && i + 1 < argc) {
+            shadowMapSize = std::atoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--point-lights" && i + 1 < argc) {
+            pointLightCount = std::atoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--depth-prepass") {
+            depthPrepassEnabled = true;
+        }
+        else if (std::string(argv[i]) == "--shadow-filter-taps" && i + 1 < argc) {
+            shadowFilterTaps = std::atoi(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--shadow-filter-radius" && i + 1 < argc) {
+            shadowFilterRadius = (float)std::atof(argv[++i]);
+        }
+        else if (std::string(argv[i]) == "--renderer" && i + 1 < argc) {
+            deferredShading = std::string(argv[++i]) == "deferred";
+        }
+        else if (std::string(argv[i]) == "--benchmark" && i + 1 < argc) {
+            benchmarkFrames = std::atoi(argv[++i]);
+        }
+    }
+    gps::GpuMemory::get().setBudget(gpuMemoryBudgetMB * 1024 * 1024);
+
     if (!initOpenGLWindow()) {
         glfwTerminate();
         return 1;
     }
 
     initOpenGLState();
+    initShaders();
     initObjects();
     initSkybox();
-    initShaders();
+    waitForShaders();
     initUniforms();
+    initPointLights();
     initFBO();
 
     glCheckError();
+    gps::GpuMemory::get().report();
+
+    if (benchmarkFrames > 0) {
+        startBenchmark();
+    }
+    std::cout << "[INFO] " << (deferredShading ? "Deferred" : "Forward") << " renderer" << std::endl;
 
     lastTimeStamp = glfwGetTime();
 
     while (!glfwWindowShouldClose(glWindow)) {
         double currentTimeStamp = glfwGetTime();
         float deltaTime = static_cast<float>(currentTimeStamp - lastTimeStamp);
-        updateDeltaTimeHeli(currentTimeStamp - lastTimeStamp);
+        if (benchmarkFrames > 0) {
+            deltaTime = benchmarkFrameTime;
+        }
+        updateDeltaTimeHeli(deltaTime);
         lastTimeStamp = currentTimeStamp;
 
+        gps::GLStateCache::get().beginFrame();
+
+        // released meshes are compacted while no packet refers to the pool
+        gps::GeometryPool::get<gps::Vertex>().defragment();
+
+        // textures keep streaming in while the first frames render
+        gps::TextureUploader::get().pump();
+
         processMovement();
         updateCameraAnimation(deltaTime);
         renderScene(deltaTime);
+        updateBenchmark();
         //debugCameraPosition();
         
         glfwPollEvents();
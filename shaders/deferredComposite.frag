@@ -0,0 +1,20 @@
+#version 410 core
+
+// Last pass of the deferred renderer: the lighting summed in the light target goes to the
+// screen with the G-buffer depth under it, the passes after this one test against it
+
+out vec4 fColor;
+
+#include <ProgramUniforms>
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbufferDepth, pixel, 0).r;
+
+    // nothing was drawn here, the skybox fills it later
+    if (depth == 1.0)
+        discard;
+
+    fColor = vec4(texelFetch(lightAccumulation, pixel, 0).rgb, 1.0);
+    gl_FragDepth = depth;
+}
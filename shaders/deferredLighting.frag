@@ -0,0 +1,79 @@
+#version 410 core
+
+// Full-screen pass of the deferred renderer: the sun, its shadows, fog and thunder for
+// every pixel the geometry pass covered, lit like shaderStart.frag lights its fragments
+
+out vec4 fColor;
+
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
+
+#include <ProgramUniforms>
+
+// ----------[ Common Phong Lighting Params ]----------
+float shininess = 32.0f;
+
+// eye and world space position of the pixel, rebuilt from the G-buffer depth
+vec4 fPosEye;
+vec3 fPosWorld;
+
+// ---------------------------------------------------------
+//    1) Directional Light Computation (the "sun")
+// ---------------------------------------------------------
+#include <SunLight>
+
+// ---------------------------------------------------------
+//    2) Shadow Computation
+// ---------------------------------------------------------
+#include <ShadowLookup>
+
+
+// ---------------------------------------------------------
+//    3) Fog Computation
+// ---------------------------------------------------------
+#include <Fog>
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbufferDepth, pixel, 0).r;
+
+    // nothing was drawn here, the skybox fills it later
+    if (depth == 1.0)
+        discard;
+
+    vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0))) * 2.0 - 1.0;
+    vec4 posEye = inverseProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    fPosEye = vec4(posEye.xyz / posEye.w, 1.0);
+    fPosWorld = vec3(inverseView * fPosEye);
+
+    vec3 normalEye  = normalize(texelFetch(gbufferNormal, pixel, 0).xyz);
+    vec3 viewDirEye = normalize(-fPosEye.xyz);
+
+    vec3 baseColor = texelFetch(gbufferAlbedo, pixel, 0).rgb;
+    vec3 specMap   = texelFetch(gbufferSpecular, pixel, 0).rgb;
+
+    float shadow = computeShadow();
+    vec3 dirLight = CalcDirectionalLight(normalEye, viewDirEye);
+
+    vec3 directLightContrib = (0.3 * dirLight) + (1.0 - shadow) * (dirLight - 0.3 * dirLight);
+    directLightContrib *= lightColor.a;
+
+    vec3 finalColor = directLightContrib * baseColor
+                    + (1.0 - shadow) * specMap;
+
+    // point lights are added by lightVolume.frag, already fogged and thundered
+#ifdef FOG
+    float fogFactor = computeFogFactor();
+    vec3 foggedColor = mix(fogColor.rgb, finalColor, fogFactor);
+    finalColor = foggedColor;
+#endif
+
+#ifdef RAIN
+    finalColor *= thunderBrightness;
+#endif
+
+    fColor = vec4(finalColor, 1.0);
+
+    // the light volumes after this one test against the scene depth
+    gl_FragDepth = depth;
+}
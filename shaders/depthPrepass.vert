@@ -0,0 +1,34 @@
+#version 410 core
+
+// the lit pass tests GL_EQUAL against this depth, every program of the opaque pass
+// computes gl_Position with the same expressions
+invariant gl_Position;
+
+// without WIND only vPosition is read, from the position-only stream
+#include <MeshVertex>
+
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
+
+#include <ProgramUniforms>
+
+void main()
+{
+    // displaced exactly like shaderStart.vert
+    vec3 displacedPosition = vPosition;
+
+#ifdef WIND
+    float baseStrength  = 0.1;
+    float extraStrength = 0.05 * sin(time * 0.2);
+    float windStrength  = baseStrength + extraStrength;
+
+    float frequency     = 0.5;
+    float wave = sin(vPosition.x * frequency + time)
+               * cos(vPosition.z * frequency + time);
+
+    displacedPosition += vNormal * wave * windStrength;
+#endif
+
+    vec4 posEye = view * model * vec4(displacedPosition, 1.0f);
+    gl_Position = projection * posEye;
+}
@@ -0,0 +1,28 @@
+#version 410 core
+
+// Geometry pass of the deferred renderer, vertices come from shaderStart.vert
+
+in vec3 fNormal;
+in vec2 fTexCoords;
+in vec4 fPosEye;
+in vec3 fPosWorld;
+flat in int fMaterialIndex;
+
+// G-buffer targets, see gps::DeferredRenderer
+layout(location = 0) out vec4 gAlbedo;
+layout(location = 1) out vec4 gNormal;
+layout(location = 2) out vec4 gSpecular;
+
+// ----------[ Materials: texture array layers ]----------
+// materialLayers[fMaterialIndex] = (diffuse, specular)
+#include <MaterialBlock>
+
+#include <ProgramUniforms>
+
+void main() {
+    ivec4 layers = materialLayers[fMaterialIndex];
+
+    gAlbedo   = vec4(texture(materialTextures, vec3(fTexCoords, layers.x)).rgb, 1.0);
+    gNormal   = vec4(normalize(fNormal), 0.0);
+    gSpecular = vec4(texture(materialTextures, vec3(fTexCoords, layers.y)).rgb, 1.0);
+}
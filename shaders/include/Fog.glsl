@@ -0,0 +1,8 @@
+// Exponential squared fog. Needs <FrameBlock> and the eye space position fPosEye
+// declared before it.
+
+float computeFogFactor() {
+    float dist = length(fPosEye.xyz);
+    float fogFactor = exp(-pow(dist * fogDensity, 2.0));
+    return clamp(fogFactor, 0.0, 1.0);
+}
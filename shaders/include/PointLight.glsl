@@ -0,0 +1,31 @@
+// Phong lighting by one point light, shared by the clustered forward shader and the
+// deferred light volumes. Needs <LightBlock> and a shininess float declared before it.
+
+vec3 CalcPointLight(
+    in vec3 normalEye,
+    in vec3 fragPosEye,
+    in vec3 viewDirEye,
+    in vec4 lightPosRadius,
+    in vec3 pointColor) {
+
+    vec3 lightVec = lightPosRadius.xyz - fragPosEye;
+    float distance = length(lightVec);
+    vec3  L = normalize(lightVec);
+
+    vec3 ambient = pointLightTerms.x * pointColor;
+
+    float diff = max(dot(normalEye, L), 0.0);
+    vec3 diffuse = pointLightTerms.y * diff * pointColor;
+
+    vec3 reflection = reflect(-L, normalEye);
+    float specCoeff = pow(max(dot(viewDirEye, reflection), 0.0), shininess);
+    vec3 specular  = pointLightTerms.z * specCoeff * pointColor;
+
+    float att = 1.0 / (attenuation.x + attenuation.y * distance
+                                 + attenuation.z * distance * distance);
+
+    // fades to nothing at the radius the light was binned with
+    float window = clamp(1.0 - pow(distance / lightPosRadius.w, 4.0), 0.0, 1.0);
+
+    return (ambient + diffuse + specular) * att * window * window;
+}
@@ -0,0 +1,96 @@
+// Cascaded shadow lookup with the filters of ShadowCascades. Needs <FrameBlock>,
+// <ProgramUniforms> and the eye and world space positions fPosEye and fPosWorld
+// declared before it.
+
+float shadowIntensity = 0.5;
+
+// ShadowFilter values of ShadowCascades.hpp
+const int SHADOW_FILTER_HARDWARE     = 0;
+const int SHADOW_FILTER_ROTATED_GRID = 1;
+const int SHADOW_FILTER_POISSON      = 2;
+
+const vec2 poissonDisk[16] = vec2[](
+    vec2(-0.94201624, -0.39906216), vec2( 0.94558609, -0.76890725),
+    vec2(-0.09418410, -0.92938870), vec2( 0.34495938,  0.29387760),
+    vec2(-0.91588581,  0.45771432), vec2(-0.81544232, -0.87912464),
+    vec2(-0.38277543,  0.27676845), vec2( 0.97484398,  0.75648379),
+    vec2( 0.44323325, -0.97511554), vec2( 0.53742981, -0.47373420),
+    vec2(-0.26496911, -0.41893023), vec2( 0.79197514,  0.19090188),
+    vec2(-0.24188840,  0.99706507), vec2(-0.81409955,  0.91437590),
+    vec2( 0.19984126,  0.78641367), vec2( 0.14383161, -0.14100790)
+);
+
+// rotation by atan(1/2): no two taps of a square grid share a row or a column
+const mat2 gridRotation = mat2(0.89442719, 0.44721360, -0.44721360, 0.89442719);
+
+// share of the texel around uv that is lit, the hardware compares and weights 2x2 texels
+float shadowTap(vec2 uv, int cascade, float reference) {
+    return texture(shadowMap, vec4(uv, float(cascade), reference));
+}
+
+// per pixel angle of the Poisson disk (interleaved gradient noise)
+float poissonAngle() {
+    return 6.2831853 * fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));
+}
+
+float computeCascadeShadow(int cascade) {
+    vec4 lightSpace = cascadeMatrices[cascade] * vec4(fPosWorld, 1.0);
+    vec3 projCoords = lightSpace.xyz / lightSpace.w;
+    projCoords = projCoords * 0.5 + 0.5;
+
+    if (projCoords.z > 1.0)
+        return 0.0;
+
+    float reference = projCoords.z - shadowBias;
+    vec2 radius = shadowFilterRadius / vec2(textureSize(shadowMap, 0).xy);
+
+    float lit = 0.0;
+    if (shadowFilter == SHADOW_FILTER_ROTATED_GRID) {
+        int side = max(1, int(sqrt(float(shadowFilterTaps))));
+        for (int y = 0; y < side; y++) {
+            for (int x = 0; x < side; x++) {
+                vec2 grid = side > 1 ? vec2(x, y) / float(side - 1) * 2.0 - 1.0 : vec2(0.0);
+                lit += shadowTap(projCoords.xy + gridRotation * grid * radius, cascade, reference);
+            }
+        }
+        lit /= float(side * side);
+    }
+    else if (shadowFilter == SHADOW_FILTER_POISSON) {
+        float angle = poissonAngle();
+        mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+        for (int i = 0; i < shadowFilterTaps; i++) {
+            lit += shadowTap(projCoords.xy + rotation * poissonDisk[i] * radius, cascade, reference);
+        }
+        lit /= float(shadowFilterTaps);
+    }
+    else {
+        lit = shadowTap(projCoords.xy, cascade, reference);
+    }
+
+    return (1.0 - lit) * shadowIntensity;
+}
+
+// first cascade whose slice holds the fragment, cross-faded into the next one
+// over the last cascadeBlend of its depth range
+float computeShadow() {
+    float depth = -fPosEye.z;
+
+    int cascade = 0;
+    while (cascade < cascadeCount && depth > cascadeSplits[cascade])
+        cascade++;
+
+    if (cascade == cascadeCount)
+        return 0.0;
+
+    float shadow = computeCascadeShadow(cascade);
+
+    float sliceStart = cascade > 0 ? cascadeSplits[cascade - 1] : 0.0;
+    float blendStart = cascadeSplits[cascade] - cascadeBlend * (cascadeSplits[cascade] - sliceStart);
+    if (depth > blendStart) {
+        float t = (depth - blendStart) / (cascadeSplits[cascade] - blendStart);
+        // past the last cascade the shadow fades out instead
+        float next = cascade + 1 < cascadeCount ? computeCascadeShadow(cascade + 1) : 0.0;
+        shadow = mix(shadow, next, t);
+    }
+    return shadow;
+}
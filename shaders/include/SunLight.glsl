@@ -0,0 +1,20 @@
+// Phong lighting by the sun, shared by the forward and deferred shaders.
+// Needs <FrameBlock> and a shininess float declared before it.
+
+vec3 CalcDirectionalLight(in vec3 normalEye, in vec3 viewDirEye) {
+    // basic ambient
+    float ambientStrength = 0.01f;
+    vec3  ambient = ambientStrength * lightColor.rgb;
+
+    // diffuse
+    float diff = max(dot(normalEye, normalize(lightDir.xyz)), 0.0f);
+    vec3 diffuse = diff * lightColor.rgb;
+
+    // specular
+    vec3 reflection = reflect(-normalize(lightDir.xyz), normalEye);
+    float specCoeff = pow(max(dot(viewDirEye, reflection), 0.0f), shininess);
+    float specularStrength = 1.0f;
+    vec3 specular = specularStrength * specCoeff * lightColor.rgb;
+
+    return (ambient + diffuse + specular);
+}
@@ -1,14 +1,17 @@
 #version 410 core
 
-layout(location=0) in vec3 vPosition;
-layout(location=1) in vec3 vNormal;
-layout(location=2) in vec2 vTexCoords;
+// drawn in the depth prepass as well, see depthPrepass.vert
+invariant gl_Position;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include <MeshVertex>
+
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
+
+#include <ProgramUniforms>
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	vec4 posEye = view * model * vec4(vPosition, 1.0f);
+	gl_Position = projection * posEye;
 }
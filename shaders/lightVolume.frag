@@ -0,0 +1,73 @@
+#version 410 core
+
+// Light volume pass of the deferred renderer: every pixel under the back faces of a
+// light's sphere adds that light, blended on top of deferredLighting.frag
+
+flat in int fLight;
+
+out vec4 fColor;
+
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
+
+// ----------[ Multiple Point Lights ]----------
+// terms = (ambient, diffuse, specular), attenuation = (constant, linear, quadratic)
+#include <LightBlock>
+
+#include <ProgramUniforms>
+
+// ----------[ Common Phong Lighting Params ]----------
+float shininess = 32.0f;
+
+// eye space position of the pixel, rebuilt from the G-buffer depth
+vec4 fPosEye;
+
+// ---------------------------------------------------------
+//    1) Point Light Computation
+// ---------------------------------------------------------
+#include <PointLight>
+
+// ---------------------------------------------------------
+//    2) Fog Computation
+// ---------------------------------------------------------
+#include <Fog>
+
+void main() {
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = texelFetch(gbufferDepth, pixel, 0).r;
+
+    if (depth == 1.0)
+        discard;
+
+    vec2 ndc = (gl_FragCoord.xy / vec2(textureSize(gbufferDepth, 0))) * 2.0 - 1.0;
+    vec4 posEye = inverseProjection * vec4(ndc, depth * 2.0 - 1.0, 1.0);
+    fPosEye = vec4(posEye.xyz / posEye.w, 1.0);
+
+    vec4 lightPosRadius = texelFetch(pointLightData, fLight * 2);
+    vec3 lightVec = lightPosRadius.xyz - fPosEye.xyz;
+    // out of the light's reach, nothing to add
+    if (dot(lightVec, lightVec) >= lightPosRadius.w * lightPosRadius.w)
+        discard;
+
+    vec3 normalEye  = normalize(texelFetch(gbufferNormal, pixel, 0).xyz);
+    vec3 viewDirEye = normalize(-fPosEye.xyz);
+
+    vec3 baseColor = texelFetch(gbufferAlbedo, pixel, 0).rgb;
+    vec3 specMap   = texelFetch(gbufferSpecular, pixel, 0).rgb;
+
+    vec3 pointColor = texelFetch(pointLightData, fLight * 2 + 1).rgb;
+    vec3 pointLight = CalcPointLight(normalEye, fPosEye.xyz, viewDirEye, lightPosRadius, pointColor);
+    vec3 finalColor = pointLight * baseColor + pointLight * specMap;
+
+    // fog and thunder are linear in the light, scaling each light's share is the same
+    // as fogging the sum like shaderStart.frag does
+#ifdef FOG
+    finalColor *= computeFogFactor();
+#endif
+
+#ifdef RAIN
+    finalColor *= thunderBrightness;
+#endif
+
+    fColor = vec4(finalColor, 1.0);
+}
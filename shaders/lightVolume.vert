@@ -0,0 +1,21 @@
+#version 410 core
+
+// Sphere around one point light per instance, scaled to the light's radius; the unit
+// sphere of gps::DeferredRenderer already encloses the exact one
+#include <PositionVertex>
+
+flat out int fLight;
+
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
+
+#include <ProgramUniforms>
+
+void main()
+{
+    fLight = gl_InstanceID;
+
+    // view space position and radius
+    vec4 lightPosRadius = texelFetch(pointLightData, gl_InstanceID * 2);
+    gl_Position = projection * vec4(lightPosRadius.xyz + vertexPosition * lightPosRadius.w, 1.0);
+}
@@ -1,6 +1,6 @@
 #version 410 core
 
-uniform vec3 rainColor;
+#include <ProgramUniforms>
 
 out vec4 fragColor;
 
@@ -1,9 +1,9 @@
 #version 410 core
 
-layout(location = 0) in vec3 vertexPosition;
+#include <PositionVertex>
 
-uniform mat4 projection;
-uniform mat4 view;
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
 
 void main() {
     gl_Position = projection * view * vec4(vertexPosition, 1.0);
@@ -4,10 +4,20 @@ in vec2 fTexCoords;
 
 out vec4 fColor;
 
-uniform sampler2D depthMap;
+#include <FrameBlock>
+
+#include <ProgramUniforms>
 
 void main() 
 {    
-    fColor = vec4(vec3(texture(depthMap, fTexCoords).r), 1.0f);
+    // one quadrant per shadow cascade
+    vec2 tile = floor(fTexCoords * 2.0);
+    int cascade = int(tile.y) * 2 + int(tile.x);
+    if (cascade >= cascadeCount) {
+        fColor = vec4(0.0, 0.0, 0.0, 1.0);
+        return;
+    }
+
+    fColor = vec4(vec3(texture(depthMap, vec3(fract(fTexCoords * 2.0), float(cascade))).r), 1.0f);
     //fColor = vec4(fTexCoords, 0.0f, 1.0f);
 }
@@ -1,8 +1,6 @@
 #version 410 core
 
-layout(location=0) in vec3 vPosition;
-layout(location=1) in vec3 vNormal;
-layout(location=2) in vec2 vTexCoords;
+#include <MeshVertex>
 
 out vec2 fTexCoords;
 
@@ -4,164 +4,103 @@ in vec3 fPosition;
 in vec3 fNormal;             
 in vec2 fTexCoords;          
 in vec4 fPosEye;             
-in vec4 fragPosLightSpace;   
+in vec3 fPosWorld;
+flat in int fMaterialIndex;
 
 out vec4 fColor;
 
-// ----------[ Directional Light Uniforms ]----------
-uniform vec3 lightDir;
-uniform vec3 lightColor;
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
 
-// ----------[ Multiple Point Lights Uniforms ]----------
-#define MAX_POINT_LIGHTS  10
-uniform int  numPointLights;
+// ----------[ Multiple Point Lights ]----------
+// eye space positions, terms = (ambient, diffuse, specular), attenuation = (constant, linear, quadratic)
+#include <LightBlock>
 
-uniform vec3 pointLightColor;
-uniform float pointLightAmbient;
-uniform float pointLightDiffuse;
-uniform float pointLightSpecular;
-uniform float constantAtt;
-uniform float linearAtt;
-uniform float quadraticAtt;
-
-uniform vec3 pointLightPositions[MAX_POINT_LIGHTS];
-uniform int  enablePointLight;
-uniform float lightBrightness;
-
-// ----------[ Shadow Sampler & Constants ]----------
-uniform sampler2D shadowMap;
-float shadowIntensity = 0.5; 
-
-// ----------[ Diffuse & Specular Textures ]----------
-uniform sampler2D diffuseTexture;
-uniform sampler2D specularTexture;
-
-// ----------[ Fog Uniforms ]----------
-uniform int   enableFog;      
-uniform float fogDensity;    
-uniform vec4  fogColor;      
-
-// ----------[ Thunder Uniforms ]----------
-uniform int   rainEnabled;         
-uniform float thunderBrightness; 
+// ----------[ Materials: texture array layers ]----------
+// materialLayers[fMaterialIndex] = (diffuse, specular)
+#include <MaterialBlock>
 
+// ----------[ Per-draw uniforms & samplers ]----------
+#include <ProgramUniforms>
 
 // ----------[ Common Phong Lighting Params ]----------
-float bias      = 0.005;
 float shininess = 32.0f;
 
 
 // ---------------------------------------------------------
 //    1) Directional Light Computation (the "sun")
 // ---------------------------------------------------------
-vec3 CalcDirectionalLight(in vec3 normalEye, in vec3 viewDirEye) {
-    // basic ambient
-    float ambientStrength = 0.01f;
-    vec3  ambient = ambientStrength * lightColor;
-
-    // diffuse
-    float diff = max(dot(normalEye, normalize(lightDir)), 0.0f);
-    vec3 diffuse = diff * lightColor;
-
-    // specular
-    vec3 reflection = reflect(-normalize(lightDir), normalEye);
-    float specCoeff = pow(max(dot(viewDirEye, reflection), 0.0f), shininess);
-    float specularStrength = 1.0f;
-    vec3 specular = specularStrength * specCoeff * lightColor;
-
-    return (ambient + diffuse + specular);
-}
+#include <SunLight>
 
 // ---------------------------------------------------------
 //    2) Point Light Computation
 // ---------------------------------------------------------
-vec3 CalcPointLight(
-    in vec3 normalEye,
-    in vec3 fragPosEye,
-    in vec3 viewDirEye,
-    in vec3 lightPosEye) {
-
-    vec3 lightVec = lightPosEye - fragPosEye;
-    float distance = length(lightVec);
-    vec3  L = normalize(lightVec);
-
-    vec3 ambient = pointLightAmbient * pointLightColor;
-
-    float diff = max(dot(normalEye, L), 0.0);
-    vec3 diffuse = pointLightDiffuse * diff * pointLightColor;
-
-    vec3 reflection = reflect(-L, normalEye);
-    float specCoeff = pow(max(dot(viewDirEye, reflection), 0.0), shininess);
-    vec3 specular  = pointLightSpecular * specCoeff * pointLightColor;
-
-    float att = 1.0 / (constantAtt + linearAtt * distance
-                                 + quadraticAtt * distance * distance);
-
-    return (ambient + diffuse + specular) * att;
+#include <PointLight>
+
+// lights of the froxel holding this fragment
+vec3 CalcClusteredPointLights(in vec3 normalEye, in vec3 viewDirEye) {
+    ivec2 tile = min(ivec2(gl_FragCoord.xy / clusterScales.xy), clusterCounts.xy - 1);
+    int slice = clamp(int(floor(log(-fPosEye.z) * clusterScales.z + clusterScales.w)), 0, clusterCounts.z - 1);
+    int cluster = (slice * clusterCounts.y + tile.y) * clusterCounts.x + tile.x;
+
+    uvec2 range = texelFetch(clusterLightRanges, cluster).xy;
+    vec3 accum = vec3(0.0);
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(clusterLightIndices, int(range.x + i)).r);
+        vec4 lightPosRadius = texelFetch(pointLightData, light * 2);
+        vec3 pointColor = texelFetch(pointLightData, light * 2 + 1).rgb;
+        accum += CalcPointLight(normalEye, fPosEye.xyz, viewDirEye, lightPosRadius, pointColor);
+    }
+    return accum;
 }
 
 // ---------------------------------------------------------
 //    3) Shadow Computation
 // ---------------------------------------------------------
-float computeShadow() {
-    vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
-    projCoords = projCoords * 0.5 + 0.5;
-
-    if (projCoords.z > 1.0)
-        return 0.0;
-
-    float closestDepth = texture(shadowMap, projCoords.xy).r;
-    float currentDepth = projCoords.z;
-
-    float shadow = currentDepth - bias > closestDepth ? shadowIntensity : 0.0;
-    return shadow;
-}
+#include <ShadowLookup>
 
 
 // ---------------------------------------------------------
 //    4) Fog Computation
 // ---------------------------------------------------------
-float computeFogFactor() {
-    float dist = length(fPosEye.xyz);
-    float fogFactor = exp(-pow(dist * fogDensity, 2.0));
-    return clamp(fogFactor, 0.0, 1.0);
-}
+#include <Fog>
 
 void main() {
     vec3 normalEye  = normalize(fNormal);
     vec3 viewDirEye = normalize(-fPosEye.xyz);
 
-    vec3 baseColor = texture(diffuseTexture, fTexCoords).rgb;
-    vec3 specMap   = texture(specularTexture, fTexCoords).rgb;
+    ivec4 layers   = materialLayers[fMaterialIndex];
+    vec3 baseColor = texture(materialTextures, vec3(fTexCoords, layers.x)).rgb;
+    vec3 specMap   = texture(materialTextures, vec3(fTexCoords, layers.y)).rgb;
 
     float shadow = computeShadow();
     vec3 dirLight = CalcDirectionalLight(normalEye, viewDirEye);
 
     vec3 directLightContrib = (0.3 * dirLight) + (1.0 - shadow) * (dirLight - 0.3 * dirLight);
-    directLightContrib *= lightBrightness;
+    directLightContrib *= lightColor.a;
 
     vec3 directionalResult = directLightContrib * baseColor
                            + (1.0 - shadow) * specMap;
 
-    vec3 pointLightsAccum = vec3(0.0);
-    for (int i = 0; i < numPointLights; i++)
-    {
-        vec3 lightContribution = CalcPointLight(normalEye, fPosEye.xyz, viewDirEye, pointLightPositions[i]);
-        pointLightsAccum += lightContribution;
-    }
+    vec3 finalColor = directionalResult;
+
+    // features are compiled in per permutation (see gps::ShaderVariants)
+#ifdef POINT_LIGHTS
+    vec3 pointLightsAccum = CalcClusteredPointLights(normalEye, viewDirEye);
     pointLightsAccum = pointLightsAccum * baseColor + pointLightsAccum * specMap;
 
-    vec3 finalColor = directionalResult + float(enablePointLight) * pointLightsAccum;
+    finalColor += pointLightsAccum;
+#endif
 
-    if (enableFog == 1) {
-        float fogFactor = computeFogFactor();
-        vec3 foggedColor = mix(fogColor.rgb, finalColor, fogFactor);
-        finalColor = foggedColor;
-    }
+#ifdef FOG
+    float fogFactor = computeFogFactor();
+    vec3 foggedColor = mix(fogColor.rgb, finalColor, fogFactor);
+    finalColor = foggedColor;
+#endif
 
-    if (rainEnabled == 1) {
-        finalColor *= thunderBrightness;
-    }
+#ifdef RAIN
+    finalColor *= thunderBrightness;
+#endif
 
     fColor = vec4(finalColor, 1.0);
 }
@@ -1,45 +1,39 @@
 #version 410 core
 
-layout(location=0) in vec3 vPosition;
-layout(location=1) in vec3 vNormal;
-layout(location=2) in vec2 vTexCoords;
+// must match depthPrepass.vert bit for bit, the lit pass tests GL_EQUAL after a prepass
+invariant gl_Position;
+
+#include <MeshVertex>
 
 out vec3 fNormal;
 out vec4 fPosEye;
 out vec2 fTexCoords;
-out vec4 fragPosLightSpace;
-
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
-uniform mat3 normalMatrix;
-uniform mat4 lightSpaceTrMatrix;
+out vec3 fPosWorld;
+flat out int fMaterialIndex;
 
-uniform float time;
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
 
-uniform int enableWind;
+#include <ProgramUniforms>
 
 void main()
 {
     //---------------------------------------------
-    // 1) Wind displacement
+    // 1) Wind displacement, only in the WIND permutation
     //---------------------------------------------
+    vec3 displacedPosition = vPosition;
+
+#ifdef WIND
     float baseStrength  = 0.1;
     float extraStrength = 0.05 * sin(time * 0.2);
-    float windStrength  = (enableWind == 1) 
-                            ? (baseStrength + extraStrength)
-                            : 0.0;   
+    float windStrength  = baseStrength + extraStrength;
 
     float frequency     = 0.5;
-    float wave = 0.0;
-
-    if (enableWind == 1)
-    {
-        wave = sin(vPosition.x * frequency + time)
-             * cos(vPosition.z * frequency + time);
-    }
+    float wave = sin(vPosition.x * frequency + time)
+               * cos(vPosition.z * frequency + time);
 
-    vec3 displacedPosition = vPosition + vNormal * wave * windStrength;
+    displacedPosition += vNormal * wave * windStrength;
+#endif
 
     //---------------------------------------------
     // 2) Usual transformations
@@ -47,7 +41,8 @@ void main()
     fPosEye  = view * model * vec4(displacedPosition, 1.0f);
     fNormal  = normalize(normalMatrix * vNormal);
     fTexCoords = vTexCoords;
-    fragPosLightSpace = lightSpaceTrMatrix * model * vec4(displacedPosition, 1.0f);
+    fMaterialIndex = vMaterialIndex;
+    fPosWorld = vec3(model * vec4(displacedPosition, 1.0f));
 
     gl_Position = projection * fPosEye;
 }
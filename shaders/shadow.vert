@@ -1,32 +1,30 @@
 #version 410 core
 
-layout(location=0) in vec3 vPosition;
-layout(location=1) in vec3 vNormal;
-layout(location=2) in vec2 vTexCoords;
+// without WIND only vPosition is read: the casters are drawn from the position-only
+// stream, which feeds location 0 and leaves the other attributes disabled
+#include <MeshVertex>
 
-uniform mat4 model;
-uniform mat4 lightSpaceTrMatrix;
-uniform float time;
-uniform int enableWind;
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
+
+#include <ProgramUniforms>
 
 void main()
 {
+    // the shadow caster has to sway exactly like the lit geometry
+    vec3 displacedPosition = vPosition;
+
+#ifdef WIND
     float baseStrength  = 0.1;
     float extraStrength = 0.05 * sin(time * 0.2);
-    float windStrength  = (enableWind == 1)
-                            ? (baseStrength + extraStrength)
-                            : 0.0;
+    float windStrength  = baseStrength + extraStrength;
 
     float frequency     = 0.5;
-    float wave = 0.0;
-
-    if (enableWind == 1)
-    {
-        wave = sin(vPosition.x * frequency + time)
-             * cos(vPosition.z * frequency + time);
-    }
+    float wave = sin(vPosition.x * frequency + time)
+               * cos(vPosition.z * frequency + time);
 
-    vec3 displacedPosition = vPosition + vNormal * wave * windStrength;
+    displacedPosition += vNormal * wave * windStrength;
+#endif
 
-    gl_Position = lightSpaceTrMatrix * model * vec4(displacedPosition, 1.0);
+    gl_Position = cascadeMatrices[shadowCascade] * model * vec4(displacedPosition, 1.0);
 }
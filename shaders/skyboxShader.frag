@@ -3,9 +3,9 @@
 in vec3 textureCoordinates;
 out vec4 color;
 
-uniform samplerCube skybox;
+#include <ProgramUniforms>
 
 void main()
 {
-    color = texture(skybox, textureCoordinates);
+    color = mix(texture(skybox, textureCoordinates), texture(skyboxNext, textureCoordinates), blendFactor);
 }
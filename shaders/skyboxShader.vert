@@ -1,15 +1,15 @@
 #version 410 core
 
-layout (location = 0) in vec3 vertexPosition;
+#include <PositionVertex>
 out vec3 textureCoordinates;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+// ----------[ Per-frame state, shared by every program ]----------
+#include <FrameBlock>
 
 void main()
 {
-    vec4 tempPos = projection * view * vec4(vertexPosition, 1.0);
+    //the skybox follows the camera, only the rotation of the view is kept
+    vec4 tempPos = projection * mat4(mat3(view)) * vec4(vertexPosition, 1.0);
     gl_Position = tempPos.xyww;
     textureCoordinates = vertexPosition;
 }